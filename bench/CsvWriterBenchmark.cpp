@@ -0,0 +1,153 @@
+/**
+ * Measures how many stat records per second the output formatting sustains, in the raw and human-readable
+ * formats, with \ref pstat::CsvWriter and with the std::ofstream formatting it replaced. Records are synthetic
+ * (so the filesystem is out of the picture) and the output goes to /dev/null.
+ *
+ * Usage: csv-writer-bench [records]
+ */
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+
+#include "config.h"
+#include "CsvWriter.hpp"
+#include "Stopwatch.hpp"
+
+#define BENCHMARK_DIRECTORY_SIZE 50 //!< Number of consecutive records sharing a directory, as the walker produces them
+
+using namespace pstat;
+
+/**
+ * \brief Fills the specified chunks with the specified number of synthetic records, and the specified directory paths
+ */
+void generate(size_t count, std::vector<std::unique_ptr<RecordChunk>>& chunks, std::vector<std::string>& dirs)
+{
+	struct stat sb;
+	char name[64];
+	unsigned seed = 42;
+
+	memset(&sb, 0, sizeof(sb));
+
+	for (size_t i = 0; i < count; i++)
+	{
+		if (chunks.empty() || chunks.back()->isFull())
+		{
+			chunks.push_back(std::unique_ptr<RecordChunk>(new RecordChunk(RECORD_CHUNK_SIZE)));
+		}
+
+		if (i % BENCHMARK_DIRECTORY_SIZE == 0)
+		{
+			snprintf(name, sizeof(name), "/data/projects/group%zu/user%zu/run%zu", i % 7, i % 31, i / BENCHMARK_DIRECTORY_SIZE);
+			dirs.push_back(name);
+		}
+
+		seed = seed * 1103515245 + 12345;
+
+		sb.st_dev = 64768;
+		sb.st_ino = 1000000 + i;
+		sb.st_nlink = 1;
+		sb.st_mode = (i % 10 == 0 ? S_IFDIR | 0755 : S_IFREG | 0644);
+		sb.st_uid = (i % 3 == 0 ? 0 : getuid());
+		sb.st_gid = (i % 3 == 0 ? 0 : getgid());
+		sb.st_size = seed % 100000000;
+		sb.st_blocks = sb.st_size / 512 + 1;
+		sb.st_atime = 1600000000 + seed % 100000000; // A few years' worth of dates
+		sb.st_mtime = sb.st_atime - seed % 1000000;
+
+		int length = snprintf(name, sizeof(name), i % 1000 == 0 ? "report \"%zu\".txt" : "output_%zu.dat", i);
+		chunks.back()->add(sb, dirs.size() - 1, name, length);
+	}
+}
+
+/**
+ * \brief Formats the specified records the way the walker did before \ref CsvWriter
+ */
+void formatWithStream(bool human, const std::vector<std::unique_ptr<RecordChunk>>& chunks, const std::vector<std::string>& dirs)
+{
+	std::ofstream out("/dev/null");
+	std::string path;
+
+	for (const std::unique_ptr<RecordChunk>& chunk : chunks)
+	{
+		for (size_t i = 0; i < chunk->size(); i++)
+		{
+			const StatRecord& rec = (*chunk)[i];
+
+			path.assign(dirs[rec.parent]);
+			DirectoryTable::appendName(path, chunk->getName(rec), rec.nameLength);
+
+			if (!human)
+			{
+				out << rec.dev << "-" << rec.ino << "," << rec.atime << "," << rec.mtime << "," << rec.uid << ","
+					<< rec.gid << "," << rec.mode << "," << rec.size << "," << rec.blocks * 512ll << ","
+					<< '"' << path << '"' << "\n";
+			}
+			else
+			{
+				CachedUtilities& utilities = CachedUtilities::getInstance();
+				char atime[16];
+				char mtime[16];
+
+				*utilities.formatDate(atime, rec.atime) = '\0';
+				*utilities.formatDate(mtime, rec.mtime) = '\0';
+
+				out << rec.dev << "-" << rec.ino << "," << rec.nlink << ","
+					<< atime << "," << mtime << ","
+					<< utilities.uidToUsername(rec.uid) << "," << utilities.gidToGroupname(rec.gid) << ","
+					<< utilities.getEffectiveFilePermissions(rec.mode) << "," << rec.size << "," << rec.blocks * 512ll << ","
+					<< utilities.getFileType(rec.mode) << "," << '"' << path << '"' << "\n";
+			}
+		}
+	}
+}
+
+/**
+ * \brief Formats the specified records with a \ref CsvWriter
+ */
+void formatWithWriter(bool human, const std::vector<std::unique_ptr<RecordChunk>>& chunks, const std::vector<std::string>& dirs)
+{
+	CsvWriter writer(human);
+	writer.open("/dev/null");
+
+	for (const std::unique_ptr<RecordChunk>& chunk : chunks)
+	{
+		for (size_t i = 0; i < chunk->size(); i++)
+		{
+			const StatRecord& rec = (*chunk)[i];
+			const std::string& dir = dirs[rec.parent];
+
+			writer.writeRecord(rec, dir.data(), dir.size(), chunk->getName(rec), rec.nameLength);
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	size_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : 2000000;
+	std::vector<std::unique_ptr<RecordChunk>> chunks;
+	std::vector<std::string> dirs;
+
+	CachedUtilities::init(true);
+	generate(count, chunks, dirs);
+
+	std::cout << "Formatting " << count << " records to /dev/null" << std::endl;
+
+	for (int human = 0; human <= 1; human++)
+	{
+		for (int writer = 0; writer <= 1; writer++)
+		{
+			Stopwatch sw(true);
+
+			writer ? formatWithWriter(human, chunks, dirs) : formatWithStream(human, chunks, dirs);
+
+			sw.stop();
+			double seconds = sw.getElapsed();
+
+			std::cout << (human ? "human" : "raw  ") << "  " << (writer ? "CsvWriter" : "ofstream ") << "  "
+				<< static_cast<long>(count / seconds) << " records/s" << std::endl;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,624 @@
+/**
+ * Benchmarks pstat end to end: generates deterministic synthetic trees (once, then reuses them), runs one or more
+ * pstat builds on them across thread counts and output modes, and reports each run as a CSV line on stdout: the
+ * files per second, the CPU time, the peak RSS and the size of the output. Progress goes to stderr.
+ *
+ * The trees are:
+ * - wide: a root holding sqrt(entries) directories, each holding the same number of files
+ * - deep: chains of BENCHMARK_DEEP_LEVELS nested directories, with a few files at each level
+ * - huge: a single directory holding all the files
+ * - small: a tree of directories with BENCHMARK_SMALL_FANOUT subdirectories each, holding a few files each
+ * - long: chains of nested directories with long names, holding files with long names (paths of thousands of bytes)
+ * - hardlinks: files that each have a second link in another directory
+ *
+ * Usage: pstat-bench [--pstat=bin/release/pstat,...] [--dir=...] [--entries=100000] [--trees=wide,deep,...]
+ *                    [--threads=1,2,4,...] [--modes=raw,human] [--runs=3] [--args='--statx ...']
+ */
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <thread>
+#include <fcntl.h>
+#include <ftw.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "vendor/cmdline.h"
+
+#define BENCHMARK_DEFAULT_ENTRIES 100000 //!< Default number of entries of each tree
+#define BENCHMARK_SEED 0x5eedull //!< Seed of the pseudo-random sizes, times and names, so that trees are the same on every machine
+#define BENCHMARK_DEEP_LEVELS 100 //!< Depth of each chain of directories of the deep tree
+#define BENCHMARK_DEEP_FILES 4 //!< Number of files at each level of the deep tree
+#define BENCHMARK_SMALL_FANOUT 16 //!< Number of subdirectories of each directory of the small tree
+#define BENCHMARK_SMALL_FILES 3 //!< Number of files of each directory of the small tree
+#define BENCHMARK_LONG_LEVELS 20 //!< Depth of each chain of directories of the long tree
+#define BENCHMARK_LONG_FILES 10 //!< Number of files at each level of the long tree
+#define BENCHMARK_LINKS_PER_DIRECTORY 100 //!< Number of files of each directory of the hardlinks tree
+
+/**
+ * \brief Generates a deterministic sequence of pseudo-random numbers (xorshift64*)
+ */
+class Random
+{
+	u_int64_t m_State; //!< The state of the generator
+
+public:
+
+	Random(u_int64_t seed) : m_State(seed)
+	{
+	}
+
+	/**
+	 * \brief Returns the next number of the sequence
+	 */
+	u_int64_t next()
+	{
+		m_State ^= m_State >> 12;
+		m_State ^= m_State << 25;
+		m_State ^= m_State >> 27;
+
+		return m_State * 0x2545f4914f6cdd1dull;
+	}
+};
+
+/**
+ * \brief Creates the entries of a synthetic tree, giving the files pseudo-random sizes (sparse) and times, and
+ * counts them
+ */
+class TreeBuilder
+{
+	Random m_Random; //!< Draws the sizes and times of the files
+	u_int64_t m_Entries; //!< Number of entries created, the root included
+	bool m_Failed; //!< Set once an entry cannot be created
+
+	/**
+	 * \brief Reports the failure of the specified operation on the specified path
+	 */
+	bool fail(const char* operation, const std::string& path)
+	{
+		if (!m_Failed)
+		{
+			std::cerr << "Error: cannot " << operation << " " << path << ": " << strerror(errno) << std::endl;
+		}
+
+		m_Failed = true;
+		return false;
+	}
+
+public:
+
+	TreeBuilder() : m_Random(BENCHMARK_SEED), m_Entries(0), m_Failed(false)
+	{
+	}
+
+	/**
+	 * \brief Creates the specified directory
+	 */
+	bool directory(const std::string& path)
+	{
+		if (mkdir(path.c_str(), 0755) != 0)
+		{
+			return fail("create", path);
+		}
+
+		m_Entries++;
+		return true;
+	}
+
+	/**
+	 * \brief Creates the specified file, of up to 1 MB (without allocating it), accessed and modified within the last
+	 * few years
+	 */
+	bool file(const std::string& path)
+	{
+		int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+		if (fd < 0)
+		{
+			return fail("create", path);
+		}
+
+		struct timespec times[2];
+		times[0].tv_sec = 1500000000 + m_Random.next() % 200000000;
+		times[0].tv_nsec = 0;
+		times[1].tv_sec = times[0].tv_sec - m_Random.next() % 10000000;
+		times[1].tv_nsec = 0;
+
+		bool created = ftruncate(fd, m_Random.next() % (1 << 20)) == 0 && futimens(fd, times) == 0;
+		close(fd);
+
+		if (!created)
+		{
+			return fail("fill", path);
+		}
+
+		m_Entries++;
+		return true;
+	}
+
+	/**
+	 * \brief Creates a hard link of the specified file
+	 */
+	bool link(const std::string& target, const std::string& path)
+	{
+		if (::link(target.c_str(), path.c_str()) != 0)
+		{
+			return fail("link", path);
+		}
+
+		m_Entries++;
+		return true;
+	}
+
+	/**
+	 * \brief Returns a name made of the specified prefix, the specified index, and pseudo-random letters up to the
+	 * specified length
+	 */
+	std::string name(const char* prefix, size_t index, size_t length = 0)
+	{
+		std::string name = prefix + std::to_string(index);
+
+		while (name.size() < length)
+		{
+			name += static_cast<char>('a' + m_Random.next() % 26);
+		}
+
+		return name;
+	}
+
+	/**
+	 * \brief Returns the number of entries created
+	 */
+	u_int64_t getEntries() const
+	{
+		return m_Entries;
+	}
+
+	/**
+	 * \brief Returns true if all the entries were created
+	 */
+	bool isOk() const
+	{
+		return !m_Failed;
+	}
+};
+
+/**
+ * \brief A root holding sqrt(entries) directories, each holding the same number of files
+ */
+void generateWide(TreeBuilder& builder, const std::string& root, u_int64_t entries)
+{
+	u_int64_t dirs = std::max<u_int64_t>(1, std::sqrt(entries));
+
+	for (u_int64_t d = 0; d < dirs && builder.isOk(); d++)
+	{
+		std::string dir = root + "/" + builder.name("d", d);
+		builder.directory(dir);
+
+		for (u_int64_t f = 0; f + 1 < entries / dirs && builder.isOk(); f++)
+		{
+			builder.file(dir + "/" + builder.name("f", f, 12));
+		}
+	}
+}
+
+/**
+ * \brief Chains of nested directories, with a few files at each level
+ */
+void generateDeep(TreeBuilder& builder, const std::string& root, u_int64_t entries)
+{
+	u_int64_t chains = std::max<u_int64_t>(1, entries / (BENCHMARK_DEEP_LEVELS * (BENCHMARK_DEEP_FILES + 1)));
+
+	for (u_int64_t c = 0; c < chains && builder.isOk(); c++)
+	{
+		std::string dir = root + "/" + builder.name("c", c);
+		builder.directory(dir);
+
+		for (int level = 0; level < BENCHMARK_DEEP_LEVELS && builder.isOk(); level++)
+		{
+			dir += "/" + builder.name("l", level);
+			builder.directory(dir);
+
+			for (int f = 0; f < BENCHMARK_DEEP_FILES; f++)
+			{
+				builder.file(dir + "/" + builder.name("f", f, 8));
+			}
+		}
+	}
+}
+
+/**
+ * \brief A single directory holding all the files
+ */
+void generateHuge(TreeBuilder& builder, const std::string& root, u_int64_t entries)
+{
+	for (u_int64_t f = 0; f + 1 < entries && builder.isOk(); f++)
+	{
+		builder.file(root + "/" + builder.name("f", f, 16));
+	}
+}
+
+/**
+ * \brief A tree of directories with a fixed fanout, each holding a few files
+ */
+void generateSmall(TreeBuilder& builder, const std::string& root, u_int64_t entries)
+{
+	u_int64_t count = std::max<u_int64_t>(1, entries / (BENCHMARK_SMALL_FILES + 1));
+	std::vector<std::string> dirs(1, root);
+
+	// Directory i (1-based) is a child of directory (i - 1) / fanout, so the tree is filled breadth first
+	for (u_int64_t d = 1; d < count && builder.isOk(); d++)
+	{
+		dirs.push_back(dirs[(d - 1) / BENCHMARK_SMALL_FANOUT] + "/" + builder.name("d", d));
+		builder.directory(dirs.back());
+	}
+
+	for (const std::string& dir : dirs)
+	{
+		for (int f = 0; f < BENCHMARK_SMALL_FILES && builder.isOk(); f++)
+		{
+			builder.file(dir + "/" + builder.name("f", f, 10));
+		}
+	}
+}
+
+/**
+ * \brief Chains of nested directories with long names, holding files with long names
+ */
+void generateLong(TreeBuilder& builder, const std::string& root, u_int64_t entries)
+{
+	u_int64_t chains = std::max<u_int64_t>(1, entries / (BENCHMARK_LONG_LEVELS * (BENCHMARK_LONG_FILES + 1)));
+
+	for (u_int64_t c = 0; c < chains && builder.isOk(); c++)
+	{
+		std::string dir = root + "/" + builder.name("chain", c, 100);
+		builder.directory(dir);
+
+		for (int level = 0; level < BENCHMARK_LONG_LEVELS && builder.isOk(); level++)
+		{
+			dir += "/" + builder.name("level", level, 100);
+			builder.directory(dir);
+
+			for (int f = 0; f < BENCHMARK_LONG_FILES; f++)
+			{
+				builder.file(dir + "/" + builder.name("file", f, 150));
+			}
+		}
+	}
+}
+
+/**
+ * \brief Files that each have a second link in another directory
+ */
+void generateHardlinks(TreeBuilder& builder, const std::string& root, u_int64_t entries)
+{
+	u_int64_t files = entries / 2;
+
+	builder.directory(root + "/files");
+	builder.directory(root + "/links");
+
+	for (u_int64_t f = 0; f < files && builder.isOk(); f++)
+	{
+		std::string dir = std::to_string(f / BENCHMARK_LINKS_PER_DIRECTORY);
+		std::string name = builder.name("f", f, 12);
+
+		if (f % BENCHMARK_LINKS_PER_DIRECTORY == 0)
+		{
+			builder.directory(root + "/files/" + dir);
+			builder.directory(root + "/links/" + dir);
+		}
+
+		builder.file(root + "/files/" + dir + "/" + name) && builder.link(root + "/files/" + dir + "/" + name, root + "/links/" + dir + "/" + name);
+	}
+}
+
+/**
+ * \brief A shape of synthetic tree
+ */
+struct TreeShape
+{
+	const char* name; //!< Name of the shape
+	void (*generate)(TreeBuilder&, const std::string&, u_int64_t); //!< Creates the entries of a tree under its root
+};
+
+static const TreeShape TREE_SHAPES[] = {
+	{"wide", generateWide},
+	{"deep", generateDeep},
+	{"huge", generateHuge},
+	{"small", generateSmall},
+	{"long", generateLong},
+	{"hardlinks", generateHardlinks}
+};
+
+/**
+ * \brief Removes the specified entry, for nftw()
+ */
+int removeEntry(const char* path, const struct stat*, int, struct FTW*)
+{
+	return remove(path);
+}
+
+/**
+ * \brief Returns the root of the tree of the specified shape and size, generating it unless a previous run did.
+ * A tree is complete once its marker file, which holds its number of entries, exists next to it.
+ * \return True on success, false otherwise
+ */
+bool prepareTree(const std::string& dir, const TreeShape& shape, u_int64_t entries, std::string& root, u_int64_t& count)
+{
+	root = dir + "/" + shape.name + "-" + std::to_string(entries);
+	std::string marker = root + ".done";
+	std::ifstream in(marker.c_str());
+
+	if (in >> count)
+	{
+		return true;
+	}
+
+	std::cerr << "-- Generating the " << shape.name << " tree (" << entries << " entries) in " << root << std::endl;
+
+	// Leftovers of an interrupted generation
+	nftw(root.c_str(), removeEntry, 64, FTW_DEPTH | FTW_PHYS);
+
+	TreeBuilder builder;
+
+	if (!builder.directory(root))
+	{
+		return false;
+	}
+
+	shape.generate(builder, root, entries);
+
+	if (!builder.isOk())
+	{
+		return false;
+	}
+
+	count = builder.getEntries();
+	std::ofstream out(marker.c_str());
+	out << count << "\n";
+
+	return static_cast<bool>(out);
+}
+
+/**
+ * \brief Measurements of a run of pstat
+ */
+struct RunResult
+{
+	double seconds; //!< Wall-clock time
+	double userSeconds; //!< CPU time in user mode
+	double systemSeconds; //!< CPU time in kernel mode
+	long peakRssKb; //!< Peak resident set size, in kilobytes
+	u_int64_t outputBytes; //!< Size of the output file
+	int exitStatus; //!< Exit status, or -1 if pstat did not exit normally
+};
+
+/**
+ * \brief Runs the specified pstat binary with the specified arguments, discarding its standard output
+ * \return True if pstat could be started, false otherwise
+ */
+bool runPstat(const std::vector<std::string>& args, const std::string& outputPath, RunResult& result)
+{
+	std::vector<char*> argv;
+
+	for (const std::string& arg : args)
+	{
+		argv.push_back(const_cast<char*>(arg.c_str()));
+	}
+
+	argv.push_back(NULL);
+	unlink(outputPath.c_str());
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	pid_t pid = fork();
+
+	if (pid < 0)
+	{
+		return false;
+	}
+
+	if (pid == 0)
+	{
+		int null = open("/dev/null", O_WRONLY);
+		dup2(null, STDOUT_FILENO);
+		execv(argv[0], &argv[0]);
+		_exit(127);
+	}
+
+	int status;
+	struct rusage usage;
+
+	if (wait4(pid, &status, 0, &usage) < 0)
+	{
+		return false;
+	}
+
+	struct stat sb;
+
+	result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	result.userSeconds = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6;
+	result.systemSeconds = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+	result.peakRssKb = usage.ru_maxrss;
+	result.outputBytes = stat(outputPath.c_str(), &sb) == 0 ? sb.st_size : 0;
+	result.exitStatus = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+	unlink(outputPath.c_str());
+
+	return result.exitStatus != 127;
+}
+
+/**
+ * \brief Splits the specified string by the specified delimiter, dropping empty elements and keeping their order
+ */
+std::vector<std::string> split(const std::string& s, char delim)
+{
+	std::vector<std::string> elems;
+	std::stringstream ss(s);
+	std::string item;
+
+	while (std::getline(ss, item, delim))
+	{
+		if (item.length() != 0)
+		{
+			elems.push_back(item);
+		}
+	}
+
+	return elems;
+}
+
+/**
+ * \brief Returns the pstat arguments of the specified output mode, or false if it is unknown
+ */
+bool getModeArgs(const std::string& mode, std::vector<std::string>& args)
+{
+	if (mode == "raw")
+	{
+		return true;
+	}
+
+	if (mode == "human")
+	{
+		args.push_back("--human");
+		return true;
+	}
+
+	if (mode == "columnar")
+	{
+		args.push_back("--format=columnar");
+		return true;
+	}
+
+	if (mode == "gzip")
+	{
+		args.push_back("--compress");
+		return true;
+	}
+
+	return false;
+}
+
+int main(int argc, char** argv)
+{
+	unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+	std::string defaultThreads = "1";
+
+	for (unsigned threads = 2; threads <= 4 * cores; threads *= 2)
+	{
+		defaultThreads += "," + std::to_string(threads);
+	}
+
+	cmdline::parser argsParser;
+	argsParser.set_program_name(argv[0]);
+	argsParser.add<std::string>("pstat", 'p', "pstat binaries to compare, separated by a comma. Default is bin/release/pstat.",
+			false, "bin/release/pstat");
+	argsParser.add<std::string>("dir", 'd', "Directory where the trees are generated and kept, preferably on tmpfs so that "
+			"the disk is out of the picture. Default is /dev/shm/pstat-bench.", false, "/dev/shm/pstat-bench");
+	argsParser.add<u_int64_t>("entries", 'n', "Approximate number of entries of each tree. Default is 100000.", false,
+			BENCHMARK_DEFAULT_ENTRIES);
+	argsParser.add<std::string>("trees", 'T', "Trees to run on, separated by a comma, among wide, deep, huge, small, long and "
+			"hardlinks. Default is all of them.", false, "wide,deep,huge,small,long,hardlinks");
+	argsParser.add<std::string>("threads", 't', "Numbers of walker threads, separated by a comma. Default is 1 and the powers "
+			"of 2 up to 4 times the number of cores.", false, defaultThreads);
+	argsParser.add<std::string>("modes", 'm', "Output modes, separated by a comma, among raw, human, columnar and gzip. "
+			"Default is raw,human.", false, "raw,human");
+	argsParser.add<int>("runs", 'r', "Number of runs of each combination. Default is 3.", false, 3, cmdline::range(1, 1000));
+	argsParser.add<std::string>("args", 'a', "Additional arguments of every pstat run, separated by a space (e.g. '--statx').",
+			false);
+	argsParser.parse_check(argc, argv);
+
+	std::vector<std::string> binaries = split(argsParser.get<std::string>("pstat"), ',');
+	std::string dir = argsParser.get<std::string>("dir");
+	u_int64_t entries = argsParser.get<u_int64_t>("entries");
+	std::vector<std::string> trees = split(argsParser.get<std::string>("trees"), ',');
+	std::vector<std::string> threads = split(argsParser.get<std::string>("threads"), ',');
+	std::vector<std::string> modes = split(argsParser.get<std::string>("modes"), ',');
+	std::vector<std::string> extraArgs = split(argsParser.get<std::string>("args"), ' ');
+	int runs = argsParser.get<int>("runs");
+	std::string outputPath = dir + "/output";
+
+	if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST)
+	{
+		std::cerr << "Error: cannot create " << dir << ": " << strerror(errno) << std::endl;
+		return -1;
+	}
+
+	std::cout << "pstat,tree,entries,threads,mode,run,seconds,files_per_second,user_seconds,system_seconds,peak_rss_kb,"
+			"output_bytes,exit_status" << std::endl;
+
+	for (const std::string& tree : trees)
+	{
+		const TreeShape* shape = NULL;
+		std::string root;
+		u_int64_t count;
+
+		for (const TreeShape& candidate : TREE_SHAPES)
+		{
+			if (tree == candidate.name)
+			{
+				shape = &candidate;
+			}
+		}
+
+		if (shape == NULL)
+		{
+			std::cerr << "Error: unknown tree: " << tree << std::endl;
+			return -1;
+		}
+
+		if (!prepareTree(dir, *shape, entries, root, count))
+		{
+			return -1;
+		}
+
+		for (const std::string& binary : binaries)
+		{
+			for (const std::string& threadCount : threads)
+			{
+				for (const std::string& mode : modes)
+				{
+					std::vector<std::string> args = {binary, "--no-prompt", "--num-threads=" + threadCount, "--output-csv=" + outputPath};
+
+					if (!getModeArgs(mode, args))
+					{
+						std::cerr << "Error: unknown mode: " << mode << std::endl;
+						return -1;
+					}
+
+					args.insert(args.end(), extraArgs.begin(), extraArgs.end());
+					args.push_back(root);
+
+					for (int run = 1; run <= runs; run++)
+					{
+						RunResult result;
+
+						std::cerr << "-- " << binary << " " << tree << " " << threadCount << " threads " << mode << " #" << run << std::endl;
+
+						if (!runPstat(args, outputPath, result))
+						{
+							std::cerr << "Error: cannot run " << binary << std::endl;
+							return -1;
+						}
+
+						std::cout << binary << "," << tree << "," << count << "," << threadCount << "," << mode << "," << run << ","
+								<< result.seconds << "," << static_cast<u_int64_t>(count / result.seconds) << "," << result.userSeconds
+								<< "," << result.systemSeconds << "," << result.peakRssKb << "," << result.outputBytes << ","
+								<< result.exitStatus << std::endl;
+					}
+				}
+			}
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,412 @@
+#ifndef AGGREGATOR_HPP
+#define	AGGREGATOR_HPP
+
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "CachedUtilities.hpp"
+#include "CsvWriter.hpp"
+#include "DirectoryTable.hpp"
+#include "RecordChunk.hpp"
+
+#define AGGREGATE_HISTOGRAM_BUCKETS 64 //!< Number of buckets of the log-scale histograms of a \ref pstat::Aggregator
+#define AGGREGATE_TOTALS_HEADER ",FILES,DIRECTORIES,SIZE,DISK\n" //!< Header of the columns of the totals in the tables of a \ref pstat::Aggregator
+#define AGGREGATE_DEFAULT_DEPTH 3 //!< Default depth, below the collected path, of the directories listed by a \ref pstat::Aggregator
+
+namespace pstat
+{
+	/**
+	 * \brief Accumulates the stat records of a collection into summary tables, instead of outputting them: du-style
+	 * totals of each directory (of its whole subtree), totals per owner user and group, and log-scale histograms of
+	 * the sizes and of the access ages of the regular files.
+	 * Each walker thread feeds its own aggregator, and the aggregators are merged once the walk is complete. Totals
+	 * of directories are only kept for the directories themselves while collecting, and summed up the tree at the end.
+	 * Not thread-safe: each instance must be used by one thread at a time.
+	 */
+	class Aggregator
+	{
+	public:
+		/**
+		 * \brief Totals of a set of entries
+		 */
+		struct Totals
+		{
+			u_int64_t files; //!< Number of entries that are not directories
+			u_int64_t directories; //!< Number of directories
+			u_int64_t size; //!< Total size in bytes
+			u_int64_t blocks; //!< Total number of 512-byte blocks allocated
+
+			/**
+			 * \brief Adds the specified totals to these
+			 */
+			inline void add(const Totals& other)
+			{
+				files += other.files;
+				directories += other.directories;
+				size += other.size;
+				blocks += other.blocks;
+			}
+
+			/**
+			 * \brief Adds the specified entry to these totals. The space on disk of an inode is only added with its first link.
+			 */
+			inline void add(const StatRecord& rec)
+			{
+				(S_ISDIR(rec.mode) ? directories : files)++;
+				size += rec.size;
+				blocks += (rec.flags & RECORD_DUPLICATE_LINK) == 0 ? rec.blocks : 0;
+			}
+		};
+
+	private:
+		std::vector<std::pair<u_int32_t, Totals>> m_Directories; //!< Totals of the entries of each directory (but not of its subdirectories), by id. Ids may repeat
+		std::unordered_map<u_int32_t, Totals> m_Users; //!< Totals per owner user id
+		std::unordered_map<u_int32_t, Totals> m_Groups; //!< Totals per owner group id
+		Totals m_Sizes[AGGREGATE_HISTOGRAM_BUCKETS]; //!< Totals of the regular files per bucket of size
+		Totals m_Ages[AGGREGATE_HISTOGRAM_BUCKETS]; //!< Totals of the regular files per bucket of days since their last access
+		int64_t m_Now; //!< The time the access ages are measured from
+
+		Aggregator(const Aggregator&);
+		Aggregator& operator=(const Aggregator&);
+
+		/**
+		 * \brief Returns the log-scale bucket of the specified value: 0 for 0, and b for [2^(b-1), 2^b)
+		 */
+		static inline int getBucket(u_int64_t value)
+		{
+			return value == 0 ? 0 : 64 - __builtin_clzll(value);
+		}
+
+		/**
+		 * \brief Adds the specified entry to the totals of the specified directory
+		 */
+		inline void addToDirectory(u_int32_t dir, const StatRecord& rec)
+		{
+			// Entries of the same directory mostly come in a row
+			if (m_Directories.empty() || m_Directories.back().first != dir)
+			{
+				Totals totals = {0, 0, 0, 0};
+				m_Directories.push_back(std::make_pair(dir, totals));
+			}
+
+			m_Directories.back().second.add(rec);
+		}
+
+		/**
+		 * \brief Writes the totals of the specified directories, with their paths, to the specified file
+		 * \return 0 on success, the errno of the failure otherwise
+		 */
+		static int writeDirectories(const std::string& path, const std::vector<std::pair<std::string, u_int32_t>>& listed,
+				const std::vector<Totals>& totals)
+		{
+			CsvWriter out(false);
+
+			if (!out.open(path))
+			{
+				return out.getError();
+			}
+
+			out.write("PATH");
+			out.write(AGGREGATE_TOTALS_HEADER);
+
+			for (const std::pair<std::string, u_int32_t>& dir : listed)
+			{
+				out.writeQuoted(dir.first);
+				writeTotals(out, totals[dir.second]);
+			}
+
+			out.close();
+
+			return out.getError();
+		}
+
+		/**
+		 * \brief Writes the specified histogram to the specified file
+		 * \param header The header of the first two columns, the bounds of the buckets
+		 * \return 0 on success, the errno of the failure otherwise
+		 */
+		static int writeHistogram(const std::string& path, const char* header, const Totals* histogram)
+		{
+			CsvWriter out(false);
+			int last = AGGREGATE_HISTOGRAM_BUCKETS - 1;
+
+			while (last > 0 && histogram[last].files == 0)
+			{
+				last--;
+			}
+
+			if (!out.open(path))
+			{
+				return out.getError();
+			}
+
+			out.write(header);
+			out.write(AGGREGATE_TOTALS_HEADER);
+
+			for (int b = 0; b <= last; b++)
+			{
+				out.writeUnsigned(b == 0 ? 0 : 1ull << (b - 1));
+				out.write(",");
+				out.writeUnsigned(1ull << b);
+				writeTotals(out, histogram[b]);
+			}
+
+			out.close();
+
+			return out.getError();
+		}
+
+		/**
+		 * \brief Writes the specified owner totals to the specified file
+		 * \param header The header of the first column, the owner
+		 * \param human Set to true to write the names of the owners instead of their ids
+		 * \param users Set to true for user ids, false for group ids
+		 * \return 0 on success, the errno of the failure otherwise
+		 */
+		static int writeOwners(const std::string& path, const char* header, const std::unordered_map<u_int32_t, Totals>& owners,
+				bool human, bool users)
+		{
+			CachedUtilities& utilities = CachedUtilities::getInstance();
+			std::vector<std::pair<u_int32_t, Totals>> sorted(owners.begin(), owners.end());
+			CsvWriter out(false);
+
+			std::sort(sorted.begin(), sorted.end(), [](const std::pair<u_int32_t, Totals>& a, const std::pair<u_int32_t, Totals>& b)
+			{
+				return a.first < b.first;
+			});
+
+			if (!out.open(path))
+			{
+				return out.getError();
+			}
+
+			out.write(header);
+			out.write(AGGREGATE_TOTALS_HEADER);
+
+			for (const std::pair<u_int32_t, Totals>& owner : sorted)
+			{
+				if (human)
+				{
+					out.writeQuoted((users ? utilities.uidToUsername(owner.first) : utilities.gidToGroupname(owner.first)).str());
+				}
+				else
+				{
+					out.writeUnsigned(owner.first);
+				}
+
+				writeTotals(out, owner.second);
+			}
+
+			out.close();
+
+			return out.getError();
+		}
+
+		/**
+		 * \brief Writes the specified totals as the last columns of a line
+		 */
+		static void writeTotals(CsvWriter& out, const Totals& totals)
+		{
+			out.write(",");
+			out.writeUnsigned(totals.files);
+			out.write(",");
+			out.writeUnsigned(totals.directories);
+			out.write(",");
+			out.writeUnsigned(totals.size);
+			out.write(",");
+			out.writeUnsigned(totals.blocks * 512);
+			out.write("\n");
+		}
+
+	public:
+
+		/**
+		 * \brief Creates an empty aggregator
+		 * \param now The time the access ages are measured from (e.g. the start of the collection)
+		 */
+		Aggregator(int64_t now)
+		{
+			Totals empty = {0, 0, 0, 0};
+
+			std::fill(m_Sizes, m_Sizes + AGGREGATE_HISTOGRAM_BUCKETS, empty);
+			std::fill(m_Ages, m_Ages + AGGREGATE_HISTOGRAM_BUCKETS, empty);
+			m_Now = now;
+		}
+
+		/**
+		 * \brief Adds the specified entry, found within the specified directory. Directories only count for the
+		 * totals of their owners here: the walker adds them to their own totals with \ref addDirectory().
+		 * \param parent Id of the directory containing the entry, or \ref NO_PARENT_DIRECTORY
+		 */
+		inline void add(const StatRecord& rec, u_int32_t parent)
+		{
+			m_Users[rec.uid].add(rec);
+			m_Groups[rec.gid].add(rec);
+
+			if (S_ISDIR(rec.mode))
+			{
+				return;
+			}
+
+			if (parent != NO_PARENT_DIRECTORY)
+			{
+				addToDirectory(parent, rec);
+			}
+
+			if (S_ISREG(rec.mode))
+			{
+				int64_t age = (m_Now - rec.atime) / 86400;
+
+				m_Sizes[getBucket(rec.size)].add(rec);
+				m_Ages[getBucket(age > 0 ? age : 0)].add(rec);
+			}
+		}
+
+		/**
+		 * \brief Same as \ref add(const StatRecord&, u_int32_t), from a stat record
+		 */
+		inline void add(const struct stat& sb, u_int32_t parent)
+		{
+			StatRecord rec;
+
+			rec.assign(sb);
+			add(rec, parent);
+		}
+
+		/**
+		 * \brief Adds the specified directory, with the specified id, to its own totals
+		 */
+		inline void addDirectory(u_int32_t id, const struct stat& sb)
+		{
+			StatRecord rec;
+
+			rec.assign(sb);
+			addToDirectory(id, rec);
+		}
+
+		/**
+		 * \brief Adds the totals of the specified aggregator to this one
+		 */
+		void merge(const Aggregator& other)
+		{
+			m_Directories.insert(m_Directories.end(), other.m_Directories.begin(), other.m_Directories.end());
+
+			for (const std::pair<const u_int32_t, Totals>& user : other.m_Users)
+			{
+				m_Users[user.first].add(user.second);
+			}
+
+			for (const std::pair<const u_int32_t, Totals>& group : other.m_Groups)
+			{
+				m_Groups[group.first].add(group.second);
+			}
+
+			for (int b = 0; b < AGGREGATE_HISTOGRAM_BUCKETS; b++)
+			{
+				m_Sizes[b].add(other.m_Sizes[b]);
+				m_Ages[b].add(other.m_Ages[b]);
+			}
+		}
+
+		/**
+		 * \brief Writes the summary tables: the totals of the directories to the specified path, and the other tables
+		 * to the paths returned by \ref getTablePath(). Errors are reported to stderr.
+		 * \param directories The directories of the collection. The root must have id 0
+		 * \param depth Maximum depth of the listed directories below the root (0 to only list the root)
+		 * \param human Set to true to write the names of the owners instead of their ids
+		 */
+		void write(const std::string& path, const DirectoryTable& directories, u_int32_t depth, bool human)
+		{
+			std::vector<Totals> totals(directories.size());
+			std::vector<u_int32_t> depths(directories.size(), 0);
+			std::vector<std::pair<std::string, u_int32_t>> listed;
+			Totals empty = {0, 0, 0, 0};
+
+			std::fill(totals.begin(), totals.end(), empty);
+
+			for (const std::pair<u_int32_t, Totals>& dir : m_Directories)
+			{
+				totals[dir.first].add(dir.second);
+			}
+
+			// Parents are always added before their subdirectories, so their ids are lower
+			for (size_t id = totals.size(); id-- > 1; )
+			{
+				totals[directories.get(id).parent].add(totals[id]);
+			}
+
+			for (size_t id = 0; id < totals.size(); id++)
+			{
+				depths[id] = id > 0 ? depths[directories.get(id).parent] + 1 : 0;
+
+				if (depths[id] <= depth)
+				{
+					listed.push_back(std::make_pair(std::string(), id));
+					directories.getPath(id, listed.back().first);
+				}
+			}
+
+			std::sort(listed.begin(), listed.end());
+
+			int error;
+
+			if ((error = writeDirectories(path, listed, totals)) != 0)
+			{
+				std::cerr << "-- Error writing the output file: " << path << ": " << strerror(error) << "\n";
+			}
+
+			std::string tablePath = getTablePath(path, "users");
+
+			if ((error = writeOwners(tablePath, human ? "USER" : "UID", m_Users, human, true)) != 0)
+			{
+				std::cerr << "-- Error writing the output file: " << tablePath << ": " << strerror(error) << "\n";
+			}
+
+			tablePath = getTablePath(path, "groups");
+
+			if ((error = writeOwners(tablePath, human ? "GROUP" : "GID", m_Groups, human, false)) != 0)
+			{
+				std::cerr << "-- Error writing the output file: " << tablePath << ": " << strerror(error) << "\n";
+			}
+
+			tablePath = getTablePath(path, "sizes");
+
+			if ((error = writeHistogram(tablePath, "SIZE_FROM,SIZE_TO", m_Sizes)) != 0)
+			{
+				std::cerr << "-- Error writing the output file: " << tablePath << ": " << strerror(error) << "\n";
+			}
+
+			tablePath = getTablePath(path, "ages");
+
+			if ((error = writeHistogram(tablePath, "ACCESSED_DAYS_FROM,ACCESSED_DAYS_TO", m_Ages)) != 0)
+			{
+				std::cerr << "-- Error writing the output file: " << tablePath << ": " << strerror(error) << "\n";
+			}
+		}
+
+		/**
+		 * \brief Returns the path of the specified summary table, next to the directory totals written to the specified
+		 * path: the path without its .csv extension, followed by the table name and .csv
+		 */
+		static std::string getTablePath(const std::string& path, const std::string& table)
+		{
+			std::string base = path;
+
+			if (base.size() > 4 && base.compare(base.size() - 4, 4, ".csv") == 0)
+			{
+				base.resize(base.size() - 4);
+			}
+
+			return base + "." + table + ".csv";
+		}
+	};
+}
+
+#endif	/* AGGREGATOR_HPP */
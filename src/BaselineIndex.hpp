@@ -0,0 +1,524 @@
+#ifndef BASELINEINDEX_HPP
+#define	BASELINEINDEX_HPP
+
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstring>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "ColumnarReader.hpp"
+
+#define NO_BASELINE_RUN 0xFFFFFFFFu //!< Marks the end of the list of runs of a directory of a \ref pstat::BaselineIndex
+#define BASELINE_INDEX_MIN_CAPACITY 1024 //!< Minimum number of slots of the hash table of a \ref pstat::BaselineIndex. Must be a power of 2.
+
+namespace pstat
+{
+	/**
+	 * \brief Indexes the directories of a previous columnar snapshot (the baseline), so that a new collection can look
+	 * each directory it traverses up in the baseline, tell whether it changed since, and copy the records of its entries
+	 * from the baseline instead of reading and stating them again.
+	 * Directories are identified by their parent and their name, as in the \ref DirectoryTable, so looking up a
+	 * subdirectory takes a single probe of a hash table. The records themselves are not copied into the index: it only
+	 * remembers where the entries of each directory are in the snapshot, as runs of consecutive rows, which are decoded
+	 * from the memory-mapped snapshot when needed.
+	 * The methods are const and thread-safe once \ref open() returns.
+	 */
+	class BaselineIndex
+	{
+		/**
+		 * \brief A directory of the baseline
+		 */
+		struct Directory
+		{
+			u_int64_t hash; //!< Hash of the parent and the name
+			u_int32_t parent; //!< Id of the parent directory, or \ref NO_BASELINE_DIRECTORY for the filesystem root
+			u_int32_t nameLength; //!< Length of name
+			const char* name; //!< The name, not NUL-terminated
+			u_int32_t pathLength; //!< Length of the path of the directory (0 for the filesystem root)
+			u_int32_t firstRun; //!< Index of the first run of entries in \ref m_Runs, or \ref NO_BASELINE_RUN
+			u_int32_t lastRun; //!< Index of the last run of entries in \ref m_Runs, or \ref NO_BASELINE_RUN
+			bool stated; //!< Set if the snapshot holds the record of the directory itself
+			u_int64_t dev; //!< Device id of the directory
+			u_int64_t ino; //!< Inode number of the directory
+			int64_t mtime; //!< Last modification time of the directory
+			int64_t ctime; //!< Last status change time of the directory
+		};
+
+		/**
+		 * \brief Consecutive rows of a row group holding entries of the same directory
+		 */
+		struct Run
+		{
+			u_int32_t snapshot; //!< Index of the snapshot (or shard) in \ref m_Snapshots
+			u_int32_t group; //!< Index of the row group
+			u_int32_t row; //!< Index of the first row
+			u_int32_t count; //!< Number of rows
+			u_int64_t pathOffset; //!< Offset of the path of the first row within the path column
+			const char* firstName; //!< Name of the entry of the first row, whose path depends on the previous row
+			u_int32_t firstNameLength; //!< Length of firstName
+			u_int32_t next; //!< Index of the next run of the directory, or \ref NO_BASELINE_RUN
+		};
+
+		std::string m_Path; //!< Path to the snapshot, or to the manifest of its shards
+		std::vector<std::unique_ptr<ColumnarReader>> m_Snapshots; //!< The snapshot, or its shards
+		std::vector<Directory> m_Directories; //!< The directories, indexed by id. Id 0 is the filesystem root
+		std::vector<u_int32_t> m_Table; //!< Hash table of the directory ids, by parent and name
+		std::vector<Run> m_Runs; //!< The runs of entries of all the directories
+		StringArena m_Names; //!< Names of the directories and of the first entries of the runs
+		int64_t m_StartTime; //!< The time the earliest collection of the snapshot (or its shards) started
+		u_int64_t m_Records; //!< Total number of records in the snapshot
+		std::string m_Error; //!< Describes why \ref open() failed
+
+		BaselineIndex(const BaselineIndex&);
+		BaselineIndex& operator=(const BaselineIndex&);
+
+		/**
+		 * \brief Sets the error message and returns false
+		 */
+		bool fail(const std::string& error)
+		{
+			m_Error = error;
+			return false;
+		}
+
+		/**
+		 * \brief Returns the hash of the directory with the specified name within the specified parent (FNV-1a)
+		 */
+		static inline u_int64_t hashDirectory(u_int32_t parent, const char* name, size_t nameLength)
+		{
+			u_int64_t hash = 14695981039346656037ull ^ parent;
+
+			for (size_t i = 0; i < nameLength; i++)
+			{
+				hash = (hash ^ static_cast<unsigned char>(name[i])) * 1099511628211ull;
+			}
+
+			return hash * 0x9E3779B97F4A7C15ull;
+		}
+
+		/**
+		 * \brief Returns the slot of \ref m_Table holding the specified directory, or the empty slot it would go in
+		 */
+		inline size_t findSlot(u_int64_t hash, u_int32_t parent, const char* name, size_t nameLength) const
+		{
+			size_t mask = m_Table.size() - 1;
+			size_t i = (hash >> 32) & mask;
+
+			for (; m_Table[i] != NO_BASELINE_DIRECTORY; i = (i + 1) & mask)
+			{
+				const Directory& dir = m_Directories[m_Table[i]];
+
+				if (dir.hash == hash && dir.parent == parent && dir.nameLength == nameLength && memcmp(dir.name, name, nameLength) == 0)
+				{
+					break;
+				}
+			}
+
+			return i;
+		}
+
+		/**
+		 * \brief Doubles the size of \ref m_Table
+		 */
+		void grow()
+		{
+			std::vector<u_int32_t> table(m_Table.size() * 2, NO_BASELINE_DIRECTORY);
+			size_t mask = table.size() - 1;
+
+			for (u_int32_t id : m_Table)
+			{
+				if (id != NO_BASELINE_DIRECTORY)
+				{
+					size_t i = (m_Directories[id].hash >> 32) & mask;
+
+					while (table[i] != NO_BASELINE_DIRECTORY)
+					{
+						i = (i + 1) & mask;
+					}
+
+					table[i] = id;
+				}
+			}
+
+			m_Table.swap(table);
+		}
+
+		/**
+		 * \brief Returns the id of the directory with the specified name within the specified parent, adding it if missing
+		 */
+		u_int32_t addDirectory(u_int32_t parent, const char* name, size_t nameLength)
+		{
+			u_int64_t hash = hashDirectory(parent, name, nameLength);
+			size_t slot = findSlot(hash, parent, name, nameLength);
+
+			if (m_Table[slot] != NO_BASELINE_DIRECTORY)
+			{
+				return m_Table[slot];
+			}
+
+			Directory dir;
+
+			memset(&dir, 0, sizeof(dir));
+			dir.hash = hash;
+			dir.parent = parent;
+			dir.nameLength = nameLength;
+			dir.name = m_Names.copy(name, nameLength);
+			dir.pathLength = m_Directories[parent].pathLength + 1 + nameLength;
+			dir.firstRun = dir.lastRun = NO_BASELINE_RUN;
+
+			m_Table[slot] = m_Directories.size();
+			m_Directories.push_back(dir);
+
+			if (2 * m_Directories.size() > m_Table.size())
+			{
+				grow();
+			}
+
+			return m_Directories.size() - 1;
+		}
+
+		/**
+		 * \brief Returns the id of the directory with the specified absolute path, adding it and its parents if missing
+		 */
+		u_int32_t addPath(const char* path, size_t pathLength)
+		{
+			u_int32_t dir = 0;
+			size_t start = 0;
+
+			while (start < pathLength)
+			{
+				const char* slash = static_cast<const char*>(memchr(path + start, '/', pathLength - start));
+				size_t end = slash != NULL ? slash - path : pathLength;
+
+				if (end > start)
+				{
+					dir = addDirectory(dir, path + start, end - start);
+				}
+
+				start = end + 1;
+			}
+
+			return dir;
+		}
+
+		/**
+		 * \brief Records the stat fields that tell whether the specified directory changed
+		 */
+		void setStat(u_int32_t id, const StatRecord& rec)
+		{
+			Directory& dir = m_Directories[id];
+
+			dir.stated = true;
+			dir.dev = rec.dev;
+			dir.ino = rec.ino;
+			dir.mtime = rec.mtime;
+			dir.ctime = rec.ctime;
+		}
+
+		/**
+		 * \brief Starts a new run of entries of the specified directory
+		 * \return The index of the run in \ref m_Runs
+		 */
+		u_int32_t addRun(u_int32_t dir, u_int32_t snapshot, u_int32_t group, u_int32_t row, u_int64_t pathOffset,
+				const char* name, size_t nameLength)
+		{
+			Run run = {snapshot, group, row, 0, pathOffset, m_Names.copy(name, nameLength),
+					static_cast<u_int32_t>(nameLength), NO_BASELINE_RUN};
+			Directory& d = m_Directories[dir];
+			u_int32_t index = m_Runs.size();
+
+			m_Runs.push_back(run);
+			(d.firstRun == NO_BASELINE_RUN ? d.firstRun : m_Runs[d.lastRun].next) = index;
+			d.lastRun = index;
+
+			return index;
+		}
+
+		/**
+		 * \brief Indexes the directories and the runs of entries of the snapshot with the specified index in \ref m_Snapshots
+		 * \return True on success, false if the snapshot is corrupted
+		 */
+		bool load(u_int32_t snapshot)
+		{
+			const ColumnarReader& reader = *m_Snapshots[snapshot];
+			ColumnarReader::RowGroup group;
+			std::string path;
+			std::string parentPath;
+			StatRecord rec;
+
+			memset(&rec, 0, sizeof(rec));
+
+			for (u_int32_t g = 0; g < reader.getRowGroupsCount(); g++)
+			{
+				if (!reader.getRowGroup(g, group))
+				{
+					return fail("corrupted columnar snapshot (bad row group)");
+				}
+
+				const char* in = group.paths;
+				u_int32_t dir = 0;
+				u_int32_t run = NO_BASELINE_RUN;
+
+				for (u_int32_t row = 0; row < group.rows; row++)
+				{
+					u_int64_t pathOffset = in - group.paths;
+
+					if (!group.decodePath(in, path))
+					{
+						return fail("corrupted columnar snapshot (bad path column)");
+					}
+
+					std::string::size_type slash = path.rfind('/');
+					size_t parentLength = slash != std::string::npos ? slash : 0;
+					size_t nameStart = slash != std::string::npos ? slash + 1 : 0;
+
+					group.getRecord(row, rec);
+
+					// The filesystem root is no entry of any directory
+					if (nameStart == path.size())
+					{
+						if (S_ISDIR(rec.mode))
+						{
+							setStat(addPath(path.data(), path.size()), rec);
+						}
+
+						run = NO_BASELINE_RUN;
+						continue;
+					}
+
+					// Records of the same directory mostly come in a row, and then extend the same run
+					if (run == NO_BASELINE_RUN || parentLength != parentPath.size() || path.compare(0, parentLength, parentPath) != 0)
+					{
+						parentPath.assign(path, 0, parentLength);
+						dir = addPath(parentPath.data(), parentPath.size());
+						run = addRun(dir, snapshot, g, row, pathOffset, path.data() + nameStart, path.size() - nameStart);
+					}
+
+					m_Runs[run].count++;
+
+					if (S_ISDIR(rec.mode))
+					{
+						setStat(addDirectory(dir, path.data() + nameStart, path.size() - nameStart), rec);
+					}
+				}
+			}
+
+			m_Records += reader.getRecordsCount();
+
+			return true;
+		}
+
+	public:
+
+		BaselineIndex() : m_Table(BASELINE_INDEX_MIN_CAPACITY, NO_BASELINE_DIRECTORY)
+		{
+			Directory root;
+
+			memset(&root, 0, sizeof(root));
+			root.parent = NO_BASELINE_DIRECTORY;
+			root.name = "";
+			root.firstRun = root.lastRun = NO_BASELINE_RUN;
+			m_Directories.push_back(root);
+
+			m_StartTime = 0;
+			m_Records = 0;
+		}
+
+		/**
+		 * \brief Opens the specified columnar snapshot, or the manifest of a sharded one, and indexes its directories
+		 * \return True on success, false otherwise (see \ref getError())
+		 */
+		bool open(const std::string& path)
+		{
+			if (!ColumnarReader::openShards(path, m_Snapshots, m_Error))
+			{
+				return false;
+			}
+
+			m_Path = path;
+
+			m_StartTime = m_Snapshots[0]->getStartTime();
+
+			for (u_int32_t i = 0; i < m_Snapshots.size(); i++)
+			{
+				m_StartTime = std::min(m_StartTime, m_Snapshots[i]->getStartTime());
+
+				if (m_Snapshots[i]->getOptions() != m_Snapshots[0]->getOptions())
+				{
+					return fail("the shards were collected with different options");
+				}
+
+				if (!load(i))
+				{
+					return false;
+				}
+			}
+
+			return true;
+		}
+
+		/**
+		 * \brief Returns the description of the last error
+		 */
+		const std::string& getError() const
+		{
+			return m_Error;
+		}
+
+		/**
+		 * \brief Returns the id of the directory with the specified name within the specified directory, or
+		 * \ref NO_BASELINE_DIRECTORY if there is none (or if parent is \ref NO_BASELINE_DIRECTORY)
+		 */
+		inline u_int32_t find(u_int32_t parent, const char* name, size_t nameLength) const
+		{
+			if (parent == NO_BASELINE_DIRECTORY)
+			{
+				return NO_BASELINE_DIRECTORY;
+			}
+
+			return m_Table[findSlot(hashDirectory(parent, name, nameLength), parent, name, nameLength)];
+		}
+
+		/**
+		 * \brief Returns the id of the directory with the specified absolute path, or \ref NO_BASELINE_DIRECTORY if there is none
+		 */
+		u_int32_t findPath(const std::string& path) const
+		{
+			u_int32_t dir = 0;
+			std::string::size_type start = 0;
+
+			while (dir != NO_BASELINE_DIRECTORY && start < path.size())
+			{
+				std::string::size_type end = std::min(path.find('/', start), path.size());
+
+				if (end > start)
+				{
+					dir = find(dir, path.data() + start, end - start);
+				}
+
+				start = end + 1;
+			}
+
+			return dir;
+		}
+
+		/**
+		 * \brief Returns true if the entries of the specified directory, with the specified current stat record, are
+		 * the same as in the baseline: its device, inode, modification and status change times are unchanged. The
+		 * times are only precise to the second, so directories changed in the second the baseline collection started,
+		 * or later, are always reported as changed.
+		 */
+		inline bool isUnchanged(u_int32_t id, const struct stat& sb) const
+		{
+			if (id == NO_BASELINE_DIRECTORY)
+			{
+				return false;
+			}
+
+			const Directory& dir = m_Directories[id];
+
+			return dir.stated && dir.dev == static_cast<u_int64_t>(sb.st_dev) && dir.ino == static_cast<u_int64_t>(sb.st_ino)
+					&& dir.mtime == sb.st_mtime && dir.ctime == sb.st_ctime && dir.ctime < m_StartTime;
+		}
+
+		/**
+		 * \brief Decodes the records of the entries of the specified directory, calling
+		 * visit(const StatRecord&, const char* name, size_t nameLength) for each of them, in order. The names are
+		 * NUL-terminated, and valid until the next call.
+		 * \return True on success, false if the snapshot is corrupted
+		 */
+		template<typename Visitor>
+		bool forEachEntry(u_int32_t id, Visitor visit) const
+		{
+			const Directory& dir = m_Directories[id];
+			ColumnarReader::RowGroup group;
+			StatRecord rec;
+			std::string path;
+
+			memset(&rec, 0, sizeof(rec));
+			rec.parent = NO_PARENT_DIRECTORY;
+
+			for (u_int32_t r = dir.firstRun; r != NO_BASELINE_RUN; r = m_Runs[r].next)
+			{
+				const Run& run = m_Runs[r];
+
+				if (!m_Snapshots[run.snapshot]->getRowGroup(run.group, group) || run.pathOffset > static_cast<u_int64_t>(group.pathsEnd - group.paths))
+				{
+					return false;
+				}
+
+				// Only the names matter, so the directory part of the paths is left as a placeholder. The first path
+				// depends on the previous row, which is not decoded: its name is taken from the run instead.
+				const char* in = group.paths + run.pathOffset;
+
+				for (u_int32_t i = 0; i < run.count; i++)
+				{
+					if (i == 0)
+					{
+						path.assign(dir.pathLength + 1, '/');
+						path.append(run.firstName, run.firstNameLength);
+
+						if (!group.skipPath(in))
+						{
+							return false;
+						}
+					}
+					else if (!group.decodePath(in, path) || path.size() <= dir.pathLength + 1)
+					{
+						return false;
+					}
+
+					group.getRecord(run.row + i, rec);
+					visit(static_cast<const StatRecord&>(rec), path.c_str() + dir.pathLength + 1, path.size() - dir.pathLength - 1);
+				}
+			}
+
+			return true;
+		}
+
+		/**
+		 * \brief Returns the time the collection of the baseline started (the earliest one, if sharded)
+		 */
+		int64_t getStartTime() const
+		{
+			return m_StartTime;
+		}
+
+		/**
+		 * \brief Returns the path the baseline was opened from
+		 */
+		const std::string& getPath() const
+		{
+			return m_Path;
+		}
+
+		/**
+		 * \brief Returns the options of the collection of the baseline
+		 */
+		const CollectionOptions& getOptions() const
+		{
+			return m_Snapshots[0]->getOptions();
+		}
+
+		/**
+		 * \brief Returns the number of records in the baseline
+		 */
+		u_int64_t getRecordsCount() const
+		{
+			return m_Records;
+		}
+
+		/**
+		 * \brief Returns the number of directories in the index
+		 */
+		size_t getDirectoriesCount() const
+		{
+			return m_Directories.size();
+		}
+	};
+}
+
+#endif	/* BASELINEINDEX_HPP */
@@ -0,0 +1,105 @@
+#ifndef BLOCKINGQUEUE_HPP
+#define	BLOCKINGQUEUE_HPP
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+namespace pstat
+{
+	/**
+	 * \brief A simple thread-safe FIFO queue whose consumers block while it is empty, until it is closed.
+	 * Meant for low-rate hand-offs (e.g. whole chunks of records), where a lock per operation is cheap.
+	 */
+	template<typename T>
+	class BlockingQueue
+	{
+		std::deque<T> m_Items; //!< The queued items
+		std::mutex m_Mutex; //!< Guards all the members
+		std::condition_variable m_Condition; //!< Notified on every push, and on close
+		bool m_Closed; //!< Once set, \ref pop() returns false when the queue is empty instead of blocking
+
+	public:
+
+		BlockingQueue()
+		{
+			m_Closed = false;
+		}
+
+		/**
+		 * \brief Pushes the specified item to the back of the queue, waking up a blocked consumer
+		 */
+		void push(const T& item)
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_Items.push_back(item);
+			lock.unlock();
+			m_Condition.notify_one();
+		}
+
+		/**
+		 * \brief Pops the front item, blocking while the queue is empty and not closed
+		 * \return True if an item is popped, false if the queue is closed and empty
+		 */
+		bool pop(T& item)
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+
+			while (m_Items.empty() && !m_Closed)
+			{
+				m_Condition.wait(lock);
+			}
+
+			if (m_Items.empty())
+			{
+				return false;
+			}
+
+			item = m_Items.front();
+			m_Items.pop_front();
+
+			return true;
+		}
+
+		/**
+		 * \brief Pops the front item without blocking
+		 * \return True if an item is popped, false if the queue is empty
+		 */
+		bool tryPop(T& item)
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+
+			if (m_Items.empty())
+			{
+				return false;
+			}
+
+			item = m_Items.front();
+			m_Items.pop_front();
+
+			return true;
+		}
+
+		/**
+		 * \brief Returns the number of queued items
+		 */
+		size_t size()
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+
+			return m_Items.size();
+		}
+
+		/**
+		 * \brief Closes the queue: consumers drain the remaining items, then \ref pop() returns false
+		 */
+		void close()
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_Closed = true;
+			m_Condition.notify_all();
+		}
+	};
+}
+
+#endif	/* BLOCKINGQUEUE_HPP */
@@ -1,146 +1,178 @@
 #ifndef CACHEDUTILITIES_H
 #define	CACHEDUTILITIES_H
 
-#include <iostream>
-#include <fstream>
-#include <unordered_map>
+#include <vector>
+#include <memory>
 #include <unistd.h>
 #include <sys/stat.h>
-#include <dirent.h>
 #include <string>
-#include <sstream>
 #include <ctime>
+#include <cerrno>
 #include <pwd.h>
 #include <grp.h>
 
-#ifdef HAVE_TBB_HEADERS_
-#include <tbb/concurrent_unordered_map.h>
-#else
-#include "inconcurrent_unordered_map.hpp"
-#endif
+#include "IdNameTable.hpp"
+#include "LocalCalendar.hpp"
+#include "StringRef.hpp"
 
-#define USER_BUF_SIZE (sysconf(_SC_GETPW_R_SIZE_MAX))
+#define USER_BUF_SIZE 16384 //!< Initial size of the buffers of getpwuid_r() and getgrgid_r(), grown as needed
 
 namespace pstat
 {
 	/**
 	 * \brief A singleton that contains a set of utility methods that make use of caching for performance.
+	 * The human-readable lookups need no libc call per record: with \ref init(true), the passwd and group databases are
+	 * loaded once into lock-free tables, and local dates are computed from a table of the timezone's UTC offset
+	 * changes. Names are returned as references to interned strings.
 	 * All the methods are thread-safe.
 	 */
 	class CachedUtilities
 	{
-		tbb::concurrent_unordered_map<gid_t, std::string> m_CachedGroups; //!< A hashtable from GID to group name
-		tbb::concurrent_unordered_map<uid_t, std::string> m_CachedUsers; //!< A hashtable from UID to username
-		tbb::concurrent_unordered_map<time_t, std::string> m_CachedTimes; //!< A hashtable from timestamp to date string
+		IdNameTable m_Users; //!< A table from UID to username
+		IdNameTable m_Groups; //!< A table from GID to group name
+		std::unique_ptr<LocalCalendar> m_Calendar; //!< Converts times to local dates, once built by \ref init()
+
+		StringRef m_Types[16]; //!< File types, indexed by the S_IFMT bits of the mode
+		char m_Permissions[01000][3]; //!< Octal permissions, indexed by the permission bits of the mode
 
-		std::unordered_map<mode_t, std::string> m_CachedTypes; //!< A hashtable of file types
-		std::unordered_map<mode_t, std::string> m_CachedPermissions; //!< A hashtable of file permissions
-		
 		/**
 		 * \brief Private constructor
        */
-		CachedUtilities()
+		CachedUtilities() : m_Users(getUsername, "UNKNOWN"), m_Groups(getGroupname, "UNKNOWN")
 		{
 			// Enumerate file types
-			m_CachedTypes[S_IFBLK] = "BDEV";
-			m_CachedTypes[S_IFCHR] = "CDEV";
-			m_CachedTypes[S_IFDIR] = "DIR";
-			m_CachedTypes[S_IFIFO] = "PIPE";
-			m_CachedTypes[S_IFLNK] = "LINK";
-			m_CachedTypes[S_IFREG] = "FILE";
-			m_CachedTypes[S_IFSOCK] = "SOCK";
-
-			for(int i = 0; i <= 0777; i++)
+			for (StringRef& type : m_Types)
 			{
-				std::stringstream ss;
-				int o = i & 0007;
-				int g = (i & 0070) >> 3;
-				int u = (i & 0700) >> 6;
+				type = "UNKNOWN";
+			}
 
-				ss << u << g << o;
+			m_Types[S_IFBLK >> 12] = "BDEV";
+			m_Types[S_IFCHR >> 12] = "CDEV";
+			m_Types[S_IFDIR >> 12] = "DIR";
+			m_Types[S_IFIFO >> 12] = "PIPE";
+			m_Types[S_IFLNK >> 12] = "LINK";
+			m_Types[S_IFREG >> 12] = "FILE";
+			m_Types[S_IFSOCK >> 12] = "SOCK";
 
-				m_CachedPermissions[i] = ss.str();
+			for(int i = 0; i <= 0777; i++)
+			{
+				m_Permissions[i][0] = '0' + ((i & 0700) >> 6);
+				m_Permissions[i][1] = '0' + ((i & 0070) >> 3);
+				m_Permissions[i][2] = '0' + (i & 0007);
 			}
 		}
 
-	public:
-		
 		/**
-		 * \brief Converts the specified time to sting of format YYYY-mm-dd
-       */
-		std::string strftime(time_t time)
+		 * \brief Resolves the specified uid with getpwuid_r()
+		 */
+		static bool getUsername(u_int32_t uid, std::string& name)
 		{
-			struct tm timeob;
-			localtime_r(&time, &timeob);
-
-			// Rewind to midnight
-			timeob.tm_sec = timeob.tm_min = timeob.tm_hour = 0;
-			time_t midnight = mktime(&timeob);
+			std::vector<char> buf(USER_BUF_SIZE);
+			struct passwd pwd;
+			struct passwd* result = NULL;
+			int error;
 
-			if (m_CachedTimes.count(midnight) != 0)
+			while ((error = getpwuid_r(uid, &pwd, &buf[0], buf.size(), &result)) == ERANGE)
 			{
-				return m_CachedTimes[midnight];
+				buf.resize(buf.size() * 2);
 			}
 
-			char buf[16];
-			std::strftime(buf, 16, "%Y-%m-%d", &timeob);
-			std::string ret(buf);
+			if (error != 0 || result == NULL)
+			{
+				return false;
+			}
 
-			m_CachedTimes[midnight] = ret;
+			name = pwd.pw_name;
 
-			return ret;
+			return true;
 		}
 
 		/**
-		 * \brief Resolves the specified uid to its corresponding username in the passwd file. 
-		 * Retuns "UNKNOWN" if failed to resolve.
-       */
-		std::string uidToUsername(uid_t uid)
+		 * \brief Resolves the specified gid with getgrgid_r()
+		 */
+		static bool getGroupname(u_int32_t gid, std::string& name)
 		{
-			if(m_CachedUsers.count(uid) != 0)
+			std::vector<char> buf(USER_BUF_SIZE);
+			struct group grp;
+			struct group* result = NULL;
+			int error;
+
+			while ((error = getgrgid_r(gid, &grp, &buf[0], buf.size(), &result)) == ERANGE)
 			{
-				return m_CachedUsers[uid];
+				buf.resize(buf.size() * 2);
 			}
 
-			char buf[USER_BUF_SIZE];
-			struct passwd pwd;
-			struct passwd* pwdbuf;
-
-			if(getpwuid_r(uid, &pwd, buf, sizeof(buf), &pwdbuf) != 0)
+			if (error != 0 || result == NULL)
 			{
-				sprintf(buf, "UNKNOWN");
+				return false;
 			}
 
-			std::string ret(buf);
-			m_CachedUsers[uid] = buf;
+			name = grp.gr_name;
 
-			return ret;
+			return true;
 		}
 
 		/**
-		 * \brief Resolves the specified gid to its corresponding group name in the passwd file. 
-		 * Retuns "UNKNOWN" if failed to resolve.
-       */
-		std::string gidToGroupname(gid_t gid)
+		 * \brief Loads the whole passwd and group databases into \ref m_Users and \ref m_Groups, and builds \ref m_Calendar.
+		 * Not thread-safe.
+		 */
+		void load()
 		{
-			if(m_CachedGroups.count(gid) != 0)
+			std::vector<std::pair<u_int32_t, std::string>> names;
+			struct passwd* pwd;
+			struct group* grp;
+
+			setpwent();
+
+			while ((pwd = getpwent()) != NULL)
 			{
-				return m_CachedGroups[gid];
+				names.push_back(std::make_pair(pwd->pw_uid, std::string(pwd->pw_name)));
 			}
 
-			char buf[USER_BUF_SIZE];
-			struct group grp;
-			struct group* grpbuf;
+			endpwent();
+			m_Users.load(names);
+			names.clear();
+
+			setgrent();
 
-			if(getgrgid_r(gid, &grp, buf, sizeof(buf), &grpbuf) != 0)
+			while ((grp = getgrent()) != NULL)
 			{
-				sprintf(buf, "UNKNOWN");
+				names.push_back(std::make_pair(grp->gr_gid, std::string(grp->gr_name)));
 			}
 
-			std::string ret(buf);
-			m_CachedGroups[gid] = ret;
+			endgrent();
+			m_Groups.load(names);
 
-			return ret;
+			m_Calendar.reset(new LocalCalendar());
+		}
+
+	public:
+
+		/**
+		 * \brief Formats the local date of the specified time as YYYY-mm-dd at out
+		 * \return The end of the formatted date
+       */
+		inline char* formatDate(char* out, time_t time) const
+		{
+			return m_Calendar ? m_Calendar->formatDate(out, time) : LocalCalendar::formatLocalDate(out, time);
+		}
+
+		/**
+		 * \brief Resolves the specified uid to its corresponding username in the passwd file.
+		 * Retuns "UNKNOWN" if failed to resolve. The returned reference stays valid for the lifetime of the instance.
+       */
+		inline StringRef uidToUsername(uid_t uid)
+		{
+			return m_Users.resolve(uid);
+		}
+
+		/**
+		 * \brief Resolves the specified gid to its corresponding group name in the passwd file.
+		 * Retuns "UNKNOWN" if failed to resolve. The returned reference stays valid for the lifetime of the instance.
+       */
+		inline StringRef gidToGroupname(gid_t gid)
+		{
+			return m_Groups.resolve(gid);
 		}
 
 		/**
@@ -153,29 +185,22 @@ namespace pstat
 		 * - LINK
 		 * - FILE
 		 * - SOCK
-		 * 
+		 *
 		 * Returns UNKNOWN if the type cannot be resolved
        */
-		std::string getFileType(mode_t mode)
+		inline StringRef getFileType(mode_t mode) const
 		{
-			unsigned int rmode = mode & S_IFMT;
-
-			if(m_CachedTypes.count(rmode) != 0)
-			{
-				return m_CachedTypes[rmode];
-			}
-
-			return "UNKNOWN";
+			return m_Types[(mode & S_IFMT) >> 12];
 		}
-		
+
 		/**
 		 * \brief Returns a string representing the effective file permission from the specified file mode
 		 */
-		inline std::string getEffectiveFilePermissions(mode_t mode, unsigned int parentMode = 0777)
+		inline StringRef getEffectiveFilePermissions(mode_t mode, unsigned int parentMode = 0777) const
 		{
-			return m_CachedPermissions[mode & parentMode];
+			return StringRef(m_Permissions[mode & parentMode & 0777], 3);
 		}
-		
+
 		/**
 		 * \brief Gets the singleton instance of this class
        */
@@ -188,10 +213,17 @@ namespace pstat
 
 		/**
 		 * \brief Call at main to avoid race-condition when calling getInstance()
+		 * \param human Set to true to also load the tables of the human-readable lookups. Without them, names are
+		 * still resolved (and cached) one id at a time, and dates with localtime_r()
 		 */
-		static void init()
+		static void init(bool human = false)
 		{
 			CachedUtilities& instance = CachedUtilities::getInstance();
+
+			if (human)
+			{
+				instance.load();
+			}
 		}
 	};
 }
@@ -0,0 +1,275 @@
+#ifndef CHECKPOINT_HPP
+#define	CHECKPOINT_HPP
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "CollectionOptions.hpp"
+
+#define CHECKPOINT_VERSION 2 //!< Version of the layout of the checkpoint files, bumped on incompatible changes
+
+namespace pstat
+{
+	/**
+	 * \brief The state of an interrupted collection, from which it can be resumed: the options it was started with,
+	 * the durable size of each output shard, and the directories that are still to be traversed. Checkpoints are taken while no directory is being
+	 * traversed, so the outputs hold all the records of the traversed directories, and none of the pending ones.
+	 *
+	 * A checkpoint file is a text file of "key value" lines, where strings are written as their length, a space and
+	 * their bytes, so that paths may hold any character. It is replaced atomically: written to a temporary file,
+	 * flushed to disk, and renamed over the previous one.
+	 */
+	class Checkpoint
+	{
+		std::string m_Error; //!< Describes the last error
+
+		/**
+		 * \brief Sets the error message and returns false
+		 */
+		bool fail(const std::string& error)
+		{
+			m_Error = error;
+			return false;
+		}
+
+		/**
+		 * \brief Writes the specified string as its length, a space and its bytes
+		 */
+		static void writeString(std::ostream& out, const std::string& str)
+		{
+			out << str.size() << ' ';
+			out.write(str.data(), str.size());
+		}
+
+		/**
+		 * \brief Returns the number of bytes left to read before the specified end of the input, or 0 if it is in error
+		 */
+		static u_int64_t getLeft(std::istream& in, std::streamoff end)
+		{
+			std::streamoff position = in.tellg();
+
+			return position >= 0 && position < end ? end - position : 0;
+		}
+
+		/**
+		 * \brief Reads a string written by \ref writeString(), which must end before the specified end of the input
+		 */
+		static bool readString(std::istream& in, std::string& str, std::streamoff end)
+		{
+			u_int64_t length;
+
+			if (!(in >> length) || in.get() != ' ' || length > getLeft(in, end))
+			{
+				return false;
+			}
+
+			str.resize(length);
+
+			return length == 0 || in.read(&str[0], length);
+		}
+
+		/**
+		 * \brief Reads the specified key, followed by a space
+		 */
+		static bool readKey(std::istream& in, const char* key)
+		{
+			std::string word;
+
+			return (in >> word) && word == key && in.get() == ' ';
+		}
+
+	public:
+		/**
+		 * \brief The durable part of an output shard
+		 */
+		struct Shard
+		{
+			u_int64_t offset; //!< Size of the shard file
+			u_int64_t records; //!< Number of records it holds
+		};
+
+		std::string path; //!< The collected path
+		std::string outputPath; //!< Path to the output file, or to the manifest of the shards
+		int format; //!< The \ref OutputFormat of the output
+		bool human; //!< Set if the output is human-readable
+		bool compressed; //!< Set if the output is compressed
+		CollectionOptions options; //!< The options that shape which entries the collection holds
+		std::string baseline; //!< Path to the baseline of the collection, or empty if it has none
+		u_int64_t stated; //!< Number of records collected so far
+		u_int64_t matched; //!< Number of records selected by the filter so far
+		std::vector<Shard> shards; //!< The output shards
+		std::vector<std::string> directories; //!< Full paths of the directories still to be traversed
+
+		Checkpoint()
+		{
+			format = 0;
+			human = false;
+			compressed = false;
+			stated = 0;
+			matched = 0;
+		}
+
+		/**
+		 * \brief Atomically replaces the specified file with this checkpoint
+		 * \return True on success, false otherwise (see \ref getError())
+		 */
+		bool write(const std::string& file)
+		{
+			std::ostringstream out;
+			std::string temporary = file + ".tmp";
+
+			out << "pstat-checkpoint " << CHECKPOINT_VERSION << "\npath ";
+			writeString(out, path);
+			out << "\noutput ";
+			writeString(out, outputPath);
+			out << "\nformat " << format << "\nhuman " << human << "\ncompressed " << compressed << "\noptions ";
+			writeString(out, options.encode());
+			out << "\nbaseline ";
+			writeString(out, baseline);
+			out << "\nstated " << stated
+					<< "\nmatched " << matched << "\nshards " << shards.size() << "\n";
+
+			for (const Shard& shard : shards)
+			{
+				out << shard.offset << " " << shard.records << "\n";
+			}
+
+			out << "directories " << directories.size() << "\n";
+
+			for (const std::string& directory : directories)
+			{
+				writeString(out, directory);
+				out << "\n";
+			}
+
+			std::string data = out.str();
+			int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+
+			if (fd < 0)
+			{
+				return fail(temporary + ": " + strerror(errno));
+			}
+
+			for (size_t written = 0; written < data.size(); )
+			{
+				ssize_t ret = ::write(fd, data.data() + written, data.size() - written);
+
+				if (ret < 0 && errno != EINTR)
+				{
+					int error = errno;
+					close(fd);
+					return fail(temporary + ": " + strerror(error));
+				}
+
+				written += ret > 0 ? ret : 0;
+			}
+
+			if (fsync(fd) != 0 || close(fd) != 0)
+			{
+				return fail(temporary + ": " + strerror(errno));
+			}
+
+			if (rename(temporary.c_str(), file.c_str()) != 0)
+			{
+				return fail(file + ": " + strerror(errno));
+			}
+
+			return true;
+		}
+
+		/**
+		 * \brief Reads the specified checkpoint file
+		 * \return True on success, false otherwise (see \ref getError())
+		 */
+		bool read(const std::string& file)
+		{
+			std::ifstream in(file.c_str(), std::ios::binary);
+			std::string encoded;
+			int version;
+			u_int64_t count;
+
+			if (!in)
+			{
+				return fail(std::string(strerror(errno)));
+			}
+
+			// The counts and lengths are checked against the size of the file, so that a corrupted one cannot make
+			// them allocate more than it holds
+			in.seekg(0, std::ios::end);
+			std::streamoff end = in.tellg();
+			in.seekg(0, std::ios::beg);
+
+			if (!readKey(in, "pstat-checkpoint") || !(in >> version))
+			{
+				return fail("not a checkpoint file");
+			}
+
+			if (version != CHECKPOINT_VERSION)
+			{
+				return fail("unsupported checkpoint version");
+			}
+
+			if (!readKey(in, "path") || !readString(in, path, end) || !readKey(in, "output") || !readString(in, outputPath, end)
+					|| !readKey(in, "format") || !(in >> format) || !readKey(in, "human") || !(in >> human)
+					|| !readKey(in, "compressed") || !(in >> compressed) || !readKey(in, "options")
+					|| !readString(in, encoded, end) || !options.decode(encoded) || !readKey(in, "baseline")
+					|| !readString(in, baseline, end) || !readKey(in, "stated") || !(in >> stated)
+					|| !readKey(in, "matched") || !(in >> matched) || !readKey(in, "shards") || !(in >> count))
+			{
+				return fail("truncated or corrupted checkpoint");
+			}
+
+			// Each shard takes at least 4 bytes ("0 0\n")
+			if (count > getLeft(in, end) / 4)
+			{
+				return fail("truncated or corrupted checkpoint");
+			}
+
+			shards.resize(count);
+
+			for (Shard& shard : shards)
+			{
+				if (!(in >> shard.offset >> shard.records))
+				{
+					return fail("truncated or corrupted checkpoint");
+				}
+			}
+
+			// Each directory takes at least 3 bytes ("\n0 ")
+			if (!readKey(in, "directories") || !(in >> count) || count > getLeft(in, end) / 3)
+			{
+				return fail("truncated or corrupted checkpoint");
+			}
+
+			directories.resize(count);
+
+			for (std::string& directory : directories)
+			{
+				if (in.get() != '\n' || !readString(in, directory, end))
+				{
+					return fail("truncated or corrupted checkpoint");
+				}
+			}
+
+			return true;
+		}
+
+		/**
+		 * \brief Returns the description of the last error
+		 */
+		const std::string& getError() const
+		{
+			return m_Error;
+		}
+	};
+}
+
+#endif	/* CHECKPOINT_HPP */
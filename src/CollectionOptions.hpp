@@ -0,0 +1,165 @@
+#ifndef COLLECTIONOPTIONS_HPP
+#define	COLLECTIONOPTIONS_HPP
+
+#include <set>
+#include <string>
+#include <sstream>
+
+#include "InodeSet.hpp"
+
+namespace pstat
+{
+	/**
+	 * \brief The options of a collection that shape which entries its snapshot holds, recorded in the header of columnar
+	 * snapshots so that a later collection can tell whether a snapshot holds all the entries it needs from a baseline.
+	 *
+	 * The options are encoded as "key value" lines, where strings are written as their length, a space and their bytes,
+	 * as in the checkpoint files.
+	 */
+	class CollectionOptions
+	{
+		/**
+		 * \brief Reads a string written as its length, a space and its bytes
+		 */
+		static bool readString(std::istream& in, std::string& str)
+		{
+			size_t length;
+
+			if (!(in >> length) || in.get() != ' ')
+			{
+				return false;
+			}
+
+			// The options are decoded from memory, so the length cannot exceed what is left of them
+			std::streampos position = in.tellg();
+			in.seekg(0, std::ios::end);
+
+			if (static_cast<size_t>(in.tellg() - position) < length)
+			{
+				return false;
+			}
+
+			in.seekg(position);
+			str.resize(length);
+
+			return length == 0 || in.read(&str[0], length);
+		}
+
+	public:
+		std::set<std::string> exclusions; //!< The exclusion patterns (see \ref ExclusionFilter)
+		bool oneFileSystem; //!< Set if the directories on other filesystems than the collected path's were not traversed
+		std::string filter; //!< The expression the records were selected with (see \ref RecordFilter), or empty if not filtered
+		HardlinkMode hardlinks; //!< How the entries with several hard links were accounted for
+
+		CollectionOptions()
+		{
+			oneFileSystem = false;
+			hardlinks = HARDLINKS_COUNT;
+		}
+
+		/**
+		 * \brief Returns the encoded options
+		 */
+		std::string encode() const
+		{
+			std::ostringstream out;
+
+			for (const std::string& pattern : exclusions)
+			{
+				out << "exclude " << pattern.size() << ' ' << pattern << "\n";
+			}
+
+			out << "one-file-system " << oneFileSystem << "\n";
+			out << "filter " << filter.size() << ' ' << filter << "\n";
+			out << "hardlinks " << hardlinks << "\n";
+
+			return out.str();
+		}
+
+		/**
+		 * \brief Decodes the specified options, as returned by \ref encode()
+		 * \return True on success, false if they are corrupted or hold an unknown option
+		 */
+		bool decode(const std::string& encoded)
+		{
+			std::istringstream in(encoded);
+			std::string key;
+			int mode;
+
+			*this = CollectionOptions();
+
+			while (in >> key)
+			{
+				std::string pattern;
+
+				if (key == "exclude" && readString(in, pattern))
+				{
+					exclusions.insert(pattern);
+				}
+				else if (key == "hardlinks" && (in >> mode) && mode >= HARDLINKS_COUNT && mode <= HARDLINKS_DROP)
+				{
+					hardlinks = static_cast<HardlinkMode>(mode);
+				}
+				else if ((key != "one-file-system" || !(in >> oneFileSystem)) && (key != "filter" || !readString(in, filter)))
+				{
+					return false;
+				}
+			}
+
+			return in.eof();
+		}
+
+		/**
+		 * \brief Tells whether a snapshot collected with these options holds all the entries a collection with the
+		 * specified options would, so that it can serve as its baseline
+		 * \param reason Receives why it does not, if it does not
+		 */
+		bool covers(const CollectionOptions& collection, std::string& reason) const
+		{
+			// The entries excluded by the collection are left out of the copies too, but the ones excluded by the
+			// snapshot only would never come back
+			for (const std::string& pattern : exclusions)
+			{
+				if (collection.exclusions.count(pattern) == 0)
+				{
+					reason = "it excludes " + pattern;
+					return false;
+				}
+			}
+
+			if (oneFileSystem && !collection.oneFileSystem)
+			{
+				reason = "it is limited to one file system";
+				return false;
+			}
+
+			// Even the same expression may select other records now, as times are relative to the start of the collection
+			if (!filter.empty())
+			{
+				reason = "it only holds the records matching " + filter;
+				return false;
+			}
+
+			if (hardlinks == HARDLINKS_DROP)
+			{
+				reason = "it only holds the first link found of each inode";
+				return false;
+			}
+
+			return true;
+		}
+
+		bool operator==(const CollectionOptions& other) const
+		{
+			return exclusions == other.exclusions && oneFileSystem == other.oneFileSystem && filter == other.filter
+					&& hardlinks == other.hardlinks;
+		}
+
+		bool operator!=(const CollectionOptions& other) const
+		{
+			return !(*this == other);
+		}
+	};
+}
+
+#endif	/* COLLECTIONOPTIONS_HPP */
@@ -0,0 +1,296 @@
+#ifndef COLUMNARFORMAT_HPP
+#define	COLUMNARFORMAT_HPP
+
+#include <cstring>
+#include <sys/types.h>
+
+#include "RecordChunk.hpp"
+
+#define COLUMNAR_ROW_GROUP_SIZE 65536 //!< Maximum number of records in each row group of a columnar snapshot
+#define COLUMNAR_VERSION 4 //!< Version of the columnar snapshot layout, bumped on incompatible changes
+
+namespace pstat
+{
+	/**
+	 * \brief The fixed-width columns of a columnar snapshot, in the order they are stored in each row group
+	 */
+	enum ColumnarColumn
+	{
+		COLUMN_DEV,
+		COLUMN_INO,
+		COLUMN_NLINK,
+		COLUMN_ATIME,
+		COLUMN_MTIME,
+		COLUMN_CTIME,
+		COLUMN_UID,
+		COLUMN_GID,
+		COLUMN_MODE,
+		COLUMN_SIZE,
+		COLUMN_BLOCKS,
+		COLUMN_FLAGS,
+		COLUMN_COUNT
+	};
+
+	/**
+	 * \brief Describes the layout of the columnar snapshots, and provides the encoding helpers shared by
+	 * \ref ColumnarWriter and \ref ColumnarReader. All the integers are little-endian.
+	 *
+	 * A snapshot is laid out as follows:
+	 * - File header (24 bytes): the magic "PSTATCOL", the layout version (u32), the number of columns (u32) and the time
+	 *   the collection started (i64), before any entry was stated
+	 * - Options: the length of the \ref CollectionOptions of the collection (u32), then the encoded options, zero-padded so
+	 *   that the whole is a multiple of 8 bytes
+	 * - Row groups, each made of:
+	 *   - A header: the magic "PCRG", the number of rows (u32), the size of the path column (u64), the width in bytes of
+	 *     each column (u8 each, zero-padded to 16 bytes), then the minimum and the maximum of each column (u64 each;
+	 *     signed columns hold the bits of an i64)
+	 *   - The fixed-width columns, in \ref ColumnarColumn order, each zero-padded to a multiple of 8 bytes. Columns are
+	 *     frame-of-reference encoded: each value is stored as its distance from the column minimum, in the fewest bytes
+	 *     that fit the distance between the minimum and the maximum (0 bytes for a constant column). Distances of signed
+	 *     columns are taken in the order of \ref toOrdered(). Values are still fixed-width, so any row is addressable.
+	 *   - The path column: for each row, the length of the prefix shared with the previous row's path (varint), the
+	 *     length of the rest (varint) and the rest of the path. The first row of each group shares nothing, so groups
+	 *     are decoded independently. The column is zero-padded to a multiple of 8 bytes.
+	 * - Footer: the number of row groups (u64), then the file offset of each row group (u64 each)
+	 * - Trailer (24 bytes): the total number of records (u64), the file offset of the footer (u64) and the magic "PSTATEND"
+	 */
+	class ColumnarFormat
+	{
+	public:
+		static const size_t FILE_HEADER_SIZE = 24; //!< Size of the file header
+		static const size_t ROW_GROUP_HEADER_SIZE = 32 + COLUMN_COUNT * 16; //!< Size of the header of each row group
+		static const size_t TRAILER_SIZE = 24; //!< Size of the trailer
+		static const size_t MAX_VARINT_SIZE = 10; //!< Maximum number of bytes of an encoded 64-bit varint
+
+		/**
+		 * \brief Returns the magic at the start of the file
+		 */
+		static const char* getFileMagic()
+		{
+			return "PSTATCOL";
+		}
+
+		/**
+		 * \brief Returns the magic at the start of each row group
+		 */
+		static const char* getRowGroupMagic()
+		{
+			return "PCRG";
+		}
+
+		/**
+		 * \brief Returns the magic at the end of the file
+		 */
+		static const char* getTrailerMagic()
+		{
+			return "PSTATEND";
+		}
+
+		/**
+		 * \brief Returns true if the values of the specified column are signed
+		 */
+		static inline bool isColumnSigned(int column)
+		{
+			return column == COLUMN_ATIME || column == COLUMN_MTIME || column == COLUMN_CTIME;
+		}
+
+		/**
+		 * \brief Returns the name of the specified column, in lower case
+		 */
+		static const char* getColumnName(int column)
+		{
+			static const char* names[COLUMN_COUNT] = {"dev", "ino", "nlink", "atime", "mtime", "ctime", "uid", "gid", "mode",
+					"size", "blocks", "flags"};
+
+			return names[column];
+		}
+
+		/**
+		 * \brief Maps the bits of a value of the specified column to an unsigned integer of the same order, so that signed
+		 * and unsigned columns are compared and subtracted alike. The mapping is its own inverse.
+		 */
+		static inline u_int64_t toOrdered(int column, u_int64_t value)
+		{
+			return isColumnSigned(column) ? value ^ (1ull << 63) : value;
+		}
+
+		/**
+		 * \brief Returns the number of bytes needed to store the specified distance
+		 */
+		static inline size_t getWidth(u_int64_t distance)
+		{
+			size_t width = 0;
+
+			while (distance != 0)
+			{
+				width++;
+				distance >>= 8;
+			}
+
+			return width;
+		}
+
+		/**
+		 * \brief Returns the value of the specified column of the specified record. Signed values are returned as their bits.
+		 */
+		static inline u_int64_t getValue(const StatRecord& rec, int column)
+		{
+			switch (column)
+			{
+				case COLUMN_DEV: return rec.dev;
+				case COLUMN_INO: return rec.ino;
+				case COLUMN_NLINK: return rec.nlink;
+				case COLUMN_ATIME: return rec.atime;
+				case COLUMN_MTIME: return rec.mtime;
+				case COLUMN_CTIME: return rec.ctime;
+				case COLUMN_UID: return rec.uid;
+				case COLUMN_GID: return rec.gid;
+				case COLUMN_MODE: return rec.mode;
+				case COLUMN_SIZE: return rec.size;
+				case COLUMN_BLOCKS: return rec.blocks;
+				default: return rec.flags;
+			}
+		}
+
+		/**
+		 * \brief Sets the specified column of the specified record to the specified value (as returned by \ref getValue())
+		 */
+		static inline void setValue(StatRecord& rec, int column, u_int64_t value)
+		{
+			switch (column)
+			{
+				case COLUMN_DEV: rec.dev = value; break;
+				case COLUMN_INO: rec.ino = value; break;
+				case COLUMN_NLINK: rec.nlink = value; break;
+				case COLUMN_ATIME: rec.atime = value; break;
+				case COLUMN_MTIME: rec.mtime = value; break;
+				case COLUMN_CTIME: rec.ctime = value; break;
+				case COLUMN_UID: rec.uid = value; break;
+				case COLUMN_GID: rec.gid = value; break;
+				case COLUMN_MODE: rec.mode = value; break;
+				case COLUMN_SIZE: rec.size = value; break;
+				case COLUMN_BLOCKS: rec.blocks = value; break;
+				default: rec.flags = value; break;
+			}
+		}
+
+		/**
+		 * \brief Stores the specified integer at out, in little-endian byte order
+		 */
+		template<typename T>
+		static inline void store(char* out, T value)
+		{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+			for (size_t i = 0; i < sizeof(T); i++)
+			{
+				out[i] = static_cast<char>(value >> (i * 8));
+			}
+#else
+			memcpy(out, &value, sizeof(T));
+#endif
+		}
+
+		/**
+		 * \brief Loads a little-endian integer from in
+		 */
+		template<typename T>
+		static inline T load(const char* in)
+		{
+			T value;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+			value = 0;
+
+			for (size_t i = 0; i < sizeof(T); i++)
+			{
+				value |= static_cast<T>(static_cast<unsigned char>(in[i])) << (i * 8);
+			}
+#else
+			memcpy(&value, in, sizeof(T));
+#endif
+			return value;
+		}
+
+		/**
+		 * \brief Stores the lowest width bytes of the specified integer at out, in little-endian byte order
+		 */
+		static inline void storePacked(char* out, u_int64_t value, size_t width)
+		{
+			for (size_t i = 0; i < width; i++)
+			{
+				out[i] = static_cast<char>(value >> (i * 8));
+			}
+		}
+
+		/**
+		 * \brief Loads a little-endian integer of width bytes from in
+		 */
+		static inline u_int64_t loadPacked(const char* in, size_t width)
+		{
+			u_int64_t value = 0;
+
+			for (size_t i = 0; i < width; i++)
+			{
+				value |= static_cast<u_int64_t>(static_cast<unsigned char>(in[i])) << (i * 8);
+			}
+
+			return value;
+		}
+
+		/**
+		 * \brief Encodes the specified integer at out, 7 bits per byte, least significant first
+		 * \return The end of the encoded integer
+		 */
+		static inline char* encodeVarint(char* out, u_int64_t value)
+		{
+			while (value >= 0x80)
+			{
+				*out++ = static_cast<char>(value | 0x80);
+				value >>= 7;
+			}
+
+			*out++ = static_cast<char>(value);
+
+			return out;
+		}
+
+		/**
+		 * \brief Decodes an integer encoded by \ref encodeVarint() from the bytes between in and end
+		 * \return The end of the encoded integer, or NULL if it runs past end or is too long
+		 */
+		static inline const char* decodeVarint(const char* in, const char* end, u_int64_t& value)
+		{
+			value = 0;
+
+			for (int shift = 0; in < end && shift < 64; shift += 7)
+			{
+				unsigned char byte = *in++;
+				value |= static_cast<u_int64_t>(byte & 0x7f) << shift;
+
+				if ((byte & 0x80) == 0)
+				{
+					return in;
+				}
+			}
+
+			return NULL;
+		}
+
+		/**
+		 * \brief Returns the file offset of the first row group, given the length of the encoded options
+		 */
+		static inline u_int64_t getDataOffset(u_int32_t optionsLength)
+		{
+			return FILE_HEADER_SIZE + getPaddedSize(4 + static_cast<u_int64_t>(optionsLength));
+		}
+
+		/**
+		 * \brief Rounds the specified size up to a multiple of 8
+		 */
+		static inline size_t getPaddedSize(size_t size)
+		{
+			return (size + 7) & ~static_cast<size_t>(7);
+		}
+	};
+}
+
+#endif	/* COLUMNARFORMAT_HPP */
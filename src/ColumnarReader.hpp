@@ -0,0 +1,459 @@
+#ifndef COLUMNARREADER_HPP
+#define	COLUMNARREADER_HPP
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <fstream>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ColumnarFormat.hpp"
+#include "CollectionOptions.hpp"
+
+namespace pstat
+{
+	/**
+	 * \brief Reads a columnar snapshot written by \ref ColumnarWriter. The file is memory-mapped, so row groups are
+	 * decoded straight from the page cache, and whatever is skipped (e.g. row groups ruled out by their statistics,
+	 * or columns that are not needed) is never read from disk. All the offsets are validated, so a truncated or
+	 * corrupted file is reported rather than crashing the reader.
+	 * The methods are const and thread-safe once \ref open() returns.
+	 */
+	class ColumnarReader
+	{
+	public:
+		/**
+		 * \brief A row group of the snapshot
+		 */
+		struct RowGroup
+		{
+			u_int32_t rows; //!< Number of rows
+			const char* columns[COLUMN_COUNT]; //!< The fixed-width columns
+			size_t widths[COLUMN_COUNT]; //!< Width in bytes of the values of each column
+			const char* paths; //!< The path column
+			const char* pathsEnd; //!< The end of the path column
+			u_int64_t min[COLUMN_COUNT]; //!< Minimum of each column. Signed columns hold the bits of an int64_t
+			u_int64_t max[COLUMN_COUNT]; //!< Maximum of each column. Signed columns hold the bits of an int64_t
+
+			/**
+			 * \brief Returns the value of the specified column at the specified row. Signed values are returned as their bits.
+			 */
+			inline u_int64_t getValue(int column, size_t row) const
+			{
+				u_int64_t distance = ColumnarFormat::loadPacked(columns[column] + row * widths[column], widths[column]);
+
+				return ColumnarFormat::toOrdered(column, ColumnarFormat::toOrdered(column, min[column]) + distance);
+			}
+
+			/**
+			 * \brief Fills the stat fields of the specified record with the values of the specified row
+			 */
+			inline void getRecord(size_t row, StatRecord& rec) const
+			{
+				for (int c = 0; c < COLUMN_COUNT; c++)
+				{
+					ColumnarFormat::setValue(rec, c, getValue(c, row));
+				}
+			}
+
+			/**
+			 * \brief Decodes the path of the row whose path starts at in, given the path of the previous row
+			 * \param in Advanced past the path of the row
+			 * \param path Holds the path of the previous row (or anything, for the first row), replaced by the path of the row
+			 * \return True on success, false if the path column is corrupted
+			 */
+			inline bool decodePath(const char*& in, std::string& path) const
+			{
+				u_int64_t shared;
+				u_int64_t rest;
+
+				if ((in = ColumnarFormat::decodeVarint(in, pathsEnd, shared)) == NULL
+						|| (in = ColumnarFormat::decodeVarint(in, pathsEnd, rest)) == NULL
+						|| shared > path.size() || rest > static_cast<u_int64_t>(pathsEnd - in))
+				{
+					return false;
+				}
+
+				path.resize(shared);
+				path.append(in, rest);
+				in += rest;
+
+				return true;
+			}
+
+			/**
+			 * \brief Skips the path of the row whose path starts at in, without decoding it
+			 * \param in Advanced past the path of the row
+			 * \return True on success, false if the path column is corrupted
+			 */
+			inline bool skipPath(const char*& in) const
+			{
+				u_int64_t shared;
+				u_int64_t rest;
+
+				if ((in = ColumnarFormat::decodeVarint(in, pathsEnd, shared)) == NULL
+						|| (in = ColumnarFormat::decodeVarint(in, pathsEnd, rest)) == NULL
+						|| rest > static_cast<u_int64_t>(pathsEnd - in))
+				{
+					return false;
+				}
+
+				in += rest;
+
+				return true;
+			}
+		};
+
+	private:
+		int m_Fd; //!< The snapshot file descriptor
+		const char* m_Data; //!< The mapped snapshot
+		size_t m_Size; //!< Size of the snapshot
+		std::vector<u_int64_t> m_RowGroupOffsets; //!< File offset of each row group
+		u_int64_t m_Records; //!< Total number of records
+		int64_t m_StartTime; //!< The time the collection started
+		CollectionOptions m_Options; //!< The options of the collection
+		std::string m_Error; //!< Describes why \ref open() or a read failed
+
+		ColumnarReader(const ColumnarReader&);
+		ColumnarReader& operator=(const ColumnarReader&);
+
+		/**
+		 * \brief Sets the error message and returns false
+		 */
+		bool fail(const std::string& error)
+		{
+			m_Error = error;
+			return false;
+		}
+
+	public:
+
+		ColumnarReader()
+		{
+			m_Fd = -1;
+			m_Data = NULL;
+			m_Size = 0;
+			m_Records = 0;
+			m_StartTime = 0;
+		}
+
+		/**
+		 * \brief Maps the specified snapshot and validates its header, footer and trailer
+		 * \return True on success, false otherwise (see \ref getError())
+		 */
+		bool open(const std::string& path)
+		{
+			close();
+
+			struct stat sb;
+
+			if ((m_Fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC)) < 0 || fstat(m_Fd, &sb) != 0)
+			{
+				return fail(strerror(errno));
+			}
+
+			m_Size = sb.st_size;
+
+			if (m_Size < ColumnarFormat::FILE_HEADER_SIZE + ColumnarFormat::TRAILER_SIZE + 8)
+			{
+				return fail("not a pstat columnar snapshot (too short)");
+			}
+
+			void* data = mmap(NULL, m_Size, PROT_READ, MAP_SHARED, m_Fd, 0);
+
+			if (data == MAP_FAILED)
+			{
+				return fail(strerror(errno));
+			}
+
+			m_Data = static_cast<const char*>(data);
+			madvise(data, m_Size, MADV_SEQUENTIAL);
+
+			if (memcmp(m_Data, ColumnarFormat::getFileMagic(), 8) != 0)
+			{
+				return fail("not a pstat columnar snapshot (bad magic)");
+			}
+
+			if (ColumnarFormat::load<u_int32_t>(m_Data + 8) != COLUMNAR_VERSION
+					|| ColumnarFormat::load<u_int32_t>(m_Data + 12) != COLUMN_COUNT)
+			{
+				return fail("unsupported columnar snapshot version");
+			}
+
+			m_StartTime = ColumnarFormat::load<int64_t>(m_Data + 16);
+
+			u_int32_t optionsLength = ColumnarFormat::load<u_int32_t>(m_Data + ColumnarFormat::FILE_HEADER_SIZE);
+			u_int64_t dataOffset = ColumnarFormat::getDataOffset(optionsLength);
+
+			if (dataOffset > m_Size - ColumnarFormat::TRAILER_SIZE - 8
+					|| !m_Options.decode(std::string(m_Data + ColumnarFormat::FILE_HEADER_SIZE + 4, optionsLength)))
+			{
+				return fail("corrupted columnar snapshot (bad options)");
+			}
+
+			const char* trailer = m_Data + m_Size - ColumnarFormat::TRAILER_SIZE;
+
+			if (memcmp(trailer + 16, ColumnarFormat::getTrailerMagic(), 8) != 0)
+			{
+				return fail("truncated columnar snapshot (missing trailer)");
+			}
+
+			m_Records = ColumnarFormat::load<u_int64_t>(trailer);
+			u_int64_t footerOffset = ColumnarFormat::load<u_int64_t>(trailer + 8);
+
+			if (footerOffset < dataOffset || footerOffset + 8 > m_Size - ColumnarFormat::TRAILER_SIZE)
+			{
+				return fail("corrupted columnar snapshot (bad footer offset)");
+			}
+
+			u_int64_t count = ColumnarFormat::load<u_int64_t>(m_Data + footerOffset);
+
+			if (count > (m_Size - ColumnarFormat::TRAILER_SIZE - footerOffset - 8) / 8)
+			{
+				return fail("corrupted columnar snapshot (bad footer)");
+			}
+
+			for (u_int64_t i = 0; i < count; i++)
+			{
+				m_RowGroupOffsets.push_back(ColumnarFormat::load<u_int64_t>(m_Data + footerOffset + 8 + i * 8));
+			}
+
+			return true;
+		}
+
+		/**
+		 * \brief Opens the specified columnar snapshot, or the shards listed in the specified manifest of a sharded one
+		 * \param snapshots Receives a reader per snapshot (or shard)
+		 * \param error Receives the description of the error, on failure
+		 * \return True on success, false otherwise
+		 */
+		static bool openShards(const std::string& path, std::vector<std::unique_ptr<ColumnarReader>>& snapshots, std::string& error)
+		{
+			std::unique_ptr<ColumnarReader> reader(new ColumnarReader());
+			std::ifstream manifest(path.c_str());
+			std::string::size_type slash = path.rfind('/');
+			std::string directory = path.substr(0, slash == std::string::npos ? 0 : slash + 1);
+			std::string line;
+
+			if (reader->open(path))
+			{
+				snapshots.push_back(std::move(reader));
+				return true;
+			}
+
+			if (!std::getline(manifest, line) || line != "SHARD,RECORDS")
+			{
+				error = reader->getError();
+				return false;
+			}
+
+			while (std::getline(manifest, line))
+			{
+				// SHARD,RECORDS lines, the shard name being quoted with its quotes doubled
+				std::string name;
+				size_t i = 1;
+
+				for (; line[0] == '"' && i < line.size() && (line[i] != '"' || (i + 1 < line.size() && line[i + 1] == '"')); i++)
+				{
+					i += line[i] == '"';
+					name.push_back(line[i]);
+				}
+
+				if (name.empty() || i == line.size())
+				{
+					error = "bad manifest line: " + line;
+					return false;
+				}
+
+				std::string shardPath = name[0] == '/' ? name : directory + name;
+				snapshots.push_back(std::unique_ptr<ColumnarReader>(new ColumnarReader()));
+
+				if (!snapshots.back()->open(shardPath))
+				{
+					error = shardPath + ": " + snapshots.back()->getError();
+					return false;
+				}
+			}
+
+			if (snapshots.empty())
+			{
+				error = "the manifest lists no shards";
+				return false;
+			}
+
+			return true;
+		}
+
+		/**
+		 * \brief Returns the description of the last error
+		 */
+		const std::string& getError() const
+		{
+			return m_Error;
+		}
+
+		/**
+		 * \brief Returns the total number of records in the snapshot
+		 */
+		u_int64_t getRecordsCount() const
+		{
+			return m_Records;
+		}
+
+		/**
+		 * \brief Returns the time the collection of the snapshot started. Entries changed since then may or may not be
+		 * reflected in the snapshot.
+		 */
+		int64_t getStartTime() const
+		{
+			return m_StartTime;
+		}
+
+		/**
+		 * \brief Returns the options of the collection of the snapshot
+		 */
+		const CollectionOptions& getOptions() const
+		{
+			return m_Options;
+		}
+
+		/**
+		 * \brief Returns the number of row groups in the snapshot
+		 */
+		size_t getRowGroupsCount() const
+		{
+			return m_RowGroupOffsets.size();
+		}
+
+		/**
+		 * \brief Gets the row group with the specified index
+		 * \return True on success, false if the row group is corrupted
+		 */
+		bool getRowGroup(size_t index, RowGroup& group) const
+		{
+			u_int64_t offset = m_RowGroupOffsets[index];
+
+			if (offset > m_Size || m_Size - offset < ColumnarFormat::ROW_GROUP_HEADER_SIZE)
+			{
+				return false;
+			}
+
+			const char* header = m_Data + offset;
+
+			if (memcmp(header, ColumnarFormat::getRowGroupMagic(), 4) != 0)
+			{
+				return false;
+			}
+
+			group.rows = ColumnarFormat::load<u_int32_t>(header + 4);
+			u_int64_t pathsLength = ColumnarFormat::load<u_int64_t>(header + 8);
+			u_int64_t position = offset + ColumnarFormat::ROW_GROUP_HEADER_SIZE;
+
+			for (int c = 0; c < COLUMN_COUNT; c++)
+			{
+				group.widths[c] = static_cast<unsigned char>(header[16 + c]);
+				group.min[c] = ColumnarFormat::load<u_int64_t>(header + 32 + c * 16);
+				group.max[c] = ColumnarFormat::load<u_int64_t>(header + 40 + c * 16);
+
+				if (group.widths[c] > sizeof(u_int64_t))
+				{
+					return false;
+				}
+
+				group.columns[c] = m_Data + position;
+				position += ColumnarFormat::getPaddedSize(static_cast<u_int64_t>(group.rows) * group.widths[c]);
+			}
+
+			group.paths = m_Data + position;
+			group.pathsEnd = group.paths + pathsLength;
+
+			return position <= m_Size && pathsLength <= m_Size - position;
+		}
+
+		/**
+		 * \brief Decodes all the records of the specified row group, calling visit(const StatRecord&, const std::string& path)
+		 * for each of them, in order
+		 * \return True on success, false if the row group is corrupted
+		 */
+		template<typename Visitor>
+		bool forEach(const RowGroup& group, Visitor visit) const
+		{
+			StatRecord rec;
+			std::string path;
+			const char* in = group.paths;
+
+			memset(&rec, 0, sizeof(rec));
+			rec.parent = NO_PARENT_DIRECTORY;
+
+			for (size_t row = 0; row < group.rows; row++)
+			{
+				if (!group.decodePath(in, path))
+				{
+					return false;
+				}
+
+				group.getRecord(row, rec);
+				visit(rec, path);
+			}
+
+			return true;
+		}
+
+		/**
+		 * \brief Decodes all the records of the snapshot, calling visit(const StatRecord&, const std::string& path) for
+		 * each of them, in order
+		 * \return True on success, false if the snapshot is corrupted (see \ref getError())
+		 */
+		template<typename Visitor>
+		bool forEach(Visitor visit)
+		{
+			RowGroup group;
+
+			for (size_t i = 0; i < getRowGroupsCount(); i++)
+			{
+				if (!getRowGroup(i, group) || !forEach(group, visit))
+				{
+					return fail("corrupted columnar snapshot (bad row group)");
+				}
+			}
+
+			return true;
+		}
+
+		/**
+		 * \brief Unmaps and closes the snapshot, if open
+		 */
+		void close()
+		{
+			if (m_Data != NULL)
+			{
+				munmap(const_cast<char*>(m_Data), m_Size);
+				m_Data = NULL;
+			}
+
+			if (m_Fd >= 0)
+			{
+				::close(m_Fd);
+				m_Fd = -1;
+			}
+
+			m_RowGroupOffsets.clear();
+			m_Records = 0;
+			m_StartTime = 0;
+			m_Options = CollectionOptions();
+			m_Error.clear();
+		}
+
+		~ColumnarReader()
+		{
+			close();
+		}
+	};
+}
+
+#endif	/* COLUMNARREADER_HPP */
@@ -0,0 +1,449 @@
+#ifndef COLUMNARWRITER_HPP
+#define	COLUMNARWRITER_HPP
+
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <climits>
+#include <ctime>
+#include <sys/uio.h>
+
+#include "ColumnarFormat.hpp"
+#include "CollectionOptions.hpp"
+#include "RecordWriter.hpp"
+
+namespace pstat
+{
+	/**
+	 * \brief Writes stat records as a columnar snapshot (see \ref ColumnarFormat for the layout). Records are gathered
+	 * into row groups of \ref COLUMNAR_ROW_GROUP_SIZE rows, each written with a single writev() once full. Paths are
+	 * front-coded against the previous record's path, which is cheap and effective since the records of a directory
+	 * come in a row.
+	 * Not thread-safe: each instance must be used by one thread at a time.
+	 */
+	class ColumnarWriter : public RecordWriter
+	{
+		int m_Fd; //!< The output file descriptor
+		int m_Error; //!< The errno of the first failed write, or 0
+		u_int64_t m_Offset; //!< Number of bytes written to the file so far
+		std::vector<u_int64_t> m_Values[COLUMN_COUNT]; //!< The values of each column of the current row group, order-preserving encoded
+		std::vector<char> m_Columns[COLUMN_COUNT]; //!< The packed columns of the current row group, ready to be written
+		std::vector<char> m_Paths; //!< The path column of the current row group
+		size_t m_PathsLength; //!< Number of used bytes in \ref m_Paths
+		u_int32_t m_Rows; //!< Number of rows in the current row group
+		u_int64_t m_Min[COLUMN_COUNT]; //!< Minimum of each column of the current row group, order-preserving encoded
+		u_int64_t m_Max[COLUMN_COUNT]; //!< Maximum of each column of the current row group, order-preserving encoded
+		std::string m_Path; //!< The path of the current record
+		std::string m_PreviousPath; //!< The path of the previous record of the current row group
+		std::vector<u_int64_t> m_RowGroupOffsets; //!< File offset of each written row group
+		u_int64_t m_Records; //!< Number of records written so far
+		std::string m_Options; //!< The encoded options of the collection, written in the file header
+
+		ColumnarWriter(const ColumnarWriter&);
+		ColumnarWriter& operator=(const ColumnarWriter&);
+
+		/**
+		 * \brief Appends the specified value to the specified column of the current row group
+		 */
+		inline void addValue(int column, u_int64_t value)
+		{
+			u_int64_t ordered = ColumnarFormat::toOrdered(column, value);
+
+			m_Values[column][m_Rows] = ordered;
+			m_Min[column] = std::min(m_Min[column], ordered);
+			m_Max[column] = std::max(m_Max[column], ordered);
+		}
+
+		/**
+		 * \brief Appends the path of the current record to the path column of the current row group
+		 */
+		inline void addPath()
+		{
+			size_t shared = 0;
+			size_t limit = std::min(m_Path.size(), m_PreviousPath.size());
+
+			while (shared < limit && m_Path[shared] == m_PreviousPath[shared])
+			{
+				shared++;
+			}
+
+			size_t rest = m_Path.size() - shared;
+
+			if (m_PathsLength + rest + 2 * ColumnarFormat::MAX_VARINT_SIZE > m_Paths.size())
+			{
+				m_Paths.resize(std::max(m_Paths.size() * 2, m_PathsLength + rest + 2 * ColumnarFormat::MAX_VARINT_SIZE));
+			}
+
+			char* out = &m_Paths[m_PathsLength];
+			out = ColumnarFormat::encodeVarint(out, shared);
+			out = ColumnarFormat::encodeVarint(out, rest);
+			memcpy(out, m_Path.data() + shared, rest);
+			m_PathsLength = out + rest - &m_Paths[0];
+
+			m_PreviousPath.swap(m_Path);
+		}
+
+		/**
+		 * \brief Writes all the specified buffers to the file, resuming after partial writes
+		 */
+		void writeFully(struct iovec* iov, int count)
+		{
+			while (m_Error == 0 && count > 0)
+			{
+				ssize_t ret = writev(m_Fd, iov, std::min(count, IOV_MAX));
+
+				if (ret < 0)
+				{
+					m_Error = errno != EINTR ? errno : 0;
+					continue;
+				}
+
+				m_Offset += ret;
+
+				// Skip the buffers written as a whole, then the written part of the next one
+				while (count > 0 && static_cast<size_t>(ret) >= iov->iov_len)
+				{
+					ret -= iov->iov_len;
+					iov++;
+					count--;
+				}
+
+				if (count > 0)
+				{
+					iov->iov_base = static_cast<char*>(iov->iov_base) + ret;
+					iov->iov_len -= ret;
+				}
+			}
+		}
+
+		/**
+		 * \brief Writes the current row group to the file, and starts a new one
+		 */
+		void flushRowGroup()
+		{
+			static const char padding[8] = {0};
+			char header[ColumnarFormat::ROW_GROUP_HEADER_SIZE];
+			struct iovec iov[1 + COLUMN_COUNT * 2 + 2];
+			int count = 0;
+
+			memset(header, 0, sizeof(header));
+			memcpy(header, ColumnarFormat::getRowGroupMagic(), 4);
+			ColumnarFormat::store<u_int32_t>(header + 4, m_Rows);
+			ColumnarFormat::store<u_int64_t>(header + 8, m_PathsLength);
+
+			m_RowGroupOffsets.push_back(m_Offset);
+
+			iov[count].iov_base = header;
+			iov[count++].iov_len = sizeof(header);
+
+			for (int c = 0; c < COLUMN_COUNT; c++)
+			{
+				// Frame of reference: store the distances from the minimum, in as few bytes as they need
+				size_t width = ColumnarFormat::getWidth(m_Max[c] - m_Min[c]);
+				size_t length = m_Rows * width;
+				char* out = &m_Columns[c][0];
+
+				for (u_int32_t row = 0; row < m_Rows; row++)
+				{
+					ColumnarFormat::storePacked(out + row * width, m_Values[c][row] - m_Min[c], width);
+				}
+
+				header[16 + c] = width;
+				ColumnarFormat::store<u_int64_t>(header + 32 + c * 16, ColumnarFormat::toOrdered(c, m_Min[c]));
+				ColumnarFormat::store<u_int64_t>(header + 40 + c * 16, ColumnarFormat::toOrdered(c, m_Max[c]));
+
+				iov[count].iov_base = out;
+				iov[count++].iov_len = length;
+				iov[count].iov_base = const_cast<char*>(padding);
+				iov[count++].iov_len = ColumnarFormat::getPaddedSize(length) - length;
+			}
+
+			iov[count].iov_base = m_Paths.empty() ? const_cast<char*>(padding) : &m_Paths[0];
+			iov[count++].iov_len = m_PathsLength;
+			iov[count].iov_base = const_cast<char*>(padding);
+			iov[count++].iov_len = ColumnarFormat::getPaddedSize(m_PathsLength) - m_PathsLength;
+
+			writeFully(iov, count);
+
+			m_Records += m_Rows;
+			resetRowGroup();
+		}
+
+		/**
+		 * \brief Empties the current row group
+		 */
+		void resetRowGroup()
+		{
+			m_Rows = 0;
+			m_PathsLength = 0;
+			m_PreviousPath.clear();
+
+			for (int c = 0; c < COLUMN_COUNT; c++)
+			{
+				m_Min[c] = ~0ull;
+				m_Max[c] = 0;
+			}
+		}
+
+	public:
+
+		/**
+		 * \param options The options of the collection, recorded in the file header
+		 */
+		ColumnarWriter(const CollectionOptions& options = CollectionOptions())
+				: m_Paths(COLUMNAR_ROW_GROUP_SIZE * 16), m_Options(options.encode())
+		{
+			for (int c = 0; c < COLUMN_COUNT; c++)
+			{
+				m_Values[c].resize(COLUMNAR_ROW_GROUP_SIZE);
+				m_Columns[c].resize(COLUMNAR_ROW_GROUP_SIZE * sizeof(u_int64_t));
+			}
+
+			m_Fd = -1;
+			m_Error = 0;
+			m_Offset = 0;
+			m_Records = 0;
+			resetRowGroup();
+		}
+
+		/**
+		 * \brief Creates (or truncates) the specified file and writes to it
+		 * \return True on success, false otherwise (errno is set)
+		 */
+		virtual bool open(const std::string& path)
+		{
+			close();
+
+			m_Fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+			m_Error = m_Fd < 0 ? errno : 0;
+			m_Offset = 0;
+			m_Records = 0;
+			m_RowGroupOffsets.clear();
+			resetRowGroup();
+
+			return m_Fd >= 0;
+		}
+
+		/**
+		 * \brief Reopens the specified snapshot, truncated at the specified offset, and appends row groups to it. The
+		 * row groups before the offset are indexed again, so that the footer lists them.
+		 * \return True on success, false otherwise (errno is set, or EINVAL if the offset is not at a row group boundary)
+		 */
+		virtual bool reopen(const std::string& path, u_int64_t offset)
+		{
+			close();
+
+			m_Fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+			m_Error = m_Fd < 0 ? errno : 0;
+			m_Offset = 0;
+			m_Records = 0;
+			m_RowGroupOffsets.clear();
+			resetRowGroup();
+
+			char length[4];
+
+			if (m_Error == 0 && pread(m_Fd, length, sizeof(length), ColumnarFormat::FILE_HEADER_SIZE) != static_cast<ssize_t>(sizeof(length)))
+			{
+				m_Error = EINVAL;
+			}
+
+			if (m_Error == 0)
+			{
+				m_Offset = ColumnarFormat::getDataOffset(ColumnarFormat::load<u_int32_t>(length));
+			}
+
+			while (m_Error == 0 && m_Offset < offset)
+			{
+				char header[ColumnarFormat::ROW_GROUP_HEADER_SIZE];
+
+				if (pread(m_Fd, header, sizeof(header), m_Offset) != static_cast<ssize_t>(sizeof(header))
+						|| memcmp(header, ColumnarFormat::getRowGroupMagic(), 4) != 0)
+				{
+					m_Error = EINVAL;
+					break;
+				}
+
+				u_int32_t rows = ColumnarFormat::load<u_int32_t>(header + 4);
+				u_int64_t size = sizeof(header) + ColumnarFormat::getPaddedSize(ColumnarFormat::load<u_int64_t>(header + 8));
+
+				for (int c = 0; c < COLUMN_COUNT; c++)
+				{
+					size += ColumnarFormat::getPaddedSize(static_cast<u_int64_t>(rows) * static_cast<unsigned char>(header[16 + c]));
+				}
+
+				m_RowGroupOffsets.push_back(m_Offset);
+				m_Records += rows;
+				m_Offset += size;
+			}
+
+			if (m_Error == 0 && m_Offset != offset)
+			{
+				m_Error = EINVAL;
+			}
+
+			if (m_Error == 0 && (ftruncate(m_Fd, offset) != 0 || lseek(m_Fd, offset, SEEK_SET) < 0))
+			{
+				m_Error = errno;
+			}
+
+			return m_Error == 0;
+		}
+
+		/**
+		 * \brief Writes the file header and the options of the collection. The current time is recorded as the start of
+		 * the collection, so the header must be written before any entry is stated.
+		 */
+		virtual void writeHeader()
+		{
+			static const char padding[8] = {0};
+			char header[ColumnarFormat::FILE_HEADER_SIZE + 4];
+			size_t optionsEnd = sizeof(header) + m_Options.size();
+			struct iovec iov[3] = {{header, sizeof(header)}, {const_cast<char*>(m_Options.data()), m_Options.size()},
+					{const_cast<char*>(padding), ColumnarFormat::getPaddedSize(optionsEnd) - optionsEnd}};
+
+			memcpy(header, ColumnarFormat::getFileMagic(), 8);
+			ColumnarFormat::store<u_int32_t>(header + 8, COLUMNAR_VERSION);
+			ColumnarFormat::store<u_int32_t>(header + 12, COLUMN_COUNT);
+			ColumnarFormat::store<int64_t>(header + 16, time(NULL));
+			ColumnarFormat::store<u_int32_t>(header + 24, m_Options.size());
+
+			writeFully(iov, 3);
+		}
+
+		/**
+		 * \brief Writes the specified stat record. Its path is the specified directory path followed by its name, with a
+		 * separator in between unless the directory path is empty or ends with one.
+		 */
+		void writeRecord(const StatRecord& rec, const char* dir, size_t dirLength, const char* name, size_t nameLength)
+		{
+			m_Path.assign(dir, dirLength);
+
+			if (dirLength > 0 && dir[dirLength - 1] != '/')
+			{
+				m_Path.push_back('/');
+			}
+
+			m_Path.append(name, nameLength);
+			addPath();
+
+			addValue(COLUMN_DEV, rec.dev);
+			addValue(COLUMN_INO, rec.ino);
+			addValue(COLUMN_NLINK, rec.nlink);
+			addValue(COLUMN_ATIME, rec.atime);
+			addValue(COLUMN_MTIME, rec.mtime);
+			addValue(COLUMN_CTIME, rec.ctime);
+			addValue(COLUMN_UID, rec.uid);
+			addValue(COLUMN_GID, rec.gid);
+			addValue(COLUMN_MODE, rec.mode);
+			addValue(COLUMN_SIZE, rec.size);
+			addValue(COLUMN_BLOCKS, rec.blocks);
+			addValue(COLUMN_FLAGS, rec.flags);
+
+			if (++m_Rows == COLUMNAR_ROW_GROUP_SIZE)
+			{
+				flushRowGroup();
+			}
+		}
+
+		/**
+		 * \brief Writes all the records of the specified chunk
+		 */
+		virtual void writeChunk(const RecordChunk& chunk, DirectoryPathCache& paths)
+		{
+			for (size_t i = 0; i < chunk.size(); i++)
+			{
+				const StatRecord& rec = chunk[i];
+				const std::string& dir = paths.getPath(rec.parent);
+
+				writeRecord(rec, dir.data(), dir.size(), chunk.getName(rec), rec.nameLength);
+			}
+		}
+
+		/**
+		 * \brief Writes the current row group, even if partial, and flushes the file to disk
+		 * \param offset Receives the size of the file
+		 * \return True on success, false if any write failed
+		 */
+		virtual bool sync(u_int64_t& offset)
+		{
+			if (m_Rows > 0)
+			{
+				flushRowGroup();
+			}
+
+			if (m_Error == 0 && fsync(m_Fd) != 0)
+			{
+				m_Error = errno;
+			}
+
+			offset = m_Offset;
+
+			return m_Error == 0;
+		}
+
+		/**
+		 * \brief Returns the errno of the first failed open or write, or 0 if none failed
+		 */
+		virtual int getError() const
+		{
+			return m_Error;
+		}
+
+		/**
+		 * \brief Writes the last row group, the footer and the trailer, and closes the file, if open
+		 * \return True on success, false if any write failed
+		 */
+		virtual bool close()
+		{
+			if (m_Fd < 0)
+			{
+				return m_Error == 0;
+			}
+
+			if (m_Rows > 0)
+			{
+				flushRowGroup();
+			}
+
+			std::vector<char> footer(8 + m_RowGroupOffsets.size() * 8 + ColumnarFormat::TRAILER_SIZE);
+			u_int64_t footerOffset = m_Offset;
+			char* out = &footer[0];
+
+			ColumnarFormat::store<u_int64_t>(out, m_RowGroupOffsets.size());
+			out += 8;
+
+			for (u_int64_t offset : m_RowGroupOffsets)
+			{
+				ColumnarFormat::store<u_int64_t>(out, offset);
+				out += 8;
+			}
+
+			ColumnarFormat::store<u_int64_t>(out, m_Records);
+			ColumnarFormat::store<u_int64_t>(out + 8, footerOffset);
+			memcpy(out + 16, ColumnarFormat::getTrailerMagic(), 8);
+
+			struct iovec iov = {&footer[0], footer.size()};
+			writeFully(&iov, 1);
+
+			if (::close(m_Fd) != 0 && m_Error == 0)
+			{
+				m_Error = errno;
+			}
+
+			m_Fd = -1;
+
+			return m_Error == 0;
+		}
+
+		~ColumnarWriter()
+		{
+			close();
+		}
+	};
+}
+
+#endif	/* COLUMNARWRITER_HPP */
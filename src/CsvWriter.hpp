@@ -0,0 +1,516 @@
+#ifndef CSVWRITER_HPP
+#define	CSVWRITER_HPP
+
+#include <vector>
+#include <memory>
+#include <string>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "CachedUtilities.hpp"
+#include "RecordWriter.hpp"
+#include "ParallelGzipWriter.hpp"
+
+#define CSV_WRITE_BUFFER_SIZE (1024 * 1024) //!< Size of the buffer records are formatted into, and of the write() calls that flush it
+#define CSV_MAX_FIELDS_LENGTH 256 //!< Upper bound of the length of a formatted record, excluding its user, group and path
+
+namespace pstat
+{
+	/**
+	 * \brief Formats stat records as CSV lines into a large buffer, and writes the buffer to a file with plain write()
+	 * calls once it fills up. Integers are formatted two digits at a time from a lookup table, names and dates come
+	 * from the tables of \ref CachedUtilities, so formatting a record neither allocates nor calls libc.
+	 * Paths are quoted, and quotes within them are doubled.
+	 * When compressing, the full buffer is handed over to a \ref ParallelGzipWriter instead of being written, so the
+	 * compression runs on other threads while the next records are formatted.
+	 * Not thread-safe: each instance must be used by one thread at a time.
+	 */
+	class CsvWriter : public RecordWriter
+	{
+		int m_Fd; //!< The output file descriptor
+		std::vector<char> m_Buffer; //!< Formatted records waiting to be written
+		size_t m_Length; //!< Number of valid bytes within \ref m_Buffer
+		int m_Error; //!< The errno of the first failed write, or 0
+		bool m_Human; //!< Set to true to write the human-readable format, false to write the raw one
+		bool m_Links; //!< Set to true to write the LINK column, telling the first link found of each inode from the others
+		int m_CompressThreads; //!< Number of compressor threads, or 0 to write uncompressed
+#ifdef HAVE_ZLIB_
+		std::unique_ptr<ParallelGzipWriter> m_Compressor; //!< Compresses and writes the buffer, if compressing
+#endif
+
+		CsvWriter(const CsvWriter&);
+		CsvWriter& operator=(const CsvWriter&);
+
+		/**
+		 * \brief Makes room for at least the specified number of bytes in \ref m_Buffer
+		 */
+		inline void reserve(size_t length)
+		{
+			if (m_Length + length > m_Buffer.size())
+			{
+				flush();
+
+				if (length > m_Buffer.size())
+				{
+					m_Buffer.resize(length);
+				}
+			}
+		}
+
+		/**
+		 * \brief Starts compressing to \ref m_Fd, if it is open and the output is compressed
+		 */
+		void startCompressor()
+		{
+#ifdef HAVE_ZLIB_
+			if (m_Fd >= 0 && m_CompressThreads > 0)
+			{
+				m_Compressor.reset(new ParallelGzipWriter(m_Fd, m_CompressThreads));
+			}
+#endif
+		}
+
+		/**
+		 * \brief Formats the specified integer at out
+		 * \return The end of the formatted integer
+		 */
+		static inline char* formatUnsigned(char* out, u_int64_t value)
+		{
+			static const char pairs[] = "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+				"404142434445464748495051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+
+			char digits[20];
+			char* p = digits + sizeof(digits);
+
+			while (value >= 100)
+			{
+				const char* pair = pairs + (value % 100) * 2;
+				value /= 100;
+				*--p = pair[1];
+				*--p = pair[0];
+			}
+
+			if (value >= 10)
+			{
+				*--p = pairs[value * 2 + 1];
+				*--p = pairs[value * 2];
+			}
+			else
+			{
+				*--p = '0' + value;
+			}
+
+			size_t length = digits + sizeof(digits) - p;
+			memcpy(out, p, length);
+
+			return out + length;
+		}
+
+		/**
+		 * \brief Formats the specified signed integer at out
+		 * \return The end of the formatted integer
+		 */
+		static inline char* formatSigned(char* out, int64_t value)
+		{
+			if (value < 0)
+			{
+				*out++ = '-';
+				return formatUnsigned(out, -static_cast<u_int64_t>(value));
+			}
+
+			return formatUnsigned(out, value);
+		}
+
+		/**
+		 * \brief Copies the specified string at out, doubling its quotes
+		 * \return The end of the copy
+		 */
+		static inline char* formatEscaped(char* out, const char* str, size_t length)
+		{
+			const char* end = str + length;
+			const char* quote;
+
+			while ((quote = static_cast<const char*>(memchr(str, '"', end - str))) != NULL)
+			{
+				memcpy(out, str, quote + 1 - str);
+				out += quote + 1 - str;
+				*out++ = '"';
+				str = quote + 1;
+			}
+
+			memcpy(out, str, end - str);
+
+			return out + (end - str);
+		}
+
+	public:
+
+		/**
+		 * \brief Creates a writer
+		 * \param human Set to true to write the human-readable format, false to write the raw one
+		 * \param compressThreads Set to the number of compressor threads to write a gzip file, or 0 to write plain CSV.
+		 * Ignored if pstat is built without zlib (see \ref isCompressionSupported())
+		 * \param bufferSize Size of the formatting buffer, which is also the size of the writes (or of the compressed blocks)
+		 * \param links Set to true to write the LINK column, for records whose hard links are marked (see \ref HARDLINKS_MARK)
+		 */
+		CsvWriter(bool human, int compressThreads = 0, size_t bufferSize = CSV_WRITE_BUFFER_SIZE, bool links = false) : m_Buffer(bufferSize)
+		{
+			m_Fd = -1;
+			m_Length = 0;
+			m_Error = 0;
+			m_Human = human;
+			m_Links = links;
+			m_CompressThreads = compressThreads;
+		}
+
+		/**
+		 * \brief Creates (or truncates) the specified file and writes to it
+		 * \return True on success, false otherwise (errno is set)
+		 */
+		virtual bool open(const std::string& path)
+		{
+			close();
+
+			m_Fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+			m_Error = m_Fd < 0 ? errno : 0;
+			startCompressor();
+
+			return m_Fd >= 0;
+		}
+
+		/**
+		 * \brief Reopens the specified file, truncated at the specified offset, and appends to it. A compressed file
+		 * stays valid, as each compressed block is a complete gzip member.
+		 * \return True on success, false otherwise (errno is set)
+		 */
+		virtual bool reopen(const std::string& path, u_int64_t offset)
+		{
+			close();
+
+			m_Fd = ::open(path.c_str(), O_WRONLY | O_CLOEXEC);
+			m_Error = m_Fd < 0 ? errno : 0;
+
+			if (m_Fd >= 0 && (ftruncate(m_Fd, offset) != 0 || lseek(m_Fd, offset, SEEK_SET) < 0))
+			{
+				m_Error = errno;
+			}
+
+			startCompressor();
+
+			return m_Error == 0;
+		}
+
+		/**
+		 * \brief Returns true if pstat is built with zlib, so that the output can be compressed
+		 */
+		static bool isCompressionSupported()
+		{
+#ifdef HAVE_ZLIB_
+			return true;
+#else
+			return false;
+#endif
+		}
+
+		/**
+		 * \brief Returns the CSV header line of the raw or human-readable format, with or without the LINK column
+		 */
+		static const char* getHeader(bool human, bool links = false)
+		{
+			if (links)
+			{
+				return human ? "INODE,LINKS,ACCESSED,MODIFIED,USER,GROUP,PERM,SIZE,DISK,TYPE,LINK,PATH\n"
+					: "INODE,ACCESSED,MODIFIED,USER,GROUP,MODE,SIZE,DISK,LINK,PATH\n";
+			}
+
+			return human ? "INODE,LINKS,ACCESSED,MODIFIED,USER,GROUP,PERM,SIZE,DISK,TYPE,PATH\n"
+				: "INODE,ACCESSED,MODIFIED,USER,GROUP,MODE,SIZE,DISK,PATH\n";
+		}
+
+		/**
+		 * \brief Writes the CSV header line
+		 */
+		virtual void writeHeader()
+		{
+			write(getHeader(m_Human, m_Links));
+		}
+
+		/**
+		 * \brief Writes the specified string as is
+		 */
+		void write(const char* str)
+		{
+			size_t length = strlen(str);
+
+			reserve(length);
+			memcpy(&m_Buffer[m_Length], str, length);
+			m_Length += length;
+		}
+
+		/**
+		 * \brief Writes the specified string in double quotes, doubling its quotes
+		 */
+		void writeQuoted(const std::string& str)
+		{
+			reserve(str.size() * 2 + 2);
+
+			char* out = &m_Buffer[m_Length];
+			*out++ = '"';
+			out = formatEscaped(out, str.data(), str.size());
+			*out++ = '"';
+
+			m_Length = out - &m_Buffer[0];
+		}
+
+		/**
+		 * \brief Writes the specified integer
+		 */
+		void writeUnsigned(u_int64_t value)
+		{
+			reserve(20);
+			m_Length = formatUnsigned(&m_Buffer[m_Length], value) - &m_Buffer[0];
+		}
+
+		/**
+		 * \brief Writes the specified signed integer
+		 */
+		void writeSigned(int64_t value)
+		{
+			reserve(21);
+			m_Length = formatSigned(&m_Buffer[m_Length], value) - &m_Buffer[0];
+		}
+
+		/**
+		 * \brief Writes the specified stat record as a CSV line. Its path is the specified directory path followed
+		 * by its name, with a separator in between unless the directory path is empty or ends with one.
+		 * \param dir Path of the directory containing the entry (not NUL-terminated), empty if name is a full path
+		 * \param name Name of the entry (not NUL-terminated)
+		 */
+		void writeRecord(const StatRecord& rec, const char* dir, size_t dirLength, const char* name, size_t nameLength)
+		{
+			CachedUtilities& utilities = CachedUtilities::getInstance();
+			StringRef user;
+			StringRef group;
+			size_t length = CSV_MAX_FIELDS_LENGTH + (dirLength + nameLength) * 2;
+
+			if (m_Human)
+			{
+				user = utilities.uidToUsername(rec.uid);
+				group = utilities.gidToGroupname(rec.gid);
+				length += user.size() + group.size();
+			}
+
+			reserve(length);
+
+			char* out = &m_Buffer[m_Length];
+
+			out = formatUnsigned(out, rec.dev);
+			*out++ = '-';
+			out = formatUnsigned(out, rec.ino);
+			*out++ = ',';
+
+			if (m_Human)
+			{
+				out = formatUnsigned(out, rec.nlink);
+				*out++ = ',';
+				out = utilities.formatDate(out, rec.atime);
+				*out++ = ',';
+				out = utilities.formatDate(out, rec.mtime);
+				*out++ = ',';
+				memcpy(out, user.data(), user.size());
+				out += user.size();
+				*out++ = ',';
+				memcpy(out, group.data(), group.size());
+				out += group.size();
+				*out++ = ',';
+				*out++ = '0' + ((rec.mode >> 6) & 7);
+				*out++ = '0' + ((rec.mode >> 3) & 7);
+				*out++ = '0' + (rec.mode & 7);
+				*out++ = ',';
+				out = formatUnsigned(out, rec.size);
+				*out++ = ',';
+				out = formatUnsigned(out, rec.blocks * 512);
+				*out++ = ',';
+
+				StringRef type = utilities.getFileType(rec.mode);
+				memcpy(out, type.data(), type.size());
+				out += type.size();
+				*out++ = ',';
+			}
+			else
+			{
+				out = formatSigned(out, rec.atime);
+				*out++ = ',';
+				out = formatSigned(out, rec.mtime);
+				*out++ = ',';
+				out = formatUnsigned(out, rec.uid);
+				*out++ = ',';
+				out = formatUnsigned(out, rec.gid);
+				*out++ = ',';
+				out = formatUnsigned(out, rec.mode);
+				*out++ = ',';
+				out = formatUnsigned(out, rec.size);
+				*out++ = ',';
+				out = formatUnsigned(out, rec.blocks * 512);
+				*out++ = ',';
+			}
+
+			if (m_Links)
+			{
+				const char* link = (rec.flags & RECORD_DUPLICATE_LINK) != 0 ? "DUPLICATE," : "PRIMARY,";
+				size_t linkLength = strlen(link);
+
+				memcpy(out, link, linkLength);
+				out += linkLength;
+			}
+
+			*out++ = '"';
+			out = formatEscaped(out, dir, dirLength);
+
+			if (dirLength > 0 && dir[dirLength - 1] != '/')
+			{
+				*out++ = '/';
+			}
+
+			out = formatEscaped(out, name, nameLength);
+			*out++ = '"';
+			*out++ = '\n';
+
+			m_Length = out - &m_Buffer[0];
+		}
+
+		/**
+		 * \brief Writes all the records of the specified chunk
+		 */
+		virtual void writeChunk(const RecordChunk& chunk, DirectoryPathCache& paths)
+		{
+			for (size_t i = 0; i < chunk.size(); i++)
+			{
+				const StatRecord& rec = chunk[i];
+				const std::string& dir = paths.getPath(rec.parent);
+
+				writeRecord(rec, dir.data(), dir.size(), chunk.getName(rec), rec.nameLength);
+			}
+		}
+
+		/**
+		 * \brief Writes the buffered records to the file (or hands them over for compression)
+		 * \return True on success, false if this or any previous write failed
+		 */
+		bool flush()
+		{
+#ifdef HAVE_ZLIB_
+			if (m_Compressor)
+			{
+				if (m_Error == 0 && m_Length > 0)
+				{
+					m_Compressor->write(m_Buffer, m_Length);
+					m_Error = m_Compressor->getError();
+				}
+
+				m_Length = 0;
+
+				return m_Error == 0;
+			}
+#endif
+			size_t written = 0;
+
+			while (m_Error == 0 && written < m_Length)
+			{
+				ssize_t ret = ::write(m_Fd, &m_Buffer[written], m_Length - written);
+
+				if (ret < 0 && errno != EINTR)
+				{
+					m_Error = errno;
+				}
+
+				written += ret > 0 ? ret : 0;
+			}
+
+			m_Length = 0;
+
+			return m_Error == 0;
+		}
+
+		/**
+		 * \brief Writes the buffered records to the file, waits for their compression if compressing, and flushes the
+		 * file to disk
+		 * \param offset Receives the size of the file
+		 * \return True on success, false if this or any previous write failed
+		 */
+		virtual bool sync(u_int64_t& offset)
+		{
+			flush();
+#ifdef HAVE_ZLIB_
+
+			if (m_Compressor)
+			{
+				int error = m_Compressor->drain();
+				m_Error = m_Error != 0 ? m_Error : error;
+			}
+#endif
+
+			off_t end = lseek(m_Fd, 0, SEEK_CUR);
+
+			if (m_Error == 0 && (end < 0 || fsync(m_Fd) != 0))
+			{
+				m_Error = errno;
+			}
+
+			offset = end;
+
+			return m_Error == 0;
+		}
+
+		/**
+		 * \brief Returns the errno of the first failed open or write, or 0 if none failed
+		 */
+		virtual int getError() const
+		{
+			return m_Error;
+		}
+
+		/**
+		 * \brief Flushes the buffered records and closes the file, if open
+		 * \return True on success, false if any write failed
+		 */
+		virtual bool close()
+		{
+			if (m_Fd < 0)
+			{
+				return m_Error == 0;
+			}
+
+			flush();
+#ifdef HAVE_ZLIB_
+
+			if (m_Compressor)
+			{
+				int error = m_Compressor->finish();
+				m_Error = m_Error != 0 ? m_Error : error;
+				m_Compressor.reset();
+			}
+#endif
+
+			if (::close(m_Fd) != 0 && m_Error == 0)
+			{
+				m_Error = errno;
+			}
+
+			m_Fd = -1;
+
+			return m_Error == 0;
+		}
+
+		~CsvWriter()
+		{
+			close();
+		}
+	};
+}
+
+#endif	/* CSVWRITER_HPP */
@@ -0,0 +1,262 @@
+#ifndef DIRECTORYREADER_HPP
+#define	DIRECTORYREADER_HPP
+
+#include <vector>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/syscall.h>
+
+#include "Telemetry.hpp"
+
+#define DIRECTORY_READ_BUFFER_SIZE (128 * 1024) //!< Size of the buffer each walker thread uses to read directory entries in batches
+
+namespace pstat
+{
+	/**
+	 * \brief Reads the entries of an open directory in large batches using the getdents64() system call.
+	 * Each walker thread owns one reader and reuses its buffer for every directory it traverses, so reading a
+	 * directory does not allocate. Falls back to fdopendir()/readdir() where getdents64() is not available.
+	 */
+	class DirectoryReader
+	{
+#ifdef SYS_getdents64
+		/**
+		 * \brief The layout of the records returned by getdents64()
+		 */
+		struct LinuxDirent64
+		{
+			ino64_t d_ino;
+			off64_t d_off;
+			unsigned short d_reclen;
+			unsigned char d_type;
+			char d_name[];
+		};
+
+		std::vector<char> m_Buffer; //!< Holds the last batch of entries read from the kernel
+		long m_Position; //!< Offset of the next entry within \ref m_Buffer
+		long m_Length; //!< Number of valid bytes within \ref m_Buffer
+#else
+		DIR* m_Dir; //!< The directory stream wrapping the open file descriptor
+#endif
+		int m_Fd; //!< The file descriptor of the directory being read
+		bool m_OwnsFd; //!< If set to false, \ref m_Fd is not closed by \ref close()
+		int m_Error; //!< The errno of the read that failed, or 0 if reading the directory has not failed
+		LatencyHistogram* m_ReadLatency; //!< Receives the latency of each batch read from the kernel, or NULL. Not measured by the readdir() fallback
+
+	public:
+
+		/**
+		 * \brief Creates a reader with a batch buffer of the specified size
+		 */
+		DirectoryReader(size_t bufferSize = DIRECTORY_READ_BUFFER_SIZE)
+		{
+#ifdef SYS_getdents64
+			m_Buffer.resize(bufferSize);
+			m_Position = m_Length = 0;
+#else
+			(void) bufferSize;
+			m_Dir = NULL;
+#endif
+			m_Fd = -1;
+			m_OwnsFd = true;
+			m_Error = 0;
+			m_ReadLatency = NULL;
+		}
+
+		/**
+		 * \brief Sets the histogram that receives the latency of each batch of entries read from the kernel, or NULL
+		 */
+		void setReadLatency(LatencyHistogram* latency)
+		{
+			m_ReadLatency = latency;
+		}
+
+		/**
+		 * \brief Opens the specified directory for reading, closing any previously opened one
+		 * \param path Full path to the directory
+		 * \return True on success, false otherwise (errno is set by open())
+		 */
+		bool open(const char* path)
+		{
+			return open(AT_FDCWD, path);
+		}
+
+		/**
+		 * \brief Opens the directory with the specified name relative to the directory file descriptor dirfd
+		 * \return True on success, false otherwise (errno is set by openat())
+		 */
+		bool open(int dirfd, const char* name)
+		{
+			close();
+
+			m_Fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+			m_OwnsFd = true;
+
+			if (m_Fd < 0)
+			{
+				return false;
+			}
+
+#ifdef SYS_getdents64
+			m_Position = m_Length = 0;
+#else
+			if ((m_Dir = fdopendir(m_Fd)) == NULL)
+			{
+				::close(m_Fd);
+				m_Fd = -1;
+				return false;
+			}
+#endif
+			return true;
+		}
+
+		/**
+		 * \brief Reads the directory of the specified file descriptor, which was opened by the caller. The file
+		 * descriptor is not closed by the reader.
+		 * \return True on success, false otherwise
+		 */
+		bool attach(int fd)
+		{
+			close();
+
+#ifdef SYS_getdents64
+			m_Fd = fd;
+			m_OwnsFd = false;
+			m_Position = m_Length = 0;
+
+			return true;
+#else
+			// The directory stream takes ownership of its file descriptor, so give it a copy
+			return (m_Fd = dup(fd)) >= 0 && (m_Dir = fdopendir(m_Fd)) != NULL;
+#endif
+		}
+
+		/**
+		 * \brief Gets the file descriptor of the open directory, to be used with the *at() family of system calls
+		 */
+		inline int fd() const
+		{
+			return m_Fd;
+		}
+
+		/**
+		 * \brief Reads the next entry of the directory, skipping "." and "..".
+		 * \param name On success, points to the entry name. Valid until the next call to this method.
+		 * \param type On success, set to the d_type of the entry (which may be DT_UNKNOWN)
+		 * \return True if an entry is read, false at the end of the directory or on error (see \ref getError())
+		 */
+		bool next(const char*& name, unsigned char& type)
+		{
+#ifdef SYS_getdents64
+			while (true)
+			{
+				if (m_Position >= m_Length)
+				{
+					u_int64_t start = m_ReadLatency != NULL ? getMonotonicNanoseconds() : 0;
+
+					m_Length = syscall(SYS_getdents64, m_Fd, &m_Buffer[0], m_Buffer.size());
+					m_Position = 0;
+
+					if (m_ReadLatency != NULL)
+					{
+						m_ReadLatency->addSince(start);
+					}
+
+					if (m_Length <= 0)
+					{
+						m_Error = m_Length < 0 ? errno : 0;
+						return false;
+					}
+				}
+
+				LinuxDirent64* ent = reinterpret_cast<LinuxDirent64*>(&m_Buffer[m_Position]);
+				m_Position += ent->d_reclen;
+
+				if (isDotOrDotDot(ent->d_name))
+				{
+					continue;
+				}
+
+				name = ent->d_name;
+				type = ent->d_type;
+
+				return true;
+			}
+#else
+			struct dirent* ent;
+
+			// readdir() only sets errno on error
+			errno = 0;
+
+			while ((ent = readdir(m_Dir)) != NULL)
+			{
+				if (isDotOrDotDot(ent->d_name))
+				{
+					continue;
+				}
+
+				name = ent->d_name;
+				type = ent->d_type;
+
+				return true;
+			}
+
+			m_Error = errno;
+
+			return false;
+#endif
+		}
+
+		/**
+		 * \brief Returns the errno of the read that made \ref next() return false before the end of the directory, or 0
+		 * if it reached the end
+		 */
+		inline int getError() const
+		{
+			return m_Error;
+		}
+
+		/**
+		 * \brief Closes the open directory, if any
+		 */
+		void close()
+		{
+#ifdef SYS_getdents64
+			if (m_Fd >= 0 && m_OwnsFd)
+			{
+				::close(m_Fd);
+			}
+#else
+			if (m_Dir != NULL)
+			{
+				closedir(m_Dir); // Also closes m_Fd
+				m_Dir = NULL;
+			}
+			else if (m_Fd >= 0)
+			{
+				::close(m_Fd);
+			}
+#endif
+			m_Fd = -1;
+			m_Error = 0;
+		}
+
+		/**
+		 * \brief Returns true if the specified name is "." or ".."
+		 */
+		static inline bool isDotOrDotDot(const char* name)
+		{
+			return name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+		}
+
+		~DirectoryReader()
+		{
+			close();
+		}
+	};
+}
+
+#endif	/* DIRECTORYREADER_HPP */
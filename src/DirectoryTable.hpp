@@ -0,0 +1,295 @@
+#ifndef DIRECTORYTABLE_HPP
+#define	DIRECTORYTABLE_HPP
+
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <cstring>
+#include <sys/types.h>
+
+#define STRING_ARENA_BLOCK_SIZE (1024 * 1024) //!< Size of each block allocated by a \ref pstat::StringArena
+#define DIRECTORY_TABLE_SEGMENT_BITS 16 //!< log2 of the number of entries in each segment of a \ref pstat::DirectoryTable
+#define NO_PARENT_DIRECTORY 0xFFFFFFFFu //!< Parent id of the root directory (and of any record that carries its full path as its name)
+#define NO_BASELINE_DIRECTORY 0xFFFFFFFFu //!< Id of the directories missing from a \ref pstat::BaselineIndex
+
+namespace pstat
+{
+	/**
+	 * \brief An append-only store of strings, allocated in large blocks that are only freed with the arena.
+	 * Not thread-safe: each thread appends to its own arena.
+	 */
+	class StringArena
+	{
+		std::vector<std::unique_ptr<char[]>> m_Blocks; //!< All the allocated blocks
+		char* m_Current; //!< Free space within the last block
+		size_t m_Left; //!< Number of free bytes at \ref m_Current
+		std::atomic<size_t> m_Allocated; //!< Total number of bytes allocated. Atomic, as other threads may read it for reporting
+
+	public:
+
+		StringArena()
+		{
+			m_Current = NULL;
+			m_Left = 0;
+			m_Allocated = 0;
+		}
+
+		/**
+		 * \brief Copies the specified string into the arena
+		 * \return The address of the copy, valid for the lifetime of the arena. The copy is not NUL-terminated.
+		 */
+		const char* copy(const char* str, size_t length)
+		{
+			if (length > m_Left)
+			{
+				size_t size = std::max<size_t>(length, STRING_ARENA_BLOCK_SIZE);
+
+				m_Blocks.push_back(std::unique_ptr<char[]>(new char[size]));
+				m_Current = m_Blocks.back().get();
+				m_Left = size;
+				m_Allocated += size;
+			}
+
+			char* ret = m_Current;
+			memcpy(ret, str, length);
+			m_Current += length;
+			m_Left -= length;
+
+			return ret;
+		}
+
+		/**
+		 * \brief Returns the total number of bytes allocated by the arena
+		 */
+		size_t getAllocatedBytes() const
+		{
+			return m_Allocated;
+		}
+	};
+
+	/**
+	 * \brief Assigns an id to every traversed directory and remembers its parent id and name, so that stat records
+	 * only carry the id of their parent directory plus their own name, and full paths are rebuilt when needed.
+	 * Ids are allocated concurrently; the entries are stored in lazily-allocated fixed-size segments, so they never move
+	 * and can be read without locks. Each thread stores the names it adds in its own \ref StringArena.
+	 */
+	class DirectoryTable
+	{
+	public:
+		/**
+		 * \brief A directory: its parent and its name within the parent (or its full path, for the root)
+		 */
+		struct Entry
+		{
+			u_int32_t parent; //!< Id of the parent directory, or \ref NO_PARENT_DIRECTORY
+			u_int32_t nameLength; //!< Length of name
+			const char* name; //!< The name, not NUL-terminated
+			const u_int32_t* exclusionState; //!< State of the \ref ExclusionFilter within the directory, or NULL
+			u_int32_t baseline; //!< Id of the directory in the \ref BaselineIndex, or \ref NO_BASELINE_DIRECTORY
+			bool unchanged; //!< Set if the entries of the directory are the same as in the \ref BaselineIndex
+		};
+
+	private:
+		static const size_t SEGMENT_SIZE = 1 << DIRECTORY_TABLE_SEGMENT_BITS; //!< Number of entries in a segment
+		static const size_t SEGMENT_COUNT = (1ull << 32) / SEGMENT_SIZE; //!< Maximum number of segments
+
+		std::unique_ptr<std::atomic<Entry*>[]> m_Segments; //!< The segments, allocated on first use
+		std::atomic<u_int32_t> m_Count; //!< Number of allocated ids
+		std::vector<std::unique_ptr<StringArena>> m_Arenas; //!< One name arena per thread
+
+		DirectoryTable(const DirectoryTable&);
+		DirectoryTable& operator=(const DirectoryTable&);
+
+	public:
+
+		/**
+		 * \brief Creates a table whose entries are added by the specified number of threads, identified by 0..threads-1
+		 */
+		DirectoryTable(int threads) : m_Segments(new std::atomic<Entry*>[SEGMENT_COUNT])
+		{
+			for (size_t i = 0; i < SEGMENT_COUNT; i++)
+			{
+				m_Segments[i] = NULL;
+			}
+
+			for (int i = 0; i < threads; i++)
+			{
+				m_Arenas.push_back(std::unique_ptr<StringArena>(new StringArena()));
+			}
+
+			m_Count = 0;
+		}
+
+		/**
+		 * \brief Adds a directory
+		 * \param thread The calling thread, whose arena stores the name
+		 * \param parent Id of the parent directory, or \ref NO_PARENT_DIRECTORY if name is a full path
+		 * \param exclusionState State of the \ref ExclusionFilter within the directory, or NULL
+		 * \param baseline Id of the directory in the \ref BaselineIndex, or \ref NO_BASELINE_DIRECTORY
+		 * \param unchanged Set if the entries of the directory are the same as in the \ref BaselineIndex
+		 * \return The id of the added directory
+		 */
+		u_int32_t add(int thread, u_int32_t parent, const char* name, size_t nameLength, const u_int32_t* exclusionState = NULL,
+				u_int32_t baseline = NO_BASELINE_DIRECTORY, bool unchanged = false)
+		{
+			u_int32_t id = m_Count++;
+			std::atomic<Entry*>& segment = m_Segments[id >> DIRECTORY_TABLE_SEGMENT_BITS];
+			Entry* entries = segment.load(std::memory_order_acquire);
+
+			if (entries == NULL)
+			{
+				Entry* allocated = new Entry[SEGMENT_SIZE];
+
+				if (segment.compare_exchange_strong(entries, allocated, std::memory_order_acq_rel))
+				{
+					entries = allocated;
+				}
+				else
+				{
+					delete[] allocated; // Another thread won, entries now holds its segment
+				}
+			}
+
+			Entry& e = entries[id & (SEGMENT_SIZE - 1)];
+			e.parent = parent;
+			e.nameLength = nameLength;
+			e.name = m_Arenas[thread]->copy(name, nameLength);
+			e.exclusionState = exclusionState;
+			e.baseline = baseline;
+			e.unchanged = unchanged;
+
+			return id;
+		}
+
+		/**
+		 * \brief Returns the directory with the specified id. The caller must have learnt the id from the thread that
+		 * added it through some synchronization (e.g. a queue), which makes the entry visible.
+		 */
+		inline const Entry& get(u_int32_t id) const
+		{
+			return m_Segments[id >> DIRECTORY_TABLE_SEGMENT_BITS].load(std::memory_order_acquire)[id & (SEGMENT_SIZE - 1)];
+		}
+
+		/**
+		 * \brief Stores the full path of the directory with the specified id in path
+		 */
+		void getPath(u_int32_t id, std::string& path) const
+		{
+			path.clear();
+			appendPath(id, path);
+		}
+
+		/**
+		 * \brief Appends the full path of the directory with the specified id to path
+		 */
+		void appendPath(u_int32_t id, std::string& path) const
+		{
+			const Entry& e = get(id);
+
+			if (e.parent != NO_PARENT_DIRECTORY)
+			{
+				appendPath(e.parent, path);
+				appendName(path, e.name, e.nameLength);
+			}
+			else
+			{
+				path.append(e.name, e.nameLength);
+			}
+		}
+
+		/**
+		 * \brief Appends the specified entry name to the specified directory path, adding a separator if needed
+		 */
+		static inline void appendName(std::string& path, const char* name, size_t nameLength)
+		{
+			if (path.empty() || *path.rbegin() != '/') // *path.rbegin() is equivalent to path.back() of c++11
+			{
+				path.push_back('/');
+			}
+
+			path.append(name, nameLength);
+		}
+
+		/**
+		 * \brief Returns the number of directories in the table
+		 */
+		size_t size() const
+		{
+			return m_Count;
+		}
+
+		/**
+		 * \brief Returns the approximate number of bytes used by the table
+		 */
+		size_t getAllocatedBytes() const
+		{
+			size_t bytes = SEGMENT_COUNT * sizeof(std::atomic<Entry*>);
+
+			for (size_t i = 0; i < SEGMENT_COUNT; i++)
+			{
+				bytes += m_Segments[i] != NULL ? SEGMENT_SIZE * sizeof(Entry) : 0;
+			}
+
+			for (const std::unique_ptr<StringArena>& arena : m_Arenas)
+			{
+				bytes += arena->getAllocatedBytes();
+			}
+
+			return bytes;
+		}
+
+		~DirectoryTable()
+		{
+			for (size_t i = 0; i < SEGMENT_COUNT; i++)
+			{
+				delete[] m_Segments[i].load();
+			}
+		}
+	};
+
+	/**
+	 * \brief Remembers the path of the last directory looked up in a \ref DirectoryTable. Records of the same directory
+	 * mostly come in a row, so consumers only rebuild a directory path when it changes.
+	 * Not thread-safe: each thread uses its own cache.
+	 */
+	class DirectoryPathCache
+	{
+		const DirectoryTable& m_Directories; //!< The table paths are looked up in
+		u_int32_t m_Directory; //!< Id of the directory whose path is cached
+		std::string m_Path; //!< The cached path
+
+	public:
+
+		DirectoryPathCache(const DirectoryTable& directories) : m_Directories(directories)
+		{
+			m_Directory = NO_PARENT_DIRECTORY;
+		}
+
+		/**
+		 * \brief Returns the full path of the directory with the specified id, or an empty string for \ref NO_PARENT_DIRECTORY.
+		 * The returned reference is valid until the next call.
+		 */
+		inline const std::string& getPath(u_int32_t id)
+		{
+			if (id != m_Directory)
+			{
+				if (id != NO_PARENT_DIRECTORY)
+				{
+					m_Directories.getPath(id, m_Path);
+				}
+				else
+				{
+					m_Path.clear();
+				}
+
+				m_Directory = id;
+			}
+
+			return m_Path;
+		}
+	};
+}
+
+#endif	/* DIRECTORYTABLE_HPP */
@@ -0,0 +1,536 @@
+#ifndef EXCLUSIONFILTER_HPP
+#define	EXCLUSIONFILTER_HPP
+
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <set>
+#include <map>
+#include <tuple>
+#include <memory>
+#include <cstring>
+#include <fnmatch.h>
+#include <sys/types.h>
+
+#include "DirectoryTable.hpp"
+
+#define EXCLUSION_NO_NODE 0xFFFFFFFFu //!< Marks a missing node of a \ref pstat::ExclusionFilter
+
+namespace pstat
+{
+	/**
+	 * \brief Decides which entries of the walked tree are excluded, given a list of patterns. Patterns are matched
+	 * against full paths, one component at a time:
+	 * - A pattern starting with '/' is anchored at the filesystem root (e.g. /scratch/tmp). Any other pattern may start
+	 *   at any depth (e.g. .snapshot, or build/obj)
+	 * - Within a component, '*', '?' and [...] are wildcards, as in fnmatch() (e.g. *.o, or core.[0-9]*). They never
+	 *   match a '/'
+	 * - A "**" component matches any number of components, including none
+	 *
+	 * An excluded directory is not traversed, so its whole subtree is excluded.
+	 *
+	 * The patterns are compiled at construction into a trie of components. Literal components are edges looked up in a
+	 * hash table, and so are wildcard components, by their literal prefix (as in "abc*", or "core.[0-9]*", which is then
+	 * checked with fnmatch()) or suffix (as in "*.o"). Only the wildcard components starting with a wildcard otherwise
+	 * are edges matched in turn. Each directory carries the set of trie nodes its
+	 * path leads to (its state, as in an NFA), so matching an entry only takes its own name, and costs the same at any
+	 * depth. States are shared between a directory and its subdirectories whenever they are equal, and a NULL state
+	 * means that nothing below can be excluded, which skips the matching altogether.
+	 * Immutable once constructed, except for the per-thread storage of the states, hence thread-safe.
+	 */
+	class ExclusionFilter
+	{
+	public:
+		/**
+		 * \brief The state of the filter within a directory: the number of trie nodes, followed by the sorted ids of the
+		 * nodes. NULL if no pattern can match within the directory.
+		 */
+		typedef const u_int32_t* State;
+
+	private:
+		/**
+		 * \brief How an edge of the hash table is matched
+		 */
+		enum EdgeKind
+		{
+			EDGE_LITERAL, //!< "abc": matches the name itself
+			EDGE_PREFIX, //!< "abc*", or "abc?*", ...: matches the names starting with the text (and matching the component)
+			EDGE_SUFFIX //!< "*abc": matches the names ending with the text
+		};
+
+		/**
+		 * \brief A wildcard edge of the trie that is not in the hash table
+		 */
+		struct Glob
+		{
+			std::string pattern; //!< The component, as written in the pattern
+			bool any; //!< Set if the component is "*", which matches any name without fnmatch()
+			u_int32_t child; //!< The node the edge leads to
+		};
+
+		/**
+		 * \brief An edge of the trie, as stored in the hash table
+		 */
+		struct Literal
+		{
+			u_int64_t hash; //!< Hash of the parent node, the kind and the text
+			u_int32_t parent; //!< The node the edge leaves, or \ref EXCLUSION_NO_NODE for an empty slot
+			u_int32_t child; //!< The node the edge leads to
+			EdgeKind kind; //!< How the edge is matched
+			const char* text; //!< The text, not NUL-terminated
+			size_t textLength; //!< Length of text
+			const char* pattern; //!< The component, to be matched with fnmatch() once the text matches, or NULL if the text suffices
+		};
+
+		/**
+		 * \brief The edges of the hash table while the trie is built, by parent node, kind and component
+		 */
+		typedef std::map<std::tuple<u_int32_t, EdgeKind, std::string>, u_int32_t> EdgeMap;
+
+		/**
+		 * \brief A node of the trie
+		 */
+		struct Node
+		{
+			bool excluded; //!< Set if a pattern ends at the node
+			bool anyDepth; //!< Set if the node is reached by a "**" component, which loops on itself
+			bool hasLiterals; //!< Set if any \ref EDGE_LITERAL edge leaves the node
+			u_int32_t anyDepthChild; //!< The node reached by a "**" component, or \ref EXCLUSION_NO_NODE
+			std::vector<u_int32_t> prefixLengths; //!< The sorted distinct text lengths of the \ref EDGE_PREFIX edges leaving the node
+			std::vector<u_int32_t> suffixLengths; //!< The sorted distinct text lengths of the \ref EDGE_SUFFIX edges leaving the node
+			std::vector<Glob> globs; //!< The other wildcard edges leaving the node
+		};
+
+		std::vector<Node> m_Nodes; //!< The trie. Node 0 is the filesystem root
+		std::vector<Literal> m_Literals; //!< Hash table of the literal, prefix and suffix edges
+		size_t m_LiteralMask; //!< Number of slots in \ref m_Literals minus one
+		StringArena m_Names; //!< Texts of the edges of \ref m_Literals
+		std::vector<std::unique_ptr<StringArena>> m_States; //!< One arena of states per thread
+
+		ExclusionFilter(const ExclusionFilter&);
+		ExclusionFilter& operator=(const ExclusionFilter&);
+
+		/**
+		 * \brief Returns the hash of the specified name (FNV-1a)
+		 * \param hash The hash of the preceding characters, to hash a name incrementally
+		 */
+		static inline u_int64_t hashName(const char* name, size_t nameLength, u_int64_t hash = 14695981039346656037ull)
+		{
+			for (size_t i = 0; i < nameLength; i++)
+			{
+				hash = (hash ^ static_cast<unsigned char>(name[i])) * 1099511628211ull;
+			}
+
+			return hash;
+		}
+
+		/**
+		 * \brief Returns the hash of the edge of the specified kind and text leaving the specified node
+		 */
+		static inline u_int64_t hashEdge(u_int32_t parent, EdgeKind kind, u_int64_t textHash)
+		{
+			return (textHash ^ (parent * 4ull + kind)) * 0x9E3779B97F4A7C15ull;
+		}
+
+		/**
+		 * \brief Adds the nodes reached from the specified node by the edges of the specified kind and text that match
+		 * the specified name (NUL-terminated) to the specified set
+		 * \return True if any of the added nodes ends a pattern
+		 */
+		inline bool matchEdges(u_int32_t parent, EdgeKind kind, u_int64_t textHash, const char* text, size_t textLength,
+				const char* name, std::vector<u_int32_t>& next) const
+		{
+			u_int64_t hash = hashEdge(parent, kind, textHash);
+			bool excluded = false;
+
+			for (size_t i = (hash >> 32) & m_LiteralMask; m_Literals[i].parent != EXCLUSION_NO_NODE; i = (i + 1) & m_LiteralMask)
+			{
+				const Literal& literal = m_Literals[i];
+
+				if (literal.hash == hash && literal.parent == parent && literal.kind == kind && literal.textLength == textLength
+						&& memcmp(literal.text, text, textLength) == 0
+						&& (literal.pattern == NULL || fnmatch(literal.pattern, name, 0) == 0))
+				{
+					excluded |= addClosure(literal.child, next);
+				}
+			}
+
+			return excluded;
+		}
+
+		/**
+		 * \brief Returns the text of the hash table edge of the specified kind and component
+		 */
+		static std::string getEdgeText(EdgeKind kind, const std::string& component)
+		{
+			switch (kind)
+			{
+				case EDGE_PREFIX:
+					return component.substr(0, component.find_first_of("*?[\\"));
+				case EDGE_SUFFIX:
+					return component.substr(1);
+				default:
+					return component;
+			}
+		}
+
+		/**
+		 * \brief Returns the node reached from the specified node by the edge of the specified kind and component,
+		 * adding it if missing
+		 * \param edges Receives the edges, until they are laid out in \ref m_Literals
+		 */
+		u_int32_t addEdge(u_int32_t parent, EdgeKind kind, const std::string& component, EdgeMap& edges)
+		{
+			std::tuple<u_int32_t, EdgeKind, std::string> key(parent, kind, component);
+			EdgeMap::const_iterator it = edges.find(key);
+
+			if (it != edges.end())
+			{
+				return it->second;
+			}
+
+			u_int32_t child = edges[key] = addNode();
+			Node& node = m_Nodes[parent];
+			std::vector<u_int32_t>& lengths = kind == EDGE_PREFIX ? node.prefixLengths : node.suffixLengths;
+			u_int32_t length = getEdgeText(kind, component).size();
+
+			if (kind == EDGE_LITERAL)
+			{
+				node.hasLiterals = true;
+			}
+			else if (std::find(lengths.begin(), lengths.end(), length) == lengths.end())
+			{
+				lengths.insert(std::upper_bound(lengths.begin(), lengths.end(), length), length);
+			}
+
+			return child;
+		}
+
+		/**
+		 * \brief Returns true if the specified component has wildcards
+		 */
+		static bool isGlob(const std::string& component)
+		{
+			return component.find_first_of("*?[\\") != std::string::npos;
+		}
+
+		/**
+		 * \brief Adds the specified node to the specified set, followed by the nodes reached from it by "**" components
+		 * (which match no component as well)
+		 * \return True if any of the added nodes ends a pattern
+		 */
+		inline bool addClosure(u_int32_t node, std::vector<u_int32_t>& nodes) const
+		{
+			bool excluded = false;
+
+			for (; node != EXCLUSION_NO_NODE; node = m_Nodes[node].anyDepthChild)
+			{
+				if (std::find(nodes.begin(), nodes.end(), node) == nodes.end())
+				{
+					nodes.push_back(node);
+				}
+
+				excluded |= m_Nodes[node].excluded;
+			}
+
+			return excluded;
+		}
+
+		/**
+		 * \brief Returns a new node
+		 */
+		u_int32_t addNode()
+		{
+			m_Nodes.push_back(Node());
+			m_Nodes.back().excluded = false;
+			m_Nodes.back().anyDepth = false;
+			m_Nodes.back().hasLiterals = false;
+			m_Nodes.back().anyDepthChild = EXCLUSION_NO_NODE;
+
+			return m_Nodes.size() - 1;
+		}
+
+		/**
+		 * \brief Adds the specified pattern to the trie
+		 * \param edges Receives the edges of the hash table
+		 */
+		void addPattern(const std::string& pattern, EdgeMap& edges)
+		{
+			std::vector<std::string> components;
+			std::string::size_type start = 0;
+
+			// Patterns that are not anchored may start at any depth
+			if (pattern.empty() || pattern[0] != '/')
+			{
+				components.push_back("**");
+			}
+
+			while (start <= pattern.size())
+			{
+				std::string::size_type end = std::min(pattern.find('/', start), pattern.size());
+				std::string component = pattern.substr(start, end - start);
+
+				if (!component.empty() && !(component == "**" && !components.empty() && components.back() == "**"))
+				{
+					components.push_back(component);
+				}
+
+				start = end + 1;
+			}
+
+			u_int32_t node = 0;
+
+			for (const std::string& component : components)
+			{
+				u_int32_t child = EXCLUSION_NO_NODE;
+
+				if (component == "**")
+				{
+					if ((child = m_Nodes[node].anyDepthChild) == EXCLUSION_NO_NODE)
+					{
+						child = addNode();
+						m_Nodes[child].anyDepth = true;
+						m_Nodes[node].anyDepthChild = child;
+					}
+				}
+				else if (!isGlob(component))
+				{
+					child = addEdge(node, EDGE_LITERAL, component, edges);
+				}
+				else if (component != "*" && component[0] == '*' && !isGlob(component.substr(1)))
+				{
+					child = addEdge(node, EDGE_SUFFIX, component, edges);
+				}
+				else if (!isGlob(component.substr(0, 1)))
+				{
+					child = addEdge(node, EDGE_PREFIX, component, edges);
+				}
+				else
+				{
+					for (const Glob& glob : m_Nodes[node].globs)
+					{
+						child = glob.pattern == component ? glob.child : child;
+					}
+
+					if (child == EXCLUSION_NO_NODE)
+					{
+						Glob glob;
+
+						glob.pattern = component;
+						glob.any = component == "*";
+						glob.child = child = addNode();
+						m_Nodes[node].globs.push_back(glob);
+					}
+				}
+
+				node = child;
+			}
+
+			m_Nodes[node].excluded = true;
+		}
+
+	public:
+
+		/**
+		 * \brief Compiles the specified patterns
+		 * \param threads Number of threads storing states, identified by 0..threads-1
+		 */
+		ExclusionFilter(const std::set<std::string>& patterns, int threads)
+		{
+			EdgeMap edges;
+
+			addNode();
+
+			for (const std::string& pattern : patterns)
+			{
+				addPattern(pattern, edges);
+			}
+
+			// Lay the edges out in a hash table at most half full
+			size_t slots = 16;
+
+			while (slots < edges.size() * 2)
+			{
+				slots *= 2;
+			}
+
+			Literal empty = {0, EXCLUSION_NO_NODE, EXCLUSION_NO_NODE, EDGE_LITERAL, NULL, 0, NULL};
+			m_Literals.assign(slots, empty);
+			m_LiteralMask = slots - 1;
+
+			for (const EdgeMap::value_type& edge : edges)
+			{
+				u_int32_t parent = std::get<0>(edge.first);
+				EdgeKind kind = std::get<1>(edge.first);
+				const std::string& component = std::get<2>(edge.first);
+				std::string text = getEdgeText(kind, component);
+				bool exactPrefix = kind == EDGE_PREFIX && component.size() == text.size() + 1 && *component.rbegin() == '*';
+				Literal literal = {hashEdge(parent, kind, hashName(text.data(), text.size())), parent, edge.second, kind,
+						m_Names.copy(text.data(), text.size()), text.size(),
+						kind != EDGE_PREFIX || exactPrefix ? NULL : m_Names.copy(component.c_str(), component.size() + 1)};
+				size_t i = (literal.hash >> 32) & m_LiteralMask;
+
+				while (m_Literals[i].parent != EXCLUSION_NO_NODE)
+				{
+					i = (i + 1) & m_LiteralMask;
+				}
+
+				m_Literals[i] = literal;
+			}
+
+			for (int i = 0; i < threads; i++)
+			{
+				m_States.push_back(std::unique_ptr<StringArena>(new StringArena()));
+			}
+		}
+
+		/**
+		 * \brief Returns true if there are no patterns
+		 */
+		bool isEmpty() const
+		{
+			return m_Nodes.size() == 1;
+		}
+
+		/**
+		 * \brief Matches the entry with the specified name within a directory in the specified state
+		 * \param name The name of the entry (NUL-terminated)
+		 * \param next Receives the nodes of the state within the entry, should it be a directory (see \ref store())
+		 * \return True if the entry is excluded, false otherwise
+		 */
+		inline bool match(State state, const char* name, size_t nameLength, std::vector<u_int32_t>& next) const
+		{
+			bool excluded = false;
+			bool hashed = false;
+			u_int64_t nameHash = 0;
+
+			next.clear();
+
+			for (u_int32_t i = 1; i <= state[0]; i++)
+			{
+				u_int32_t id = state[i];
+				const Node& node = m_Nodes[id];
+
+				if (node.anyDepth)
+				{
+					excluded |= addClosure(id, next);
+				}
+
+				if (node.hasLiterals)
+				{
+					if (!hashed)
+					{
+						nameHash = hashName(name, nameLength);
+						hashed = true;
+					}
+
+					excluded |= matchEdges(id, EDGE_LITERAL, nameHash, name, nameLength, name, next);
+				}
+
+				// FNV-1a is incremental, so the prefixes of every length are hashed in a single pass over the name
+				u_int64_t prefixHash = hashName(name, 0);
+				size_t hashedLength = 0;
+
+				for (u_int32_t length : node.prefixLengths)
+				{
+					if (length > nameLength)
+					{
+						break;
+					}
+
+					prefixHash = hashName(name + hashedLength, length - hashedLength, prefixHash);
+					hashedLength = length;
+					excluded |= matchEdges(id, EDGE_PREFIX, prefixHash, name, length, name, next);
+				}
+
+				for (u_int32_t length : node.suffixLengths)
+				{
+					if (length > nameLength)
+					{
+						break;
+					}
+
+					const char* suffix = name + nameLength - length;
+					excluded |= matchEdges(id, EDGE_SUFFIX, hashName(suffix, length), suffix, length, name, next);
+				}
+
+				for (const Glob& glob : node.globs)
+				{
+					if (glob.any || fnmatch(glob.pattern.c_str(), name, 0) == 0)
+					{
+						excluded |= addClosure(glob.child, next);
+					}
+				}
+			}
+
+			return excluded;
+		}
+
+		/**
+		 * \brief Stores the specified nodes (as computed by \ref match()) as the state of a subdirectory of a directory in
+		 * the specified state
+		 * \param thread The calling thread, whose arena stores the state
+		 * \return The state, which is the parent state itself if the nodes are the same, and NULL if there are none
+		 */
+		State store(int thread, State parent, std::vector<u_int32_t>& nodes)
+		{
+			if (nodes.empty())
+			{
+				return NULL;
+			}
+
+			std::sort(nodes.begin(), nodes.end());
+
+			if (parent != NULL && parent[0] == nodes.size() && std::equal(nodes.begin(), nodes.end(), parent + 1))
+			{
+				return parent;
+			}
+
+			// Only whole u_int32_t arrays go to the arena, so the copies stay aligned
+			nodes.insert(nodes.begin(), nodes.size());
+			State state = reinterpret_cast<State>(m_States[thread]->copy(reinterpret_cast<const char*>(&nodes[0]),
+					nodes.size() * sizeof(u_int32_t)));
+			nodes.erase(nodes.begin());
+
+			return state;
+		}
+
+		/**
+		 * \brief Returns the state within the specified directory, given as an absolute path. The exclusion of the
+		 * directory itself, or of its parents, is not checked.
+		 * \param thread The calling thread, whose arena stores the state
+		 */
+		State getState(int thread, const std::string& path)
+		{
+			std::vector<u_int32_t> nodes;
+			std::string::size_type start = 0;
+
+			if (isEmpty())
+			{
+				return NULL;
+			}
+
+			addClosure(0, nodes);
+			State state = store(thread, NULL, nodes);
+
+			while (state != NULL && start < path.size())
+			{
+				std::string::size_type end = std::min(path.find('/', start), path.size());
+
+				if (end > start)
+				{
+					std::string component = path.substr(start, end - start);
+
+					match(state, component.c_str(), component.size(), nodes);
+					state = store(thread, state, nodes);
+				}
+
+				start = end + 1;
+			}
+
+			return state;
+		}
+	};
+}
+
+#endif	/* EXCLUSIONFILTER_HPP */
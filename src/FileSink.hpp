@@ -0,0 +1,264 @@
+#ifndef FILESINK_HPP
+#define	FILESINK_HPP
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+
+#include "CsvWriter.hpp"
+#include "ColumnarWriter.hpp"
+#include "Checkpoint.hpp"
+#include "StatBackend.hpp"
+
+namespace pstat
+{
+	/**
+	 * \brief The record sink of the pstat command: writes the records a \ref Walker collects to one file, or to several
+	 * shards listed by a manifest, in one of the \ref OutputFormat formats. Each shard has its own \ref RecordWriter,
+	 * fed by its own flush thread of the walker.
+	 * With \ref OUTPUT_FORMAT_AGGREGATE, the sink has no shards: the walker aggregates the records instead (see
+	 * \ref Walker::writeSummary()).
+	 */
+	class FileSink
+	{
+		std::string m_OutputPath; //!< Path to the output file, or to the manifest of the shards
+		bool m_Human; //!< Set to true to write human-readable output
+		OutputFormat m_Format; //!< The format of the output
+		int m_CompressThreads; //!< Number of compressor threads of each output shard, or 0 if the output is not compressed
+		CollectionOptions m_Options; //!< The options of the collection
+		std::vector<std::unique_ptr<RecordWriter>> m_Outputs; //!< One writer per output shard
+		std::vector<u_int64_t> m_ShardRecords; //!< Number of records written to each shard, each counted by the shard's flush thread
+		bool m_Opened; //!< Set if all the output files were opened (or reopened)
+
+		FileSink(const FileSink&);
+		FileSink& operator=(const FileSink&);
+
+		/**
+		 * \brief Writes the manifest of the output shards to \ref m_OutputPath: a CSV file listing the name of each shard
+		 * (relative to the manifest) and the number of records it holds
+		 * \return True on success, false otherwise
+		 */
+		bool writeManifest()
+		{
+			CsvWriter manifest(false, m_CompressThreads > 0 ? 1 : 0);
+
+			if (!manifest.open(m_OutputPath))
+			{
+				std::cerr << "-- Error opening the output file: " << m_OutputPath << ": " << strerror(manifest.getError()) << "\n";
+				return false;
+			}
+
+			std::string::size_type slash = m_OutputPath.rfind('/');
+			std::string name = m_OutputPath.substr(slash == std::string::npos ? 0 : slash + 1);
+
+			manifest.write("SHARD,RECORDS\n");
+
+			for (size_t i = 0; i < m_Outputs.size(); i++)
+			{
+				manifest.writeQuoted(getShardPath(name, i));
+				manifest.write(",");
+				manifest.writeUnsigned(m_ShardRecords[i]);
+				manifest.write("\n");
+			}
+
+			if (!manifest.close())
+			{
+				std::cerr << "-- Error writing the output file: " << strerror(manifest.getError()) << "\n";
+				return false;
+			}
+
+			return true;
+		}
+
+	public:
+
+		/**
+		 * \brief Creates (or truncates) the output files, and writes their headers. Errors are reported to stderr, and
+		 * leave the sink unusable (see \ref isOpen()).
+		 * \param outputPath Path to the output file
+		 * \param human Set to true to get human-readable output (or false for raw). Only applies to \ref OUTPUT_FORMAT_CSV
+		 * \param shards The number of output shards. With more than one, the records go to the files returned by
+		 * \ref getShardPath(), and outputPath lists them and their record counts
+		 * \param format The format of the output file(s)
+		 * \param compressThreads Set to the number of compressor threads of each output shard to write gzip files, or 0
+		 * to write plain ones. Only applies to \ref OUTPUT_FORMAT_CSV
+		 * \param resume A checkpoint of an interrupted collection with the same parameters, whose outputs are reopened
+		 * where it left them. May be NULL
+		 * \param options The options of the collection, recorded in the header of columnar snapshots
+		 */
+		FileSink(const std::string& outputPath, bool human = false, int shards = 1, OutputFormat format = OUTPUT_FORMAT_CSV,
+				int compressThreads = 0, const Checkpoint* resume = NULL, const CollectionOptions& options = CollectionOptions())
+				: m_OutputPath(outputPath), m_Human(human), m_Format(format), m_CompressThreads(compressThreads),
+				m_Options(options), m_Opened(true)
+		{
+			if (format == OUTPUT_FORMAT_AGGREGATE)
+			{
+				shards = 0;
+			}
+
+			m_ShardRecords.assign(shards, 0);
+
+			for (int i = 0; i < shards; i++)
+			{
+				std::string shardPath = shards > 1 ? getShardPath(outputPath, i) : outputPath;
+
+				m_Outputs.push_back(std::unique_ptr<RecordWriter>(format == OUTPUT_FORMAT_COLUMNAR
+						? static_cast<RecordWriter*>(new ColumnarWriter(options))
+						: new CsvWriter(human, compressThreads, CSV_WRITE_BUFFER_SIZE, options.hardlinks == HARDLINKS_MARK)));
+
+				if (resume != NULL)
+				{
+					if (!m_Outputs[i]->reopen(shardPath, resume->shards[i].offset))
+					{
+						std::cerr << "-- Error reopening the output file: " << shardPath << ": " << strerror(m_Outputs[i]->getError()) << "\n";
+						m_Opened = false;
+					}
+
+					m_ShardRecords[i] = resume->shards[i].records;
+					continue;
+				}
+
+				if (!m_Outputs[i]->open(shardPath))
+				{
+					std::cerr << "-- Error opening the output file: " << shardPath << ": " << strerror(m_Outputs[i]->getError()) << "\n";
+					m_Opened = false;
+					continue;
+				}
+
+				m_Outputs[i]->writeHeader();
+			}
+		}
+
+		/**
+		 * \brief Returns true if all the output files were opened, false otherwise, in which case no records must be
+		 * handed to the sink
+		 */
+		bool isOpen() const
+		{
+			return m_Opened;
+		}
+
+		/**
+		 * \brief Returns the number of output shards, each fed by its own flush thread
+		 */
+		int getShardsCount() const
+		{
+			return m_Outputs.size();
+		}
+
+		/**
+		 * \brief Returns the \ref StatField flags of the fields written to the output
+		 */
+		unsigned int getStatFields() const
+		{
+			return getOutputStatFields(m_Human, m_Format);
+		}
+
+		/**
+		 * \brief Writes all the records of the specified chunk to the specified shard. Called by the shard's flush thread only.
+		 * \param paths Resolves the parent directories of the records to their paths
+		 */
+		inline void consume(int shard, const RecordChunk& chunk, DirectoryPathCache& paths)
+		{
+			m_Outputs[shard]->writeChunk(chunk, paths);
+			m_ShardRecords[shard] += chunk.size();
+		}
+
+		/**
+		 * \brief Flushes the records written so far to disk, and stores where each shard can be reopened, along with the
+		 * output and collection options, in the specified checkpoint. Must not be called while the flush threads write. Errors are
+		 * reported to stderr.
+		 * \return True on success, false otherwise
+		 */
+		bool sync(Checkpoint& state)
+		{
+			bool synced = true;
+
+			for (size_t i = 0; i < m_Outputs.size(); i++)
+			{
+				Checkpoint::Shard shard = {0, m_ShardRecords[i]};
+
+				if (!m_Outputs[i]->sync(shard.offset))
+				{
+					std::cerr << "-- Error writing the output file: " << strerror(m_Outputs[i]->getError()) << "\n";
+					synced = false;
+				}
+
+				state.shards.push_back(shard);
+			}
+
+			state.outputPath = m_OutputPath;
+			state.format = m_Format;
+			state.human = m_Human;
+			state.compressed = m_CompressThreads > 0;
+			state.options = m_Options;
+
+			return synced;
+		}
+
+		/**
+		 * \brief Flushes and closes the output files, and writes the manifest of the shards if there are several. Must be
+		 * called once the walker is done. Errors are reported to stderr.
+		 * \return True on success, false otherwise
+		 */
+		bool close()
+		{
+			bool closed = true;
+
+			for (std::unique_ptr<RecordWriter>& output : m_Outputs)
+			{
+				if (!output->close())
+				{
+					std::cerr << "-- Error writing the output file: " << strerror(output->getError()) << "\n";
+					closed = false;
+				}
+			}
+
+			if (m_Outputs.size() > 1)
+			{
+				closed = writeManifest() && closed;
+			}
+
+			return closed;
+		}
+
+		/**
+		 * \brief Returns the \ref StatField flags of the fields written by the raw or human-readable output of the specified format
+		 */
+		static unsigned int getOutputStatFields(bool human, OutputFormat format = OUTPUT_FORMAT_CSV)
+		{
+			unsigned int fields = STAT_FIELD_ATIME | STAT_FIELD_MTIME | STAT_FIELD_UID | STAT_FIELD_GID | STAT_FIELD_MODE
+					| STAT_FIELD_SIZE | STAT_FIELD_BLOCKS;
+
+			// Snapshots keep the link count, so that they can be converted to either CSV output later, and the status
+			// change time, so that they can serve as the baseline of a later collection
+			if (human || format == OUTPUT_FORMAT_COLUMNAR)
+			{
+				fields |= STAT_FIELD_NLINK;
+			}
+
+			if (format == OUTPUT_FORMAT_COLUMNAR)
+			{
+				fields |= STAT_FIELD_CTIME;
+			}
+
+			return fields;
+		}
+
+		/**
+		 * \brief Returns the path of the specified output shard: the output path followed by the shard's zero-padded index
+		 */
+		static std::string getShardPath(const std::string& outputPath, int shard)
+		{
+			char suffix[16];
+			snprintf(suffix, sizeof(suffix), ".%03d", shard);
+
+			return outputPath + suffix;
+		}
+	};
+}
+
+#endif	/* FILESINK_HPP */
@@ -0,0 +1,213 @@
+#ifndef IDNAMETABLE_HPP
+#define	IDNAMETABLE_HPP
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include <sys/types.h>
+
+#include "DirectoryTable.hpp"
+#include "StringRef.hpp"
+
+#define ID_NAME_TABLE_MIN_CAPACITY 1024 //!< Minimum number of slots of a \ref pstat::IdNameTable. Must be a power of 2.
+
+namespace pstat
+{
+	/**
+	 * \brief Maps numeric ids (uids or gids) to their names. The table is an open-addressing hash table of fixed
+	 * capacity, bulk-loaded once (e.g. with the whole passwd database) and probed without locks. Ids missing from the
+	 * table are resolved by a callback, under a lock, and added to it, so each id is resolved at most once. Once the
+	 * table is half full, further ids go to a locked overflow map.
+	 * Names are interned in an arena, so the returned references stay valid for the lifetime of the table.
+	 * \ref find() and \ref resolve() are thread-safe; \ref load() is not.
+	 */
+	class IdNameTable
+	{
+	public:
+		/**
+		 * \brief Resolves the specified id to its name
+		 * \return True on success, false if the id has no name
+		 */
+		typedef bool (*Resolver)(u_int32_t id, std::string& name);
+
+	private:
+		/**
+		 * \brief A slot of the table
+		 */
+		struct Slot
+		{
+			std::atomic<u_int64_t> key; //!< The id, plus 2^32 so that 0 marks an empty slot. Published after name
+			StringRef name; //!< The name of the id
+		};
+
+		std::unique_ptr<Slot[]> m_Slots; //!< The table
+		size_t m_Mask; //!< Number of slots minus one
+		size_t m_Used; //!< Number of used slots
+		std::unordered_map<u_int32_t, StringRef> m_Overflow; //!< Names added once the table is half full
+		StringArena m_Names; //!< The interned names
+		std::mutex m_Mutex; //!< Guards the additions, and \ref m_Overflow
+		Resolver m_Resolver; //!< Resolves the ids missing from the table
+		StringRef m_Unknown; //!< Returned for ids with no name
+
+		IdNameTable(const IdNameTable&);
+		IdNameTable& operator=(const IdNameTable&);
+
+		/**
+		 * \brief Returns the index of the first slot to probe for the specified id
+		 */
+		inline size_t getSlot(u_int32_t id) const
+		{
+			// Fibonacci hashing, as consecutive ids are common
+			return ((id * 0x9E3779B97F4A7C15ull) >> 32) & m_Mask;
+		}
+
+		/**
+		 * \brief Allocates an empty table with at least the specified number of slots
+		 */
+		void allocate(size_t capacity)
+		{
+			size_t slots = ID_NAME_TABLE_MIN_CAPACITY;
+
+			while (slots < capacity)
+			{
+				slots *= 2;
+			}
+
+			m_Slots.reset(new Slot[slots]);
+			m_Mask = slots - 1;
+			m_Used = 0;
+
+			for (size_t i = 0; i < slots; i++)
+			{
+				m_Slots[i].key.store(0, std::memory_order_relaxed);
+			}
+		}
+
+		/**
+		 * \brief Adds the specified id and name, unless the id is already known. Must be called with \ref m_Mutex held
+		 * (or before the table is shared).
+		 * \return The name of the id
+		 */
+		StringRef add(u_int32_t id, const std::string& name)
+		{
+			u_int64_t key = id + (1ull << 32);
+			size_t i = getSlot(id);
+
+			for (; m_Slots[i].key.load(std::memory_order_relaxed) != 0; i = (i + 1) & m_Mask)
+			{
+				if (m_Slots[i].key.load(std::memory_order_relaxed) == key)
+				{
+					return m_Slots[i].name;
+				}
+			}
+
+			std::unordered_map<u_int32_t, StringRef>::const_iterator overflow = m_Overflow.find(id);
+
+			if (overflow != m_Overflow.end())
+			{
+				return overflow->second;
+			}
+
+			StringRef interned(m_Names.copy(name.data(), name.size()), name.size());
+
+			if (2 * (m_Used + 1) > m_Mask + 1)
+			{
+				m_Overflow[id] = interned;
+			}
+			else
+			{
+				m_Slots[i].name = interned;
+				m_Slots[i].key.store(key, std::memory_order_release);
+				m_Used++;
+			}
+
+			return interned;
+		}
+
+	public:
+
+		/**
+		 * \brief Creates an empty table
+		 * \param resolver Resolves the ids missing from the table
+		 * \param unknown Returned for the ids with no name
+		 */
+		IdNameTable(Resolver resolver, const char* unknown) : m_Unknown(unknown)
+		{
+			m_Resolver = resolver;
+			allocate(ID_NAME_TABLE_MIN_CAPACITY);
+		}
+
+		/**
+		 * \brief Replaces the content of the table with the specified ids and names. For repeated ids, the first name is
+		 * kept. Not thread-safe: must be called before the table is shared.
+		 */
+		void load(const std::vector<std::pair<u_int32_t, std::string>>& names)
+		{
+			allocate(names.size() * 4);
+			m_Overflow.clear();
+
+			for (const std::pair<u_int32_t, std::string>& name : names)
+			{
+				add(name.first, name.second);
+			}
+		}
+
+		/**
+		 * \brief Looks the specified id up in the table, without locking
+		 * \return True if the id is found, false otherwise
+		 */
+		inline bool find(u_int32_t id, StringRef& name) const
+		{
+			u_int64_t key = id + (1ull << 32);
+			u_int64_t found;
+
+			for (size_t i = getSlot(id); (found = m_Slots[i].key.load(std::memory_order_acquire)) != 0; i = (i + 1) & m_Mask)
+			{
+				if (found == key)
+				{
+					name = m_Slots[i].name;
+					return true;
+				}
+			}
+
+			return false;
+		}
+
+		/**
+		 * \brief Returns the name of the specified id, resolving it if it is not in the table yet
+		 */
+		inline StringRef resolve(u_int32_t id)
+		{
+			StringRef name;
+
+			if (find(id, name))
+			{
+				return name;
+			}
+
+			std::unique_lock<std::mutex> lock(m_Mutex);
+
+			// Another thread may have added it meanwhile, in which case it is not resolved again
+			std::unordered_map<u_int32_t, StringRef>::const_iterator overflow = m_Overflow.find(id);
+
+			if (overflow != m_Overflow.end())
+			{
+				return overflow->second;
+			}
+
+			if (find(id, name))
+			{
+				return name;
+			}
+
+			std::string resolved;
+
+			return m_Resolver(id, resolved) ? add(id, resolved) : add(id, m_Unknown.str());
+		}
+	};
+}
+
+#endif	/* IDNAMETABLE_HPP */
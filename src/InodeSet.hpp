@@ -0,0 +1,185 @@
+#ifndef INODESET_HPP
+#define	INODESET_HPP
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <sys/types.h>
+
+#define INODE_SET_SHARD_BITS 8 //!< log2 of the number of shards of a \ref pstat::InodeSet
+#define INODE_SET_INITIAL_CAPACITY 256 //!< Initial number of slots of each shard of a \ref pstat::InodeSet
+
+namespace pstat
+{
+	/**
+	 * \brief How the entries with several hard links are accounted for
+	 */
+	enum HardlinkMode
+	{
+		HARDLINKS_COUNT, //!< Every link is output as is, so its space is counted once per link
+		HARDLINKS_MARK, //!< Every link is output, but only the first one found carries the space on disk of the inode
+		HARDLINKS_DROP //!< Only the first link found of each inode is output
+	};
+
+	/**
+	 * \brief A concurrent set of inodes, identified by their device and inode numbers, that tells which link of an inode
+	 * is found first. Keys are stored packed (16 bytes each) in open-addressing tables rather than in nodes, so it is
+	 * meant to hold the inodes with several links only. The set is split into shards, picked by the hash of the key,
+	 * each with its own lock and table, so that threads only contend when they insert into the same shard at once.
+	 * All the methods are thread-safe.
+	 */
+	class InodeSet
+	{
+		/**
+		 * \brief A key: device and inode numbers. (0, 0) marks a free slot
+		 */
+		struct Key
+		{
+			u_int64_t dev; //!< Device number
+			u_int64_t ino; //!< Inode number
+		};
+
+		/**
+		 * \brief A shard. Each one is allocated separately and padded, so that shards do not false-share
+		 */
+		struct Shard
+		{
+			char padding[64]; //!< Keeps the tail of the previous allocation off the cache line of the mutex
+			std::mutex mutex; //!< Guards the members below
+			std::vector<Key> slots; //!< The open-addressing table. Its size is a power of 2
+			size_t count; //!< Number of keys in slots
+			bool zero; //!< Set if the set holds the (0, 0) key, which cannot be stored in slots
+		};
+
+		static const size_t SHARD_COUNT = 1 << INODE_SET_SHARD_BITS; //!< Number of shards
+
+		std::vector<std::unique_ptr<Shard>> m_Shards; //!< The shards
+
+		InodeSet(const InodeSet&);
+		InodeSet& operator=(const InodeSet&);
+
+		/**
+		 * \brief Returns the hash of the specified key (the finalizer of MurmurHash3, over both halves)
+		 */
+		static inline u_int64_t hash(u_int64_t dev, u_int64_t ino)
+		{
+			u_int64_t h = ino ^ (dev * 0x9e3779b97f4a7c15ull);
+
+			h ^= h >> 33;
+			h *= 0xff51afd7ed558ccdull;
+			h ^= h >> 33;
+			h *= 0xc4ceb9fe1a85ec53ull;
+			h ^= h >> 33;
+
+			return h;
+		}
+
+		/**
+		 * \brief Inserts the specified key into the specified table, which has a free slot and does not hold the key
+		 */
+		static inline void place(std::vector<Key>& slots, const Key& key, u_int64_t h)
+		{
+			size_t mask = slots.size() - 1;
+			size_t i = h & mask;
+
+			while (slots[i].dev != 0 || slots[i].ino != 0)
+			{
+				i = (i + 1) & mask;
+			}
+
+			slots[i] = key;
+		}
+
+		/**
+		 * \brief Doubles the size of the table of the specified shard, whose lock is held
+		 */
+		static void grow(Shard& shard)
+		{
+			Key free = {0, 0};
+			std::vector<Key> slots(shard.slots.size() * 2, free);
+
+			for (const Key& key : shard.slots)
+			{
+				if (key.dev != 0 || key.ino != 0)
+				{
+					place(slots, key, hash(key.dev, key.ino));
+				}
+			}
+
+			shard.slots.swap(slots);
+		}
+
+	public:
+
+		InodeSet()
+		{
+			Key free = {0, 0};
+
+			for (size_t i = 0; i < SHARD_COUNT; i++)
+			{
+				m_Shards.push_back(std::unique_ptr<Shard>(new Shard()));
+				m_Shards[i]->slots.resize(INODE_SET_INITIAL_CAPACITY, free);
+				m_Shards[i]->count = 0;
+				m_Shards[i]->zero = false;
+			}
+		}
+
+		/**
+		 * \brief Inserts the specified inode into the set
+		 * \return True if it was not in the set yet, false otherwise
+		 */
+		bool insert(u_int64_t dev, u_int64_t ino)
+		{
+			u_int64_t h = hash(dev, ino);
+			Shard& shard = *m_Shards[h >> (64 - INODE_SET_SHARD_BITS)];
+			std::unique_lock<std::mutex> lock(shard.mutex);
+
+			if (dev == 0 && ino == 0)
+			{
+				bool inserted = !shard.zero;
+				shard.zero = true;
+				return inserted;
+			}
+
+			size_t mask = shard.slots.size() - 1;
+
+			for (size_t i = h & mask; shard.slots[i].dev != 0 || shard.slots[i].ino != 0; i = (i + 1) & mask)
+			{
+				if (shard.slots[i].dev == dev && shard.slots[i].ino == ino)
+				{
+					return false;
+				}
+			}
+
+			// Keep the load factor under 1/2, so that probe sequences stay short
+			if ((shard.count + 1) * 2 > shard.slots.size())
+			{
+				grow(shard);
+			}
+
+			Key key = {dev, ino};
+			place(shard.slots, key, h);
+			shard.count++;
+
+			return true;
+		}
+
+		/**
+		 * \brief Returns the approximate number of bytes used by the set
+		 */
+		size_t getAllocatedBytes()
+		{
+			size_t bytes = 0;
+
+			for (std::unique_ptr<Shard>& shard : m_Shards)
+			{
+				std::unique_lock<std::mutex> lock(shard->mutex);
+				bytes += sizeof(Shard) + shard->slots.size() * sizeof(Key);
+			}
+
+			return bytes;
+		}
+	};
+}
+
+#endif	/* INODESET_HPP */
@@ -0,0 +1,309 @@
+#ifndef IOURING_HPP
+#define	IOURING_HPP
+
+#include <sys/syscall.h>
+#include <sys/stat.h>
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && defined(SYS_io_uring_setup) && defined(SYS_getdents64) && defined(STATX_BASIC_STATS)
+#include <linux/io_uring.h>
+#ifdef IO_URING_OP_SUPPORTED // Operation probing comes with the same kernel headers (5.6) as IORING_OP_OPENAT and IORING_OP_STATX
+#define HAVE_IO_URING_ 1 //!< Defined if the io_uring system calls can be compiled in
+#endif
+#endif
+#endif
+
+#ifdef HAVE_IO_URING_
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <vector>
+
+namespace pstat
+{
+	/**
+	 * \brief A minimal io_uring submission/completion ring, talking to the kernel through the raw system calls so
+	 * that liburing is not required. An instance must only be used by a single thread.
+	 */
+	class IoUring
+	{
+		int m_Fd; //!< The ring file descriptor
+		void* m_SqRing; //!< The mapped submission queue ring
+		void* m_CqRing; //!< The mapped completion queue ring (equal to \ref m_SqRing on kernels that map both at once)
+		size_t m_SqRingSize; //!< Size of the \ref m_SqRing mapping
+		size_t m_CqRingSize; //!< Size of the \ref m_CqRing mapping
+		io_uring_sqe* m_Sqes; //!< The mapped submission queue entries
+		size_t m_SqesSize; //!< Size of the \ref m_Sqes mapping
+
+		unsigned* m_SqHead; //!< Submission queue head, advanced by the kernel
+		unsigned* m_SqTail; //!< Submission queue tail, advanced by us
+		unsigned* m_SqMask; //!< Submission queue ring mask
+		unsigned* m_SqArray; //!< Submission queue index array
+		unsigned m_SqEntries; //!< Number of entries in the submission queue
+		unsigned m_SqLocalTail; //!< Tail of the prepared (but maybe not yet published) entries
+		unsigned m_ToSubmit; //!< Number of entries prepared but not yet consumed by the kernel
+
+		unsigned* m_CqHead; //!< Completion queue head, advanced by us
+		unsigned* m_CqTail; //!< Completion queue tail, advanced by the kernel
+		unsigned* m_CqMask; //!< Completion queue ring mask
+		io_uring_cqe* m_Cqes; //!< The completion queue entries
+
+		IoUring(const IoUring&);
+		IoUring& operator=(const IoUring&);
+
+		/**
+		 * \brief Returns the address at the specified offset within the specified mapping
+		 */
+		template<typename T>
+		static inline T* at(void* base, unsigned offset)
+		{
+			return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+		}
+
+	public:
+
+		IoUring()
+		{
+			m_Fd = -1;
+			m_SqRing = m_CqRing = MAP_FAILED;
+			m_Sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+			m_SqLocalTail = m_ToSubmit = 0;
+		}
+
+		/**
+		 * \brief Sets up the ring with the specified number of submission entries
+		 * \return True on success, false if the kernel does not support (or does not allow) io_uring
+		 */
+		bool init(unsigned entries)
+		{
+			io_uring_params params;
+			memset(&params, 0, sizeof(params));
+
+			m_Fd = syscall(SYS_io_uring_setup, entries, &params);
+
+			if (m_Fd < 0)
+			{
+				return false;
+			}
+
+			m_SqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+			m_CqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+			if (params.features & IORING_FEAT_SINGLE_MMAP)
+			{
+				m_SqRingSize = m_CqRingSize = std::max(m_SqRingSize, m_CqRingSize);
+			}
+
+			m_SqRing = mmap(NULL, m_SqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_Fd, IORING_OFF_SQ_RING);
+
+			if (m_SqRing == MAP_FAILED)
+			{
+				return false;
+			}
+
+			if (params.features & IORING_FEAT_SINGLE_MMAP)
+			{
+				m_CqRing = m_SqRing;
+			}
+			else if ((m_CqRing = mmap(NULL, m_CqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_Fd, IORING_OFF_CQ_RING)) == MAP_FAILED)
+			{
+				return false;
+			}
+
+			m_SqesSize = params.sq_entries * sizeof(io_uring_sqe);
+			m_Sqes = static_cast<io_uring_sqe*>(mmap(NULL, m_SqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_Fd, IORING_OFF_SQES));
+
+			if (m_Sqes == MAP_FAILED)
+			{
+				return false;
+			}
+
+			m_SqHead = at<unsigned>(m_SqRing, params.sq_off.head);
+			m_SqTail = at<unsigned>(m_SqRing, params.sq_off.tail);
+			m_SqMask = at<unsigned>(m_SqRing, params.sq_off.ring_mask);
+			m_SqArray = at<unsigned>(m_SqRing, params.sq_off.array);
+			m_SqEntries = params.sq_entries;
+			m_SqLocalTail = *m_SqTail;
+
+			m_CqHead = at<unsigned>(m_CqRing, params.cq_off.head);
+			m_CqTail = at<unsigned>(m_CqRing, params.cq_off.tail);
+			m_CqMask = at<unsigned>(m_CqRing, params.cq_off.ring_mask);
+			m_Cqes = at<io_uring_cqe>(m_CqRing, params.cq_off.cqes);
+
+			return true;
+		}
+
+		/**
+		 * \brief Returns true if the kernel supports all the specified IORING_OP_* operations
+		 */
+		bool supports(const std::vector<int>& opcodes)
+		{
+			size_t size = sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op);
+			io_uring_probe* probe = static_cast<io_uring_probe*>(calloc(1, size));
+
+			bool ret = syscall(SYS_io_uring_register, m_Fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+
+			for (int op : opcodes)
+			{
+				ret = ret && op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+			}
+
+			free(probe);
+
+			return ret;
+		}
+
+		/**
+		 * \brief Gets a cleared submission entry to be filled by the caller
+		 * \return The entry, or NULL if the submission queue is full (call \ref submit() first)
+		 */
+		io_uring_sqe* getSqe()
+		{
+			unsigned head = __atomic_load_n(m_SqHead, __ATOMIC_ACQUIRE);
+
+			if (m_SqLocalTail - head >= m_SqEntries)
+			{
+				return NULL;
+			}
+
+			unsigned index = m_SqLocalTail & *m_SqMask;
+			io_uring_sqe* sqe = &m_Sqes[index];
+
+			memset(sqe, 0, sizeof(*sqe));
+			m_SqArray[index] = index;
+			m_SqLocalTail++;
+			m_ToSubmit++;
+
+			return sqe;
+		}
+
+		/**
+		 * \brief Prepares a statx() of the specified name relative to dirfd. The name and the buffer must stay valid
+		 * until the request completes.
+		 */
+		io_uring_sqe* prepareStatx(int dirfd, const char* name, int flags, unsigned mask, struct statx* buffer, unsigned long long userData)
+		{
+			io_uring_sqe* sqe = getSqe();
+
+			if (sqe != NULL)
+			{
+				sqe->opcode = IORING_OP_STATX;
+				sqe->fd = dirfd;
+				sqe->addr = reinterpret_cast<unsigned long>(name);
+				sqe->len = mask;
+				sqe->off = reinterpret_cast<unsigned long>(buffer);
+				sqe->statx_flags = flags;
+				sqe->user_data = userData;
+			}
+
+			return sqe;
+		}
+
+		/**
+		 * \brief Prepares an openat() of the specified path relative to dirfd. The path must stay valid until the
+		 * request completes.
+		 */
+		io_uring_sqe* prepareOpenat(int dirfd, const char* path, int flags, unsigned long long userData)
+		{
+			io_uring_sqe* sqe = getSqe();
+
+			if (sqe != NULL)
+			{
+				sqe->opcode = IORING_OP_OPENAT;
+				sqe->fd = dirfd;
+				sqe->addr = reinterpret_cast<unsigned long>(path);
+				sqe->open_flags = flags;
+				sqe->user_data = userData;
+			}
+
+			return sqe;
+		}
+
+		/**
+		 * \brief Submits all the prepared entries to the kernel
+		 * \param waitCount Blocks until at least that many completions are available
+		 * \return The number of submitted entries, or -errno on failure
+		 */
+		int submit(unsigned waitCount = 0)
+		{
+			__atomic_store_n(m_SqTail, m_SqLocalTail, __ATOMIC_RELEASE);
+
+			int ret = syscall(SYS_io_uring_enter, m_Fd, m_ToSubmit, waitCount, waitCount > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+
+			if (ret < 0)
+			{
+				return -errno;
+			}
+
+			m_ToSubmit -= ret;
+
+			return ret;
+		}
+
+		/**
+		 * \brief Gets the next available completion without blocking
+		 * \return The completion, or NULL if none is available. Call \ref seen() once done with it.
+		 */
+		inline io_uring_cqe* peek()
+		{
+			unsigned head = *m_CqHead;
+
+			if (head == __atomic_load_n(m_CqTail, __ATOMIC_ACQUIRE))
+			{
+				return NULL;
+			}
+
+			return &m_Cqes[head & *m_CqMask];
+		}
+
+		/**
+		 * \brief Marks the completion returned by \ref peek() as consumed
+		 */
+		inline void seen()
+		{
+			__atomic_store_n(m_CqHead, *m_CqHead + 1, __ATOMIC_RELEASE);
+		}
+
+		/**
+		 * \brief Returns true if io_uring is usable and supports the operations needed by the walker
+		 * (IORING_OP_OPENAT and IORING_OP_STATX)
+		 */
+		static bool isSupported()
+		{
+			IoUring ring;
+
+			return ring.init(2) && ring.supports({IORING_OP_OPENAT, IORING_OP_STATX});
+		}
+
+		~IoUring()
+		{
+			if (m_Sqes != MAP_FAILED)
+			{
+				munmap(m_Sqes, m_SqesSize);
+			}
+
+			if (m_CqRing != MAP_FAILED && m_CqRing != m_SqRing)
+			{
+				munmap(m_CqRing, m_CqRingSize);
+			}
+
+			if (m_SqRing != MAP_FAILED)
+			{
+				munmap(m_SqRing, m_SqRingSize);
+			}
+
+			if (m_Fd >= 0)
+			{
+				close(m_Fd);
+			}
+		}
+	};
+}
+
+#endif	/* HAVE_IO_URING_ */
+
+#endif	/* IOURING_HPP */
@@ -0,0 +1,204 @@
+#ifndef LOCALCALENDAR_HPP
+#define	LOCALCALENDAR_HPP
+
+#include <algorithm>
+#include <vector>
+#include <ctime>
+#include <cstring>
+#include <sys/types.h>
+
+#define LOCAL_CALENDAR_FIRST_YEAR 1900 //!< First year covered by the table of a \ref pstat::LocalCalendar
+#define LOCAL_CALENDAR_LAST_YEAR 2100 //!< Year following the last one covered by the table of a \ref pstat::LocalCalendar
+#define LOCAL_CALENDAR_BUCKET_BITS 20 //!< log2 of the number of seconds covered by each bucket of a \ref pstat::LocalCalendar (about 12 days)
+
+namespace pstat
+{
+	/**
+	 * \brief Converts times to local dates with arithmetic only. The UTC offset changes of the local timezone between
+	 * \ref LOCAL_CALENDAR_FIRST_YEAR and \ref LOCAL_CALENDAR_LAST_YEAR are found once, at construction, and laid out in
+	 * fixed-size buckets of time, each holding at most one change. Converting a time then takes a bucket lookup, a
+	 * comparison and the civil-from-days computation, instead of localtime_r(). Times out of the table, and the rare
+	 * buckets holding more than one change, fall back to localtime_r().
+	 * Immutable once constructed, hence thread-safe.
+	 */
+	class LocalCalendar
+	{
+		/**
+		 * \brief The UTC offsets within a bucket of time
+		 */
+		struct Bucket
+		{
+			time_t change; //!< The first second at the offset after, or the end of the bucket if the offset is unchanged
+			int32_t before; //!< UTC offset, in seconds east, before change
+			int32_t after; //!< UTC offset, in seconds east, from change on
+			bool irregular; //!< Set if the offset changes more than once within the bucket
+		};
+
+		time_t m_Start; //!< The first second covered by the table
+		time_t m_End; //!< The second following the last one covered by the table
+		std::vector<Bucket> m_Buckets; //!< The table
+
+		/**
+		 * \brief Returns the UTC offset, in seconds east, of the local timezone at the specified time
+		 */
+		static long getOffset(time_t time)
+		{
+			struct tm timeob;
+			localtime_r(&time, &timeob);
+
+			return timeob.tm_gmtoff;
+		}
+
+		/**
+		 * \brief Returns the number of days between the epoch and the specified date of the proleptic Gregorian calendar
+		 */
+		static int64_t daysFromCivil(int64_t year, unsigned month, unsigned day)
+		{
+			year -= month <= 2;
+
+			int64_t era = (year >= 0 ? year : year - 399) / 400;
+			unsigned yearOfEra = year - era * 400;
+			unsigned dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+			unsigned dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+
+			return era * 146097 + dayOfEra - 719468;
+		}
+
+		/**
+		 * \brief Formats the date of the specified number of days since the epoch as YYYY-mm-dd at out. The year must
+		 * have 4 digits.
+		 * \return The end of the formatted date
+		 */
+		static char* formatCivil(char* out, int64_t days)
+		{
+			// Shift the epoch to 0000-03-01, so that leap days end the years, then split into 400-year eras
+			days += 719468;
+
+			int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+			unsigned dayOfEra = days - era * 146097;
+			unsigned yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+			unsigned dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+			unsigned shiftedMonth = (5 * dayOfYear + 2) / 153;
+			unsigned day = dayOfYear - (153 * shiftedMonth + 2) / 5 + 1;
+			unsigned month = shiftedMonth < 10 ? shiftedMonth + 3 : shiftedMonth - 9;
+			unsigned year = yearOfEra + era * 400 + (month <= 2);
+
+			out[0] = '0' + year / 1000;
+			out[1] = '0' + year / 100 % 10;
+			out[2] = '0' + year / 10 % 10;
+			out[3] = '0' + year % 10;
+			out[4] = '-';
+			out[5] = '0' + month / 10;
+			out[6] = '0' + month % 10;
+			out[7] = '-';
+			out[8] = '0' + day / 10;
+			out[9] = '0' + day % 10;
+
+			return out + 10;
+		}
+
+		/**
+		 * \brief Returns the first second within (from, to] whose UTC offset differs from the one at from. The offset at
+		 * to must differ.
+		 */
+		static time_t findChange(time_t from, time_t to)
+		{
+			long offset = getOffset(from);
+
+			while (to - from > 1)
+			{
+				time_t middle = from + (to - from) / 2;
+
+				(getOffset(middle) == offset ? from : to) = middle;
+			}
+
+			return to;
+		}
+
+	public:
+
+		/**
+		 * \brief Builds the table of the local timezone (as set when constructed)
+		 */
+		LocalCalendar()
+		{
+			// A day of margin at both ends, so that local dates near the bounds are covered whatever the offset
+			m_Start = (daysFromCivil(LOCAL_CALENDAR_FIRST_YEAR, 1, 1) - 1) * 86400;
+			m_End = (daysFromCivil(LOCAL_CALENDAR_LAST_YEAR, 1, 1) + 1) * 86400;
+			m_Buckets.resize(((m_End - m_Start) >> LOCAL_CALENDAR_BUCKET_BITS) + 1);
+
+			for (size_t i = 0; i < m_Buckets.size(); i++)
+			{
+				Bucket& bucket = m_Buckets[i];
+				time_t start = m_Start + (static_cast<time_t>(i) << LOCAL_CALENDAR_BUCKET_BITS);
+				time_t end = start + (1 << LOCAL_CALENDAR_BUCKET_BITS);
+
+				bucket.before = bucket.after = getOffset(start);
+				bucket.change = end;
+				bucket.irregular = false;
+
+				// Offsets change at most a few times a year, so probing daily finds every change
+				for (time_t time = start; time < end && !bucket.irregular; time += 86400)
+				{
+					time_t next = std::min<time_t>(time + 86400, end - 1);
+					long offset = getOffset(next);
+
+					if (offset == (bucket.change == end ? bucket.before : bucket.after))
+					{
+						continue;
+					}
+
+					if (bucket.change != end)
+					{
+						bucket.irregular = true;
+					}
+					else
+					{
+						bucket.change = findChange(time, next);
+						bucket.after = getOffset(bucket.change);
+						bucket.irregular = bucket.after != offset;
+					}
+				}
+			}
+		}
+
+		/**
+		 * \brief Formats the local date of the specified time as YYYY-mm-dd at out
+		 * \return The end of the formatted date
+		 */
+		inline char* formatDate(char* out, time_t time) const
+		{
+			if (time >= m_Start && time < m_End)
+			{
+				const Bucket& bucket = m_Buckets[(time - m_Start) >> LOCAL_CALENDAR_BUCKET_BITS];
+
+				if (!bucket.irregular)
+				{
+					time_t local = time + (time < bucket.change ? bucket.before : bucket.after);
+
+					return formatCivil(out, local >= 0 ? local / 86400 : (local - 86399) / 86400);
+				}
+			}
+
+			return formatLocalDate(out, time);
+		}
+
+		/**
+		 * \brief Formats the local date of the specified time as YYYY-mm-dd at out with localtime_r()
+		 * \return The end of the formatted date
+		 */
+		static char* formatLocalDate(char* out, time_t time)
+		{
+			struct tm timeob;
+			char text[32];
+
+			localtime_r(&time, &timeob);
+			size_t length = std::strftime(text, sizeof(text), "%Y-%m-%d", &timeob);
+			memcpy(out, text, length);
+
+			return out + length;
+		}
+	};
+}
+
+#endif	/* LOCALCALENDAR_HPP */
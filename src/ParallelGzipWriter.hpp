@@ -0,0 +1,311 @@
+#ifndef PARALLELGZIPWRITER_HPP
+#define	PARALLELGZIPWRITER_HPP
+
+#ifdef HAVE_ZLIB_
+
+#include <vector>
+#include <map>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "BlockingQueue.hpp"
+
+#define GZIP_COMPRESSION_LEVEL Z_DEFAULT_COMPRESSION //!< zlib compression level of the gzip members
+#define GZIP_BLOCKS_PER_THREAD 2 //!< Number of blocks in flight per compressor thread, bounding the memory held by a \ref pstat::ParallelGzipWriter
+
+namespace pstat
+{
+	/**
+	 * \brief Compresses the blocks handed over by its owner on a pool of compressor threads, and writes them to a file in
+	 * the order they were handed over. Each block is compressed as a complete gzip member, so blocks are compressed
+	 * independently of each other and the file (a concatenation of gzip members) is read by zcat and gzip -d as a whole.
+	 * Blocks are recycled, so at most \ref GZIP_BLOCKS_PER_THREAD blocks per thread are in flight: once they are all
+	 * busy, \ref write() blocks until the oldest one is written.
+	 * \ref write() must be called by one thread at a time.
+	 */
+	class ParallelGzipWriter
+	{
+		/**
+		 * \brief A block of data, before and after its compression
+		 */
+		struct Block
+		{
+			u_int64_t sequence; //!< The order in which the block was handed over
+			std::vector<char> input; //!< The uncompressed data
+			size_t inputLength; //!< Number of valid bytes within input
+			std::vector<char> output; //!< The gzip member
+			size_t outputLength; //!< Number of valid bytes within output
+		};
+
+		int m_Fd; //!< The output file descriptor
+		int m_Error; //!< The errno of the first failed compression or write, or 0
+		std::vector<std::unique_ptr<Block>> m_Blocks; //!< All the blocks
+		std::vector<std::thread> m_CompressThreads; //!< The compressor threads
+		BlockingQueue<Block*> m_PendingBlocks; //!< Blocks waiting to be compressed
+		std::mutex m_Mutex; //!< Guards all the members below, and \ref m_Error
+		std::condition_variable m_BlockFreed; //!< Notified whenever a block is written and back to \ref m_FreeBlocks
+		std::vector<Block*> m_FreeBlocks; //!< Blocks ready to be handed over
+		std::map<u_int64_t, Block*> m_CompressedBlocks; //!< Compressed blocks waiting for the blocks before them, by sequence
+		u_int64_t m_NextSequence; //!< The sequence of the next block to be handed over
+		u_int64_t m_NextWrite; //!< The sequence of the next block to be written
+		bool m_Writing; //!< Set while a compressor thread writes blocks out
+
+		ParallelGzipWriter(const ParallelGzipWriter&);
+		ParallelGzipWriter& operator=(const ParallelGzipWriter&);
+
+		/**
+		 * \brief Records the specified errno, unless an error was already recorded
+		 */
+		void setError(int error)
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+
+			if (m_Error == 0)
+			{
+				m_Error = error;
+			}
+		}
+
+		/**
+		 * \brief Writes all the specified bytes to the file
+		 * \return 0 on success, errno otherwise
+		 */
+		int writeFully(const char* data, size_t length)
+		{
+			while (length > 0)
+			{
+				ssize_t ret = ::write(m_Fd, data, length);
+
+				if (ret < 0 && errno != EINTR)
+				{
+					return errno;
+				}
+
+				data += ret > 0 ? ret : 0;
+				length -= ret > 0 ? ret : 0;
+			}
+
+			return 0;
+		}
+
+		/**
+		 * \brief Queues the specified compressed block for writing. Then, unless another thread is already at it, writes
+		 * all the blocks whose turn came, in order, and recycles them.
+		 */
+		void complete(Block* block)
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_CompressedBlocks[block->sequence] = block;
+
+			if (m_Writing)
+			{
+				return;
+			}
+
+			m_Writing = true;
+
+			std::map<u_int64_t, Block*>::iterator next;
+
+			while ((next = m_CompressedBlocks.find(m_NextWrite)) != m_CompressedBlocks.end())
+			{
+				Block* written = next->second;
+				m_CompressedBlocks.erase(next);
+				m_NextWrite++;
+
+				// Write without the lock, so that the other threads can queue their blocks meanwhile
+				bool failed = m_Error != 0;
+				lock.unlock();
+				int error = failed ? 0 : writeFully(&written->output[0], written->outputLength);
+				lock.lock();
+
+				if (error != 0 && m_Error == 0)
+				{
+					m_Error = error;
+				}
+
+				m_FreeBlocks.push_back(written);
+				m_BlockFreed.notify_one();
+			}
+
+			m_Writing = false;
+		}
+
+		/**
+		 * \brief The main loop of the compressor threads: compresses the pending blocks, each as a gzip member
+		 */
+		void compressThreadWork()
+		{
+			z_stream stream;
+			memset(&stream, 0, sizeof(stream));
+
+			// 15 window bits, plus 16 for a gzip header and trailer instead of zlib's
+			bool initialized = deflateInit2(&stream, GZIP_COMPRESSION_LEVEL, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+
+			if (!initialized)
+			{
+				setError(ENOMEM);
+			}
+
+			Block* block;
+
+			while (m_PendingBlocks.pop(block))
+			{
+				block->outputLength = 0;
+
+				if (initialized)
+				{
+					deflateReset(&stream);
+
+					size_t bound = deflateBound(&stream, block->inputLength);
+
+					if (block->output.size() < bound)
+					{
+						block->output.resize(bound);
+					}
+
+					stream.next_in = reinterpret_cast<Bytef*>(&block->input[0]);
+					stream.avail_in = block->inputLength;
+					stream.next_out = reinterpret_cast<Bytef*>(&block->output[0]);
+					stream.avail_out = bound;
+
+					// The output is large enough for the whole member, so a single call compresses the block
+					if (deflate(&stream, Z_FINISH) == Z_STREAM_END)
+					{
+						block->outputLength = bound - stream.avail_out;
+					}
+					else
+					{
+						setError(EIO);
+					}
+				}
+
+				complete(block);
+			}
+
+			if (initialized)
+			{
+				deflateEnd(&stream);
+			}
+		}
+
+	public:
+
+		/**
+		 * \brief Creates a writer, and starts its compressor threads
+		 * \param fd The file descriptor to write to. It is not closed by the writer.
+		 * \param threads Number of compressor threads
+		 */
+		ParallelGzipWriter(int fd, int threads)
+		{
+			m_Fd = fd;
+			m_Error = 0;
+			m_NextSequence = 0;
+			m_NextWrite = 0;
+			m_Writing = false;
+
+			for (int i = 0; i < threads * GZIP_BLOCKS_PER_THREAD; i++)
+			{
+				m_Blocks.push_back(std::unique_ptr<Block>(new Block()));
+				m_FreeBlocks.push_back(m_Blocks.back().get());
+			}
+
+			for (int i = 0; i < threads; i++)
+			{
+				m_CompressThreads.push_back(std::thread(&ParallelGzipWriter::compressThreadWork, this));
+			}
+		}
+
+		/**
+		 * \brief Hands over the first length bytes of the specified buffer for compression. The buffer is swapped with
+		 * the input buffer of a free block rather than copied, and comes back with at least its original size.
+		 * Blocks while no block is free.
+		 */
+		void write(std::vector<char>& buffer, size_t length)
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+
+			while (m_FreeBlocks.empty())
+			{
+				m_BlockFreed.wait(lock);
+			}
+
+			Block* block = m_FreeBlocks.back();
+			m_FreeBlocks.pop_back();
+			block->sequence = m_NextSequence++;
+			lock.unlock();
+
+			size_t size = buffer.size();
+			block->input.swap(buffer);
+			block->inputLength = length;
+
+			if (buffer.size() < size)
+			{
+				buffer.resize(size);
+			}
+
+			m_PendingBlocks.push(block);
+		}
+
+		/**
+		 * \brief Returns the errno of the first failed compression or write, or 0 if none failed
+		 */
+		int getError()
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+
+			return m_Error;
+		}
+
+		/**
+		 * \brief Waits until all the handed over blocks are written
+		 * \return The errno of the first failed compression or write, or 0 if none failed
+		 */
+		int drain()
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+
+			while (m_FreeBlocks.size() < m_Blocks.size())
+			{
+				m_BlockFreed.wait(lock);
+			}
+
+			return m_Error;
+		}
+
+		/**
+		 * \brief Waits until all the handed over blocks are written, and stops the compressor threads
+		 * \return The errno of the first failed compression or write, or 0 if none failed
+		 */
+		int finish()
+		{
+			if (!m_CompressThreads.empty())
+			{
+				m_PendingBlocks.close();
+
+				for (std::thread& thread : m_CompressThreads)
+				{
+					thread.join();
+				}
+
+				m_CompressThreads.clear();
+			}
+
+			return getError();
+		}
+
+		~ParallelGzipWriter()
+		{
+			finish();
+		}
+	};
+}
+
+#endif	/* HAVE_ZLIB_ */
+
+#endif	/* PARALLELGZIPWRITER_HPP */
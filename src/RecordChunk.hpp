@@ -0,0 +1,304 @@
+#ifndef RECORDCHUNK_HPP
+#define	RECORDCHUNK_HPP
+
+#include "BlockingQueue.hpp"
+#include "DirectoryTable.hpp"
+
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <sys/stat.h>
+
+#define RECORD_CHUNK_SIZE 4096 //!< Number of stat records a walker thread collects before handing them to the flush threads
+
+namespace pstat
+{
+	/**
+	 * \brief Flags of a \ref StatRecord, set by the walker
+	 */
+	enum RecordFlag
+	{
+		RECORD_DUPLICATE_LINK = 1 //!< The entry is a further link of an inode whose first link found carries its space on disk
+	};
+
+	/**
+	 * \brief A compact stat record, holding only the fields pstat outputs. The path of the entry is not stored: the record
+	 * refers to its parent directory in the \ref DirectoryTable, and its name is stored in the names arena of its chunk.
+	 */
+	struct StatRecord
+	{
+		u_int64_t dev; //!< Device id
+		u_int64_t ino; //!< Inode number
+		u_int64_t size; //!< Size in bytes
+		u_int64_t blocks; //!< Number of 512-byte blocks allocated
+		int64_t atime; //!< Last access time
+		int64_t mtime; //!< Last modification time
+		int64_t ctime; //!< Last status change time
+		u_int32_t uid; //!< Owner user id
+		u_int32_t gid; //!< Owner group id
+		u_int32_t mode; //!< File type and mode
+		u_int32_t nlink; //!< Number of hard links
+		u_int32_t parent; //!< Id of the parent directory, or \ref NO_PARENT_DIRECTORY if the name is a full path
+		u_int32_t nameOffset; //!< Offset of the name within the names arena of the chunk
+		u_int16_t nameLength; //!< Length of the name
+		u_int16_t flags; //!< The \ref RecordFlag flags of the record
+
+		/**
+		 * \brief Fills the fields of this record from the specified stat record
+		 */
+		inline void assign(const struct stat& sb)
+		{
+			dev = sb.st_dev;
+			ino = sb.st_ino;
+			size = sb.st_size;
+			blocks = sb.st_blocks;
+			atime = sb.st_atime;
+			mtime = sb.st_mtime;
+			ctime = sb.st_ctime;
+			uid = sb.st_uid;
+			gid = sb.st_gid;
+			mode = sb.st_mode;
+			nlink = sb.st_nlink;
+			flags = 0;
+		}
+	};
+
+	/**
+	 * \brief A fixed-capacity batch of stat records, filled by a single walker thread and handed to the flush threads
+	 * as a whole. The names of the records are packed in an arena that belongs to the chunk. Chunks are recycled:
+	 * clearing a chunk keeps its memory, so a recycled chunk is refilled without allocating.
+	 */
+	class RecordChunk
+	{
+		std::vector<StatRecord> m_Records; //!< The record slots, all allocated upfront
+		size_t m_Count; //!< Number of used slots
+		std::vector<char> m_Names; //!< The names arena. Grows when needed, and keeps its size when cleared
+		size_t m_NamesLength; //!< Number of used bytes in \ref m_Names
+
+		/**
+		 * \brief Takes the next record slot, and stores the specified parent and name in it
+		 */
+		inline StatRecord& addName(u_int32_t parent, const char* name, size_t nameLength)
+		{
+			StatRecord& rec = m_Records[m_Count++];
+
+			if (m_NamesLength + nameLength > m_Names.size())
+			{
+				m_Names.resize(std::max(m_Names.size() * 2, m_NamesLength + nameLength));
+			}
+
+			memcpy(&m_Names[m_NamesLength], name, nameLength);
+
+			rec.parent = parent;
+			rec.nameOffset = m_NamesLength;
+			rec.nameLength = nameLength;
+			m_NamesLength += nameLength;
+
+			return rec;
+		}
+
+	public:
+
+		/**
+		 * \brief Creates a chunk of the specified capacity
+		 */
+		RecordChunk(size_t capacity = RECORD_CHUNK_SIZE) : m_Records(capacity), m_Names(capacity * 32)
+		{
+			m_Count = 0;
+			m_NamesLength = 0;
+		}
+
+		/**
+		 * \brief Adds a record to the chunk. Make sure the chunk is not full first.
+		 * \param sb The stat record of the entry
+		 * \param parent Id of the parent directory of the entry
+		 * \param name Name of the entry (or full path, if parent is \ref NO_PARENT_DIRECTORY)
+		 * \return The added record
+		 */
+		inline StatRecord& add(const struct stat& sb, u_int32_t parent, const char* name, size_t nameLength)
+		{
+			StatRecord& rec = addName(parent, name, nameLength);
+
+			rec.assign(sb);
+
+			return rec;
+		}
+
+		/**
+		 * \brief Adds a copy of the specified record to the chunk (e.g. a record of a previous snapshot). Make sure the
+		 * chunk is not full first.
+		 * \param parent Id of the parent directory of the entry
+		 * \param name Name of the entry (or full path, if parent is \ref NO_PARENT_DIRECTORY)
+		 * \return The added record
+		 */
+		inline StatRecord& add(const StatRecord& source, u_int32_t parent, const char* name, size_t nameLength)
+		{
+			StatRecord& rec = m_Records[m_Count];
+
+			rec = source;
+
+			return addName(parent, name, nameLength);
+		}
+
+		/**
+		 * \brief Returns the record at the specified index
+		 */
+		inline const StatRecord& operator[](size_t i) const
+		{
+			return m_Records[i];
+		}
+
+		/**
+		 * \brief Returns the name of the specified record of this chunk. It is not NUL-terminated.
+		 */
+		inline const char* getName(const StatRecord& rec) const
+		{
+			return &m_Names[rec.nameOffset];
+		}
+
+		/**
+		 * \brief Returns the number of records in the chunk
+		 */
+		inline size_t size() const
+		{
+			return m_Count;
+		}
+
+		inline bool isEmpty() const
+		{
+			return m_Count == 0;
+		}
+
+		inline bool isFull() const
+		{
+			return m_Count == m_Records.size();
+		}
+
+		/**
+		 * \brief Empties the chunk, keeping its memory for reuse
+		 */
+		inline void clear()
+		{
+			m_Count = 0;
+			m_NamesLength = 0;
+		}
+	};
+
+	/**
+	 * \brief Owns all the record chunks, and recycles them through a free list so that the steady state of a walk
+	 * does not allocate. The number of chunks can be capped, in which case acquiring one blocks, once they are all
+	 * allocated, until another one is released: this is what holds the walker threads back when the flush threads
+	 * cannot keep up. All the methods are thread-safe.
+	 */
+	class RecordChunkPool
+	{
+		std::vector<std::unique_ptr<RecordChunk>> m_Chunks; //!< All the chunks ever allocated
+		std::mutex m_Mutex; //!< Guards \ref m_Chunks
+		BlockingQueue<RecordChunk*> m_FreeChunks; //!< The chunks available for reuse
+		size_t m_ChunkSize; //!< Capacity of each chunk
+		std::atomic<size_t> m_MaxChunks; //!< Maximum number of chunks allocated, or 0 for no limit
+
+	public:
+
+		/**
+		 * \brief Creates a pool of chunks of the specified capacity
+		 */
+		RecordChunkPool(size_t chunkSize = RECORD_CHUNK_SIZE)
+		{
+			m_ChunkSize = chunkSize;
+			m_MaxChunks = 0;
+		}
+
+		/**
+		 * \brief Gets an empty chunk, from the free list if possible, without blocking
+		 * \return True if a chunk is stored in chunk, false if all the chunks allowed are allocated and in use
+		 */
+		bool tryAcquire(RecordChunk*& chunk)
+		{
+			if (m_FreeChunks.tryPop(chunk))
+			{
+				return true;
+			}
+
+			std::unique_lock<std::mutex> lock(m_Mutex);
+
+			if (m_MaxChunks > 0 && m_Chunks.size() >= m_MaxChunks)
+			{
+				return false;
+			}
+
+			m_Chunks.push_back(std::unique_ptr<RecordChunk>(new RecordChunk(m_ChunkSize)));
+			chunk = m_Chunks.back().get();
+
+			return true;
+		}
+
+		/**
+		 * \brief Gets an empty chunk, from the free list if possible, blocking until one is released if all the chunks
+		 * allowed are allocated and in use
+		 */
+		RecordChunk* acquire()
+		{
+			RecordChunk* chunk;
+
+			if (!tryAcquire(chunk))
+			{
+				m_FreeChunks.pop(chunk);
+			}
+
+			return chunk;
+		}
+
+		/**
+		 * \brief Clears the specified chunk and returns it to the free list
+		 */
+		void release(RecordChunk* chunk)
+		{
+			chunk->clear();
+			m_FreeChunks.push(chunk);
+		}
+
+		/**
+		 * \brief Caps the number of chunks allocated, or lifts the cap if 0. Lowering the cap does not free the chunks
+		 * allocated already, but no more are allocated until their number drops under it. The cap must leave at least
+		 * one chunk more than the threads that hold one at any time, so that they do not all wait for each other.
+		 */
+		void setMaxChunks(size_t maxChunks)
+		{
+			m_MaxChunks = maxChunks;
+		}
+
+		/**
+		 * \brief Returns the maximum number of chunks allocated, or 0 if there is no limit
+		 */
+		size_t getMaxChunks() const
+		{
+			return m_MaxChunks;
+		}
+
+		/**
+		 * \brief Returns the number of chunks allocated so far
+		 */
+		size_t getAllocatedCount()
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+
+			return m_Chunks.size();
+		}
+
+		/**
+		 * \brief Returns the approximate number of bytes of each chunk: its records, and its names arena as allocated
+		 * upfront (longer names grow it)
+		 */
+		size_t getChunkBytes() const
+		{
+			return sizeof(RecordChunk) + m_ChunkSize * (sizeof(StatRecord) + 32);
+		}
+	};
+}
+
+#endif	/* RECORDCHUNK_HPP */
@@ -0,0 +1,575 @@
+#ifndef RECORDFILTER_HPP
+#define	RECORDFILTER_HPP
+
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <ctime>
+#include <strings.h>
+#include <pwd.h>
+#include <grp.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "RecordChunk.hpp"
+#include "StatBackend.hpp"
+
+namespace pstat
+{
+	/**
+	 * \brief Selects the stat records to be output, according to an expression such as
+	 * <tt>type==FILE && size>1G && atime<-180d</tt>.
+	 * An expression is made of comparisons between a field and a value (==, !=, <, <=, > and >=), combined with &&, ||,
+	 * ! and parentheses. The fields are:
+	 * - type: FILE, DIR, LINK, PIPE, SOCK, BDEV or CDEV
+	 * - perm: permission bits, in octal (e.g. 644)
+	 * - size, disk: size and space allocated on disk, in bytes, with an optional K, M, G, T or P (binary) suffix
+	 * - atime, mtime, ctime: a date (YYYY-MM-DD, local midnight), seconds since the epoch, or a time before the
+	 *   construction of the filter: a minus sign, a number and a unit (s, m, h, d, w or y), e.g. -180d
+	 * - user, group: a name or an id; uid and gid: an id
+	 * - links, inode: numbers
+	 *
+	 * The expression is compiled once into a flat program that runs on a single boolean register: each comparison sets
+	 * the register, and && and || become conditional jumps over their right operand, so that evaluation short-circuits
+	 * without a stack. Matching is thread-safe.
+	 */
+	class RecordFilter
+	{
+		/**
+		 * \brief A field of the stat records
+		 */
+		enum Field
+		{
+			FIELD_TYPE,
+			FIELD_PERM,
+			FIELD_SIZE,
+			FIELD_DISK,
+			FIELD_ATIME,
+			FIELD_MTIME,
+			FIELD_CTIME,
+			FIELD_UID,
+			FIELD_GID,
+			FIELD_LINKS,
+			FIELD_INODE
+		};
+
+		/**
+		 * \brief An instruction of the compiled program
+		 */
+		enum Opcode
+		{
+			OP_EQ, //!< Sets the register to field == value
+			OP_NE, //!< Sets the register to field != value
+			OP_LT, //!< Sets the register to field < value
+			OP_LE, //!< Sets the register to field <= value
+			OP_GT, //!< Sets the register to field > value
+			OP_GE, //!< Sets the register to field >= value
+			OP_NOT, //!< Negates the register
+			OP_JUMP_IF_FALSE, //!< Jumps to target if the register is false
+			OP_JUMP_IF_TRUE //!< Jumps to target if the register is true
+		};
+
+		/**
+		 * \brief An instruction and its operands
+		 */
+		struct Instruction
+		{
+			u_int8_t opcode; //!< The \ref Opcode
+			u_int8_t field; //!< The compared \ref Field
+			u_int32_t target; //!< Index of the instruction jumped to
+			int64_t value; //!< The value the field is compared to
+		};
+
+		/**
+		 * \brief The name of a field, along with the stat fields it needs
+		 */
+		struct FieldName
+		{
+			const char* name; //!< Name of the field in expressions
+			Field field; //!< The field
+			unsigned int statFields; //!< The \ref StatField flags it is computed from
+		};
+
+		std::vector<Instruction> m_Program; //!< The compiled expression. Empty to match every record
+		unsigned int m_StatFields; //!< The \ref StatField flags of the fields the expression uses
+		int64_t m_Now; //!< The time relative times are measured from
+		std::string m_Error; //!< Describes the last compilation error
+		const char* m_Cursor; //!< Position of the parser within the compiled expression
+
+		RecordFilter(const RecordFilter&);
+		RecordFilter& operator=(const RecordFilter&);
+
+		/**
+		 * \brief Returns the value of the specified field of the specified record
+		 */
+		static inline int64_t getField(const StatRecord& rec, u_int8_t field)
+		{
+			switch (field)
+			{
+				case FIELD_TYPE: return rec.mode & S_IFMT;
+				case FIELD_PERM: return rec.mode & 07777;
+				case FIELD_SIZE: return rec.size;
+				case FIELD_DISK: return rec.blocks * 512;
+				case FIELD_ATIME: return rec.atime;
+				case FIELD_MTIME: return rec.mtime;
+				case FIELD_CTIME: return rec.ctime;
+				case FIELD_UID: return rec.uid;
+				case FIELD_GID: return rec.gid;
+				case FIELD_LINKS: return rec.nlink;
+				default: return rec.ino;
+			}
+		}
+
+		/**
+		 * \brief Sets the error message and returns false
+		 */
+		bool fail(const std::string& error)
+		{
+			m_Error = error;
+			return false;
+		}
+
+		/**
+		 * \brief Skips the whitespace at \ref m_Cursor
+		 */
+		void skipSpaces()
+		{
+			while (*m_Cursor == ' ' || *m_Cursor == '\t')
+			{
+				m_Cursor++;
+			}
+		}
+
+		/**
+		 * \brief Consumes the specified token if it is next
+		 * \return True if the token is consumed
+		 */
+		bool accept(const char* token)
+		{
+			skipSpaces();
+
+			size_t length = strlen(token);
+
+			if (strncmp(m_Cursor, token, length) != 0)
+			{
+				return false;
+			}
+
+			m_Cursor += length;
+
+			return true;
+		}
+
+		/**
+		 * \brief Adds an instruction to the program
+		 * \return Its index
+		 */
+		u_int32_t emit(Opcode opcode, u_int8_t field = 0, int64_t value = 0)
+		{
+			Instruction instruction = {static_cast<u_int8_t>(opcode), field, 0, value};
+
+			m_Program.push_back(instruction);
+
+			return m_Program.size() - 1;
+		}
+
+		/**
+		 * \brief Compiles operands separated by the specified operator, which short-circuits with the specified jump
+		 * \param parseOperand Compiles an operand
+		 */
+		bool parseSequence(const char* token, Opcode jump, bool (RecordFilter::*parseOperand)())
+		{
+			if (!(this->*parseOperand)())
+			{
+				return false;
+			}
+
+			while (accept(token))
+			{
+				u_int32_t instruction = emit(jump);
+
+				if (!(this->*parseOperand)())
+				{
+					return false;
+				}
+
+				m_Program[instruction].target = m_Program.size();
+			}
+
+			return true;
+		}
+
+		/**
+		 * \brief Compiles a sequence of conjunctions separated by ||
+		 */
+		bool parseOr()
+		{
+			return parseSequence("||", OP_JUMP_IF_TRUE, &RecordFilter::parseAnd);
+		}
+
+		/**
+		 * \brief Compiles a sequence of operands separated by &&
+		 */
+		bool parseAnd()
+		{
+			return parseSequence("&&", OP_JUMP_IF_FALSE, &RecordFilter::parseUnary);
+		}
+
+		/**
+		 * \brief Compiles a negation, a parenthesized expression or a comparison
+		 */
+		bool parseUnary()
+		{
+			if (accept("!"))
+			{
+				if (!parseUnary())
+				{
+					return false;
+				}
+
+				emit(OP_NOT);
+
+				return true;
+			}
+
+			if (accept("("))
+			{
+				if (!parseOr())
+				{
+					return false;
+				}
+
+				return accept(")") || fail("missing ) at: " + std::string(m_Cursor));
+			}
+
+			return parseComparison();
+		}
+
+		/**
+		 * \brief Compiles a comparison between a field and a value
+		 */
+		bool parseComparison()
+		{
+			static const FieldName fields[] = {
+				{"type", FIELD_TYPE, STAT_FIELD_MODE}, {"perm", FIELD_PERM, STAT_FIELD_MODE},
+				{"size", FIELD_SIZE, STAT_FIELD_SIZE}, {"disk", FIELD_DISK, STAT_FIELD_BLOCKS},
+				{"atime", FIELD_ATIME, STAT_FIELD_ATIME}, {"mtime", FIELD_MTIME, STAT_FIELD_MTIME},
+				{"ctime", FIELD_CTIME, STAT_FIELD_CTIME}, {"user", FIELD_UID, STAT_FIELD_UID},
+				{"uid", FIELD_UID, STAT_FIELD_UID}, {"group", FIELD_GID, STAT_FIELD_GID}, {"gid", FIELD_GID, STAT_FIELD_GID},
+				{"links", FIELD_LINKS, STAT_FIELD_NLINK}, {"inode", FIELD_INODE, 0}
+			};
+			static const char* operators[] = {"==", "!=", "<=", "<", ">=", ">", "="};
+			static const Opcode opcodes[] = {OP_EQ, OP_NE, OP_LE, OP_LT, OP_GE, OP_GT, OP_EQ};
+
+			skipSpaces();
+
+			const char* start = m_Cursor;
+
+			while (isalpha(*m_Cursor))
+			{
+				m_Cursor++;
+			}
+
+			std::string name(start, m_Cursor - start);
+			const FieldName* field = NULL;
+
+			for (const FieldName& f : fields)
+			{
+				if (name == f.name)
+				{
+					field = &f;
+				}
+			}
+
+			if (field == NULL)
+			{
+				return fail(name.empty() ? "expected a field at: " + std::string(start) : "unknown field: " + name);
+			}
+
+			size_t op = 0;
+
+			while (op < sizeof(operators) / sizeof(operators[0]) && !accept(operators[op]))
+			{
+				op++;
+			}
+
+			if (op == sizeof(operators) / sizeof(operators[0]))
+			{
+				return fail("expected a comparison after " + name + " at: " + std::string(m_Cursor));
+			}
+
+			skipSpaces();
+			start = m_Cursor;
+
+			while (*m_Cursor != '\0' && strchr(" \t()&|!<>=", *m_Cursor) == NULL)
+			{
+				m_Cursor++;
+			}
+
+			std::string text(start, m_Cursor - start);
+			int64_t value;
+
+			if (!parseValue(field->field, name, text, value))
+			{
+				return false;
+			}
+
+			emit(opcodes[op], field->field, value);
+			m_StatFields |= field->statFields;
+
+			return true;
+		}
+
+		/**
+		 * \brief Parses the specified value of the specified field
+		 * \param name Name of the field, as written in the expression
+		 */
+		bool parseValue(Field field, const std::string& name, const std::string& text, int64_t& value)
+		{
+			static const char* types[] = {"FILE", "DIR", "LINK", "PIPE", "SOCK", "BDEV", "CDEV"};
+			static const int64_t typeModes[] = {S_IFREG, S_IFDIR, S_IFLNK, S_IFIFO, S_IFSOCK, S_IFBLK, S_IFCHR};
+			char* end;
+
+			if (text.empty())
+			{
+				return fail("expected a value after " + name + " at: " + std::string(m_Cursor));
+			}
+
+			switch (field)
+			{
+				case FIELD_TYPE:
+					for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++)
+					{
+						if (strcasecmp(text.c_str(), types[i]) == 0)
+						{
+							value = typeModes[i];
+							return true;
+						}
+					}
+
+					return fail("unknown file type: " + text);
+
+				case FIELD_PERM:
+					value = strtoll(text.c_str(), &end, 8);
+					return *end == '\0' || fail("bad permissions: " + text);
+
+				case FIELD_SIZE:
+				case FIELD_DISK:
+					return parseSize(text, value);
+
+				case FIELD_ATIME:
+				case FIELD_MTIME:
+				case FIELD_CTIME:
+					return parseTime(text, value);
+
+				case FIELD_UID:
+				case FIELD_GID:
+					value = strtoll(text.c_str(), &end, 10);
+
+					if (*end == '\0')
+					{
+						return true;
+					}
+
+					if (name == "user")
+					{
+						struct passwd* pwd = getpwnam(text.c_str());
+
+						if (pwd != NULL)
+						{
+							value = pwd->pw_uid;
+							return true;
+						}
+					}
+					else if (name == "group")
+					{
+						struct group* grp = getgrnam(text.c_str());
+
+						if (grp != NULL)
+						{
+							value = grp->gr_gid;
+							return true;
+						}
+					}
+
+					return fail("unknown " + name + ": " + text);
+
+				default:
+					value = strtoll(text.c_str(), &end, 10);
+					return *end == '\0' || fail("bad number: " + text);
+			}
+		}
+
+		/**
+		 * \brief Parses a size in bytes, with an optional K, M, G, T or P suffix (powers of 1024)
+		 */
+		bool parseSize(const std::string& text, int64_t& value)
+		{
+			static const char units[] = "KMGTP";
+			char* end;
+
+			value = strtoll(text.c_str(), &end, 10);
+
+			if (*end != '\0')
+			{
+				const char* unit = strchr(units, toupper(*end));
+
+				if (unit == NULL || end[1] != '\0')
+				{
+					return fail("bad size: " + text);
+				}
+
+				value <<= 10 * (unit - units + 1);
+			}
+
+			return true;
+		}
+
+		/**
+		 * \brief Parses a time: a date (YYYY-MM-DD), seconds since the epoch, or a time before \ref m_Now such as -180d
+		 */
+		bool parseTime(const std::string& text, int64_t& value)
+		{
+			static const char units[] = "smhdwy";
+			static const int64_t seconds[] = {1, 60, 3600, 86400, 7 * 86400, 365 * 86400};
+			struct tm date;
+			char* end;
+
+			memset(&date, 0, sizeof(date));
+
+			if (strptime(text.c_str(), "%Y-%m-%d", &date) == text.c_str() + text.size())
+			{
+				date.tm_isdst = -1;
+				value = mktime(&date);
+				return true;
+			}
+
+			value = strtoll(text.c_str(), &end, 10);
+
+			if (*end == '\0')
+			{
+				return true;
+			}
+
+			const char* unit = strchr(units, *end);
+
+			if (text[0] != '-' || unit == NULL || *unit == '\0' || end[1] != '\0')
+			{
+				return fail("bad time: " + text);
+			}
+
+			value = m_Now + value * seconds[unit - units];
+
+			return true;
+		}
+
+	public:
+
+		/**
+		 * \brief Creates a filter that matches every record. Relative times will be measured from now.
+		 */
+		RecordFilter()
+		{
+			m_StatFields = 0;
+			m_Now = time(NULL);
+			m_Cursor = NULL;
+		}
+
+		/**
+		 * \brief Compiles the specified expression, replacing the current one
+		 * \return True on success, false otherwise (see \ref getError())
+		 */
+		bool compile(const std::string& expression)
+		{
+			m_Program.clear();
+			m_StatFields = 0;
+			m_Cursor = expression.c_str();
+
+			if (!parseOr())
+			{
+				m_Program.clear();
+				return false;
+			}
+
+			skipSpaces();
+
+			if (*m_Cursor != '\0')
+			{
+				m_Program.clear();
+				return fail("unexpected text at: " + std::string(m_Cursor));
+			}
+
+			return true;
+		}
+
+		/**
+		 * \brief Returns true if the specified record matches the expression
+		 */
+		inline bool match(const StatRecord& rec) const
+		{
+			const Instruction* program = m_Program.data();
+			size_t size = m_Program.size();
+			bool result = true;
+
+			for (size_t pc = 0; pc < size; pc++)
+			{
+				const Instruction& i = program[pc];
+
+				switch (i.opcode)
+				{
+					case OP_EQ: result = getField(rec, i.field) == i.value; break;
+					case OP_NE: result = getField(rec, i.field) != i.value; break;
+					case OP_LT: result = getField(rec, i.field) < i.value; break;
+					case OP_LE: result = getField(rec, i.field) <= i.value; break;
+					case OP_GT: result = getField(rec, i.field) > i.value; break;
+					case OP_GE: result = getField(rec, i.field) >= i.value; break;
+					case OP_NOT: result = !result; break;
+					case OP_JUMP_IF_FALSE: pc = result ? pc : i.target - 1; break;
+					case OP_JUMP_IF_TRUE: pc = result ? i.target - 1 : pc; break;
+				}
+			}
+
+			return result;
+		}
+
+		/**
+		 * \brief Same as \ref match(const StatRecord&) const, from a stat record
+		 */
+		inline bool match(const struct stat& sb) const
+		{
+			StatRecord rec;
+
+			rec.assign(sb);
+
+			return match(rec);
+		}
+
+		/**
+		 * \brief Returns true if the filter matches every record
+		 */
+		bool isEmpty() const
+		{
+			return m_Program.empty();
+		}
+
+		/**
+		 * \brief Returns the \ref StatField flags of the fields the expression compares
+		 */
+		unsigned int getStatFields() const
+		{
+			return m_StatFields;
+		}
+
+		/**
+		 * \brief Returns the description of the last compilation error
+		 */
+		const std::string& getError() const
+		{
+			return m_Error;
+		}
+	};
+}
+
+#endif	/* RECORDFILTER_HPP */
@@ -0,0 +1,79 @@
+#ifndef RECORDWRITER_HPP
+#define	RECORDWRITER_HPP
+
+#include <string>
+
+#include "RecordChunk.hpp"
+
+namespace pstat
+{
+	/**
+	 * \brief The output formats the stat records can be written in
+	 */
+	enum OutputFormat
+	{
+		OUTPUT_FORMAT_CSV, //!< One CSV line per record, see \ref CsvWriter
+		OUTPUT_FORMAT_COLUMNAR, //!< Binary row groups of little-endian columns, see \ref ColumnarWriter
+		OUTPUT_FORMAT_AGGREGATE //!< No records, only summary tables of the whole collection, see \ref Aggregator
+	};
+
+	/**
+	 * \brief Writes stat records to a file in some output format. Records are handed over a chunk at a time, so that
+	 * each implementation runs its own per-record loop without a virtual call per record.
+	 * Not thread-safe: each instance must be used by one thread at a time.
+	 */
+	class RecordWriter
+	{
+	public:
+
+		/**
+		 * \brief Creates (or truncates) the specified file and writes to it
+		 * \return True on success, false otherwise (see \ref getError())
+		 */
+		virtual bool open(const std::string& path) = 0;
+
+		/**
+		 * \brief Reopens the specified file, made durable up to the specified offset by a previous writer (see
+		 * \ref sync()). The file is truncated at the offset, and the next records are appended to it. The header
+		 * must not be written again.
+		 * \return True on success, false otherwise (see \ref getError())
+		 */
+		virtual bool reopen(const std::string& path, u_int64_t offset) = 0;
+
+		/**
+		 * \brief Writes whatever precedes the records in the file (e.g. a header line)
+		 */
+		virtual void writeHeader() = 0;
+
+		/**
+		 * \brief Writes all the records of the specified chunk
+		 * \param paths Resolves the parent directories of the records to their paths
+		 */
+		virtual void writeChunk(const RecordChunk& chunk, DirectoryPathCache& paths) = 0;
+
+		/**
+		 * \brief Writes all the records handed over so far to the file, and flushes the file to disk. The file can then
+		 * be reopened at the returned offset, should the collection be interrupted later.
+		 * \param offset Receives the size of the file, which holds these records and nothing else
+		 * \return True on success, false if any write failed
+		 */
+		virtual bool sync(u_int64_t& offset) = 0;
+
+		/**
+		 * \brief Flushes the buffered records and closes the file, if open
+		 * \return True on success, false if any write failed
+		 */
+		virtual bool close() = 0;
+
+		/**
+		 * \brief Returns the errno of the first failed open or write, or 0 if none failed
+		 */
+		virtual int getError() const = 0;
+
+		virtual ~RecordWriter()
+		{
+		}
+	};
+}
+
+#endif	/* RECORDWRITER_HPP */
@@ -0,0 +1,299 @@
+#ifndef SNAPSHOTDIFF_HPP
+#define	SNAPSHOTDIFF_HPP
+
+#include <vector>
+#include <string>
+#include <cstring>
+
+#include "SnapshotSorter.hpp"
+#include "CsvWriter.hpp"
+
+namespace pstat
+{
+	/**
+	 * \brief Finds the entries added, removed and modified between two snapshots, by merge-joining their sorted entries
+	 * (see \ref SnapshotSorter), so that only the current entry of each side is held in memory. The changes are written
+	 * as CSV lines: CHANGE,FIELD,OLD,NEW,PATH. An added or removed entry takes one line, with empty FIELD, OLD and NEW.
+	 * A modified entry takes one line per changed field, with its old and new values (raw, as in the snapshots).
+	 *
+	 * Joined by path, a file replaced by another one is modified (its inode changes). Joined by inode, the path is
+	 * compared as a field, so moved entries are found, and the links of an inode are matched by path first, then in
+	 * order. An inode freed then reused by another entry between the snapshots is reported as modified.
+	 * Not thread-safe: each instance must be used by one thread at a time.
+	 */
+	class SnapshotDiff
+	{
+		SnapshotKey m_Key; //!< What identifies an entry across the snapshots
+		CsvWriter m_Output; //!< The output file
+		u_int64_t m_Added; //!< Number of entries added
+		u_int64_t m_Removed; //!< Number of entries removed
+		u_int64_t m_Modified; //!< Number of entries modified
+		u_int64_t m_Unchanged; //!< Number of entries unchanged
+		std::string m_Error; //!< Describes the first error
+		std::vector<SnapshotEntry> m_OldLinks; //!< With \ref SNAPSHOT_KEY_INODE, the old entries of the current inode
+		std::vector<SnapshotEntry> m_NewLinks; //!< With \ref SNAPSHOT_KEY_INODE, the new entries of the current inode
+
+		SnapshotDiff(const SnapshotDiff&);
+		SnapshotDiff& operator=(const SnapshotDiff&);
+
+		/**
+		 * \brief Writes an added or removed entry
+		 */
+		void writeChange(const char* change, const SnapshotEntry& entry)
+		{
+			m_Output.write(change);
+			m_Output.write(",,,,");
+			m_Output.writeQuoted(entry.path);
+			m_Output.write("\n");
+		}
+
+		/**
+		 * \brief Writes the specified value of the specified column
+		 */
+		void writeValue(int column, u_int64_t value)
+		{
+			if (ColumnarFormat::isColumnSigned(column))
+			{
+				m_Output.writeSigned(static_cast<int64_t>(value));
+			}
+			else
+			{
+				m_Output.writeUnsigned(value);
+			}
+		}
+
+		/**
+		 * \brief Compares the fields of the specified entries, which are the same entry in both snapshots, and writes the
+		 * changed ones
+		 */
+		void compareEntries(const SnapshotEntry& oldEntry, const SnapshotEntry& newEntry)
+		{
+			bool modified = false;
+
+			if (m_Key == SNAPSHOT_KEY_INODE && oldEntry.path != newEntry.path)
+			{
+				m_Output.write("modified,path,");
+				m_Output.writeQuoted(oldEntry.path);
+				m_Output.write(",");
+				m_Output.writeQuoted(newEntry.path);
+				m_Output.write(",");
+				m_Output.writeQuoted(newEntry.path);
+				m_Output.write("\n");
+				modified = true;
+			}
+
+			// Which link of an inode carries its space on disk depends on the traversal order, so the flags are not compared
+			for (int c = 0; c < COLUMN_FLAGS; c++)
+			{
+				if (oldEntry.values[c] == newEntry.values[c])
+				{
+					continue;
+				}
+
+				m_Output.write("modified,");
+				m_Output.write(ColumnarFormat::getColumnName(c));
+				m_Output.write(",");
+				writeValue(c, oldEntry.values[c]);
+				m_Output.write(",");
+				writeValue(c, newEntry.values[c]);
+				m_Output.write(",");
+				m_Output.writeQuoted(newEntry.path);
+				m_Output.write("\n");
+				modified = true;
+			}
+
+			if (modified)
+			{
+				m_Modified++;
+			}
+			else
+			{
+				m_Unchanged++;
+			}
+		}
+
+		/**
+		 * \brief Joins the links of the current inode, \ref m_OldLinks and \ref m_NewLinks, each sorted by path: the
+		 * links found at the same path on both sides first, then the others in order. The links left on either side are
+		 * removed or added.
+		 */
+		void joinLinks()
+		{
+			std::vector<const SnapshotEntry*> oldLeft;
+			std::vector<const SnapshotEntry*> newLeft;
+			size_t i = 0;
+			size_t j = 0;
+
+			while (i < m_OldLinks.size() || j < m_NewLinks.size())
+			{
+				int c = i == m_OldLinks.size() ? 1 : j == m_NewLinks.size() ? -1 : m_OldLinks[i].path.compare(m_NewLinks[j].path);
+
+				if (c == 0)
+				{
+					compareEntries(m_OldLinks[i++], m_NewLinks[j++]);
+				}
+				else if (c < 0)
+				{
+					oldLeft.push_back(&m_OldLinks[i++]);
+				}
+				else
+				{
+					newLeft.push_back(&m_NewLinks[j++]);
+				}
+			}
+
+			for (size_t k = 0; k < oldLeft.size() || k < newLeft.size(); k++)
+			{
+				if (k >= newLeft.size())
+				{
+					writeChange("removed", *oldLeft[k]);
+					m_Removed++;
+				}
+				else if (k >= oldLeft.size())
+				{
+					writeChange("added", *newLeft[k]);
+					m_Added++;
+				}
+				else
+				{
+					compareEntries(*oldLeft[k], *newLeft[k]);
+				}
+			}
+		}
+
+		/**
+		 * \brief Moves all the entries of the inode of the specified entry, starting with it, from the specified sorter
+		 * to the specified links
+		 * \return The first entry of the next inode, or NULL if there is none
+		 */
+		static const SnapshotEntry* readLinks(SnapshotSorter& sorter, const SnapshotEntry* entry, std::vector<SnapshotEntry>& links)
+		{
+			links.clear();
+			links.push_back(*entry);
+
+			while ((entry = sorter.next()) != NULL && SnapshotEntry::compareInodes(entry->values, links[0].values) == 0)
+			{
+				links.push_back(*entry);
+			}
+
+			return entry;
+		}
+
+	public:
+
+		/**
+		 * \brief Creates a diff of two snapshots
+		 * \param key What identifies an entry across the snapshots. Both snapshots must be sorted in this order
+		 * \param compressThreads Set to the number of compressor threads to write a gzip file, or 0 to write a plain one
+		 */
+		SnapshotDiff(SnapshotKey key, int compressThreads = 0)
+				: m_Key(key), m_Output(false, compressThreads), m_Added(0), m_Removed(0), m_Modified(0), m_Unchanged(0)
+		{
+		}
+
+		/**
+		 * \brief Writes the changes between the specified snapshots, both sorted already, to the specified file
+		 * \return True on success, false otherwise (see \ref getError())
+		 */
+		bool write(SnapshotSorter& oldSnapshot, SnapshotSorter& newSnapshot, const std::string& outputPath)
+		{
+			if (!m_Output.open(outputPath))
+			{
+				m_Error = std::string("cannot open the output file: ") + strerror(m_Output.getError());
+				return false;
+			}
+
+			m_Output.write("CHANGE,FIELD,OLD,NEW,PATH\n");
+
+			const SnapshotEntry* oldEntry = oldSnapshot.next();
+			const SnapshotEntry* newEntry = newSnapshot.next();
+
+			while (oldEntry != NULL || newEntry != NULL)
+			{
+				int c = oldEntry == NULL ? 1 : newEntry == NULL ? -1 : m_Key == SNAPSHOT_KEY_INODE
+						? SnapshotEntry::compareInodes(oldEntry->values, newEntry->values) : oldEntry->compare(*newEntry, m_Key);
+
+				if (c < 0)
+				{
+					writeChange("removed", *oldEntry);
+					m_Removed++;
+					oldEntry = oldSnapshot.next();
+				}
+				else if (c > 0)
+				{
+					writeChange("added", *newEntry);
+					m_Added++;
+					newEntry = newSnapshot.next();
+				}
+				else if (m_Key == SNAPSHOT_KEY_PATH)
+				{
+					compareEntries(*oldEntry, *newEntry);
+					oldEntry = oldSnapshot.next();
+					newEntry = newSnapshot.next();
+				}
+				else
+				{
+					oldEntry = readLinks(oldSnapshot, oldEntry, m_OldLinks);
+					newEntry = readLinks(newSnapshot, newEntry, m_NewLinks);
+					joinLinks();
+				}
+			}
+
+			if (!m_Output.close())
+			{
+				m_Error = std::string("cannot write the output file: ") + strerror(m_Output.getError());
+				return false;
+			}
+
+			if (!oldSnapshot.getError().empty() || !newSnapshot.getError().empty())
+			{
+				m_Error = !oldSnapshot.getError().empty() ? oldSnapshot.getError() : newSnapshot.getError();
+				return false;
+			}
+
+			return true;
+		}
+
+		/**
+		 * \brief Returns the number of entries added
+		 */
+		u_int64_t getAddedCount() const
+		{
+			return m_Added;
+		}
+
+		/**
+		 * \brief Returns the number of entries removed
+		 */
+		u_int64_t getRemovedCount() const
+		{
+			return m_Removed;
+		}
+
+		/**
+		 * \brief Returns the number of entries modified
+		 */
+		u_int64_t getModifiedCount() const
+		{
+			return m_Modified;
+		}
+
+		/**
+		 * \brief Returns the number of entries unchanged
+		 */
+		u_int64_t getUnchangedCount() const
+		{
+			return m_Unchanged;
+		}
+
+		/**
+		 * \brief Returns a description of the first error, or an empty string
+		 */
+		const std::string& getError() const
+		{
+			return m_Error;
+		}
+	};
+}
+
+#endif	/* SNAPSHOTDIFF_HPP */
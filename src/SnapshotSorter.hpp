@@ -0,0 +1,686 @@
+#ifndef SNAPSHOTSORTER_HPP
+#define	SNAPSHOTSORTER_HPP
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "ColumnarReader.hpp"
+
+#define SNAPSHOT_SORT_DEFAULT_MEMORY 1024 //!< Default memory budget, in MB, of the two sorts of a snapshot diff
+#define SNAPSHOT_RUN_BUFFER_SIZE (1 << 20) //!< Size of the write buffer of a run being spilled, and of the read buffer of each spilled run while merging
+#define SNAPSHOT_RUN_ENTRY_OVERHEAD ((2 + COLUMN_COUNT) * ColumnarFormat::MAX_VARINT_SIZE) //!< Maximum size of an entry of a spilled run, besides the unshared part of its path
+
+namespace pstat
+{
+	/**
+	 * \brief What identifies an entry across two snapshots
+	 */
+	enum SnapshotKey
+	{
+		SNAPSHOT_KEY_PATH, //!< The path of the entry
+		SNAPSHOT_KEY_INODE //!< The device and inode numbers of the entry, so that an entry that moved is matched with itself
+	};
+
+	/**
+	 * \brief An entry of a snapshot: its path and the values of its columns
+	 */
+	struct SnapshotEntry
+	{
+		std::string path; //!< Full path
+		u_int64_t values[COLUMN_COUNT]; //!< Values of the columns, in \ref ColumnarColumn order. Signed values hold their bits
+
+		/**
+		 * \brief Compares two entries, given by their values and paths, in the order of the specified key: by path, or by
+		 * device number, inode number then path
+		 * \return A negative value, zero or a positive value if the first entry comes before, along with or after the other one
+		 */
+		static inline int compare(SnapshotKey key, const u_int64_t* values, const char* path, size_t length,
+				const u_int64_t* otherValues, const char* otherPath, size_t otherLength)
+		{
+			if (key == SNAPSHOT_KEY_INODE)
+			{
+				int c = compareInodes(values, otherValues);
+
+				if (c != 0)
+				{
+					return c;
+				}
+			}
+
+			int c = memcmp(path, otherPath, std::min(length, otherLength));
+
+			return c != 0 ? c : length < otherLength ? -1 : length > otherLength ? 1 : 0;
+		}
+
+		/**
+		 * \brief Compares the device and inode numbers of two entries, given by their values
+		 */
+		static inline int compareInodes(const u_int64_t* values, const u_int64_t* otherValues)
+		{
+			if (values[COLUMN_DEV] != otherValues[COLUMN_DEV])
+			{
+				return values[COLUMN_DEV] < otherValues[COLUMN_DEV] ? -1 : 1;
+			}
+
+			if (values[COLUMN_INO] != otherValues[COLUMN_INO])
+			{
+				return values[COLUMN_INO] < otherValues[COLUMN_INO] ? -1 : 1;
+			}
+
+			return 0;
+		}
+
+		/**
+		 * \brief Compares this entry with the specified one, in the order of the specified key
+		 */
+		inline int compare(const SnapshotEntry& other, SnapshotKey key) const
+		{
+			return compare(key, values, path.data(), path.size(), other.values, other.path.data(), other.path.size());
+		}
+	};
+
+	/**
+	 * \brief Sorts the entries of a columnar snapshot by path, or by inode, within a memory budget, and streams them in
+	 * order. The snapshot's row groups are decoded by several threads at once, each into a buffer of its own. Whenever
+	 * a buffer fills its share of the budget, the thread sorts it and spills it to a temporary file as a sorted run, so
+	 * that the sort of the runs and their writes run in parallel too. The runs (including the last buffers, kept in
+	 * memory) are then merged as the entries are read.
+	 * Spilled runs are written with their paths prefix-compressed and their values as varints, which sorted paths
+	 * compress well. Their files are unlinked as soon as they are created, so they never outlive the process.
+	 * Not thread-safe: each instance must be used by one thread at a time.
+	 */
+	class SnapshotSorter
+	{
+		/**
+		 * \brief An entry of a buffer: the first bytes of its path, for fast comparisons, and where its path and values are
+		 */
+		struct Item
+		{
+			u_int64_t prefix; //!< The first 8 bytes of the path, big-endian and zero-padded, so that they compare as the path does. 0 when sorting by inode
+			u_int64_t offset; //!< Offset of the path in the paths arena of the buffer
+			u_int32_t length; //!< Length of the path
+			u_int32_t index; //!< Index of the entry's values in the values of the buffer
+		};
+
+		/**
+		 * \brief Entries decoded by a thread, sorted once the buffer is full or the snapshot is decoded
+		 */
+		struct Buffer
+		{
+			std::vector<char> paths; //!< The paths arena
+			std::vector<u_int64_t> values; //!< The values of the entries, COLUMN_COUNT per entry
+			std::vector<Item> items; //!< The entries
+
+			/**
+			 * \brief Returns the number of bytes used by the entries of the buffer
+			 */
+			size_t getBytes() const
+			{
+				return paths.size() + values.size() * sizeof(u_int64_t) + items.size() * sizeof(Item);
+			}
+
+			void clear()
+			{
+				paths.clear();
+				values.clear();
+				items.clear();
+			}
+		};
+
+		/**
+		 * \brief A sorted run, either in memory or spilled to a file, read one entry at a time
+		 */
+		struct Run
+		{
+			std::unique_ptr<Buffer> buffer; //!< The entries, if in memory
+			size_t position; //!< Index of the next entry of \ref buffer
+			int fd; //!< The file, if spilled, or -1
+			std::vector<char> data; //!< The read buffer of the file
+			size_t begin; //!< Offset of the next entry in \ref data
+			size_t end; //!< Number of valid bytes in \ref data
+			bool eof; //!< Set once the file is read entirely
+			SnapshotEntry entry; //!< The current entry
+
+			Run() : position(0), fd(-1), begin(0), end(0), eof(false)
+			{
+			}
+
+			~Run()
+			{
+				if (fd >= 0)
+				{
+					close(fd);
+				}
+			}
+		};
+
+		SnapshotKey m_Key; //!< The order of the entries
+		size_t m_MemoryBytes; //!< The memory budget of the sort
+		int m_Threads; //!< Number of threads that decode and sort the snapshot
+		std::string m_TempDir; //!< Directory of the spilled runs
+		std::vector<std::unique_ptr<Run>> m_Runs; //!< The sorted runs
+		std::vector<Run*> m_Heap; //!< The runs not exhausted yet, except \ref m_Current, as a heap whose top holds the least current entry
+		Run* m_Current; //!< The run whose current entry was returned last by \ref next(), or NULL
+		bool m_Merging; //!< Set once the runs are primed for merging
+		u_int64_t m_Records; //!< Number of entries of the snapshot
+		size_t m_SpilledRuns; //!< Number of runs spilled to disk
+		std::mutex m_Mutex; //!< Guards \ref m_Runs, \ref m_SpilledRuns and \ref m_Error while sorting
+		std::string m_Error; //!< Describes the first error
+
+		SnapshotSorter(const SnapshotSorter&);
+		SnapshotSorter& operator=(const SnapshotSorter&);
+
+		/**
+		 * \brief Records the specified error, unless one is recorded already
+		 * \return False
+		 */
+		bool fail(const std::string& error)
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+
+			if (m_Error.empty())
+			{
+				m_Error = error;
+			}
+
+			return false;
+		}
+
+		/**
+		 * \brief Adds the specified record to the specified buffer
+		 */
+		inline void add(Buffer& buffer, const StatRecord& rec, const std::string& path)
+		{
+			Item item;
+			item.prefix = 0;
+			item.offset = buffer.paths.size();
+			item.length = path.size();
+			item.index = buffer.items.size();
+
+			if (m_Key == SNAPSHOT_KEY_PATH)
+			{
+				for (size_t i = 0; i < 8; i++)
+				{
+					item.prefix = (item.prefix << 8) | (i < path.size() ? static_cast<unsigned char>(path[i]) : 0);
+				}
+			}
+
+			buffer.paths.insert(buffer.paths.end(), path.begin(), path.end());
+
+			for (int c = 0; c < COLUMN_COUNT; c++)
+			{
+				buffer.values.push_back(ColumnarFormat::getValue(rec, c));
+			}
+
+			buffer.items.push_back(item);
+		}
+
+		/**
+		 * \brief Sorts the entries of the specified buffer
+		 */
+		void sortBuffer(Buffer& buffer)
+		{
+			const char* paths = buffer.paths.data();
+			const u_int64_t* values = buffer.values.data();
+			SnapshotKey key = m_Key;
+
+			std::sort(buffer.items.begin(), buffer.items.end(), [paths, values, key](const Item& a, const Item& b)
+			{
+				if (a.prefix != b.prefix)
+				{
+					return a.prefix < b.prefix;
+				}
+
+				return SnapshotEntry::compare(key, values + a.index * COLUMN_COUNT, paths + a.offset, a.length,
+						values + b.index * COLUMN_COUNT, paths + b.offset, b.length) < 0;
+			});
+		}
+
+		/**
+		 * \brief Writes all the specified bytes to the specified file
+		 * \return True on success, false otherwise
+		 */
+		static bool writeAll(int fd, const char* data, size_t length)
+		{
+			while (length > 0)
+			{
+				ssize_t written = write(fd, data, length);
+
+				if (written < 0 && errno == EINTR)
+				{
+					continue;
+				}
+
+				if (written <= 0)
+				{
+					return false;
+				}
+
+				data += written;
+				length -= written;
+			}
+
+			return true;
+		}
+
+		/**
+		 * \brief Sorts the specified buffer, and spills it to a new run file
+		 * \return True on success, false otherwise
+		 */
+		bool spill(Buffer& buffer)
+		{
+			sortBuffer(buffer);
+
+			std::string pattern = m_TempDir + "/pstat-sort-XXXXXX";
+			std::vector<char> name(pattern.begin(), pattern.end());
+			name.push_back('\0');
+
+			int fd = mkostemp(&name[0], O_CLOEXEC);
+
+			if (fd < 0)
+			{
+				return fail("cannot create a temporary file in " + m_TempDir + ": " + strerror(errno));
+			}
+
+			// The file is only reached through its descriptor from now on, and goes away with it
+			unlink(&name[0]);
+
+			std::unique_ptr<Run> run(new Run());
+			std::vector<char> out(SNAPSHOT_RUN_BUFFER_SIZE);
+			size_t length = 0;
+			const char* previous = NULL;
+			size_t previousLength = 0;
+
+			run->fd = fd;
+
+			for (const Item& item : buffer.items)
+			{
+				const char* path = &buffer.paths[item.offset];
+				const u_int64_t* values = &buffer.values[item.index * COLUMN_COUNT];
+				size_t shared = 0;
+
+				while (shared < previousLength && shared < item.length && previous[shared] == path[shared])
+				{
+					shared++;
+				}
+
+				size_t needed = SNAPSHOT_RUN_ENTRY_OVERHEAD + item.length - shared;
+
+				if (length + needed > out.size())
+				{
+					if (!writeAll(fd, out.data(), length))
+					{
+						return fail(std::string("cannot write a temporary file: ") + strerror(errno));
+					}
+
+					length = 0;
+					out.resize(std::max(out.size(), needed));
+				}
+
+				char* p = &out[length];
+				p = ColumnarFormat::encodeVarint(p, shared);
+				p = ColumnarFormat::encodeVarint(p, item.length - shared);
+				memcpy(p, path + shared, item.length - shared);
+				p += item.length - shared;
+
+				for (int c = 0; c < COLUMN_COUNT; c++)
+				{
+					p = ColumnarFormat::encodeVarint(p, values[c]);
+				}
+
+				length = p - &out[0];
+				previous = path;
+				previousLength = item.length;
+			}
+
+			if (!writeAll(fd, out.data(), length) || lseek(fd, 0, SEEK_SET) != 0)
+			{
+				return fail(std::string("cannot write a temporary file: ") + strerror(errno));
+			}
+
+			buffer.clear();
+
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_Runs.push_back(std::move(run));
+			m_SpilledRuns++;
+
+			return true;
+		}
+
+		/**
+		 * \brief Decodes the specified row groups, each given as its snapshot (or shard) and its index, taking the next one
+		 * from the specified counter, and spills the buffer whenever it exceeds the specified size. The last buffer is
+		 * sorted and kept in memory.
+		 */
+		void sortThreadWork(const std::vector<std::pair<const ColumnarReader*, size_t>>& groups, std::atomic<size_t>& nextGroup,
+				size_t bufferBytes)
+		{
+			std::unique_ptr<Buffer> buffer(new Buffer());
+			ColumnarReader::RowGroup group;
+
+			for (size_t index = nextGroup++; index < groups.size(); index = nextGroup++)
+			{
+				const ColumnarReader& reader = *groups[index].first;
+
+				if (!reader.getRowGroup(groups[index].second, group) || !reader.forEach(group, [&](const StatRecord& rec, const std::string& path)
+				{
+					add(*buffer, rec, path);
+				}))
+				{
+					fail("corrupted columnar snapshot (bad row group)");
+					return;
+				}
+
+				if (buffer->getBytes() >= bufferBytes && !spill(*buffer))
+				{
+					return;
+				}
+			}
+
+			if (buffer->items.empty())
+			{
+				return;
+			}
+
+			sortBuffer(*buffer);
+
+			std::unique_ptr<Run> run(new Run());
+			run->buffer = std::move(buffer);
+
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_Runs.push_back(std::move(run));
+		}
+
+		/**
+		 * \brief Makes sure that at least the specified number of bytes of the specified spilled run are in its read
+		 * buffer, unless its file ends first
+		 * \return True on success, false if the file cannot be read
+		 */
+		bool fill(Run& run, size_t length)
+		{
+			if (run.end - run.begin >= length || run.eof)
+			{
+				return true;
+			}
+
+			memmove(&run.data[0], &run.data[run.begin], run.end - run.begin);
+			run.end -= run.begin;
+			run.begin = 0;
+
+			if (run.data.size() < length)
+			{
+				run.data.resize(length);
+			}
+
+			while (run.end < run.data.size())
+			{
+				ssize_t bytes = read(run.fd, &run.data[run.end], run.data.size() - run.end);
+
+				if (bytes < 0 && errno == EINTR)
+				{
+					continue;
+				}
+
+				if (bytes < 0)
+				{
+					return fail(std::string("cannot read a temporary file: ") + strerror(errno));
+				}
+
+				if (bytes == 0)
+				{
+					run.eof = true;
+					break;
+				}
+
+				run.end += bytes;
+			}
+
+			return true;
+		}
+
+		/**
+		 * \brief Loads the next entry of the specified run as its current entry
+		 * \return True on success, false if the run is exhausted or cannot be read (see \ref getError())
+		 */
+		bool advance(Run& run)
+		{
+			if (run.buffer)
+			{
+				if (run.position == run.buffer->items.size())
+				{
+					run.buffer.reset();
+					return false;
+				}
+
+				const Item& item = run.buffer->items[run.position++];
+
+				run.entry.path.assign(&run.buffer->paths[item.offset], item.length);
+				memcpy(run.entry.values, &run.buffer->values[item.index * COLUMN_COUNT], sizeof(run.entry.values));
+
+				return true;
+			}
+
+			u_int64_t shared;
+			u_int64_t rest;
+
+			if (!fill(run, 2 * ColumnarFormat::MAX_VARINT_SIZE))
+			{
+				return false;
+			}
+
+			if (run.begin == run.end)
+			{
+				return false;
+			}
+
+			const char* in = &run.data[run.begin];
+			const char* end = &run.data[0] + run.end;
+
+			if ((in = ColumnarFormat::decodeVarint(in, end, shared)) == NULL || (in = ColumnarFormat::decodeVarint(in, end, rest)) == NULL
+					|| shared > run.entry.path.size())
+			{
+				return fail("corrupted temporary file");
+			}
+
+			size_t header = in - &run.data[run.begin];
+
+			if (!fill(run, header + rest + COLUMN_COUNT * ColumnarFormat::MAX_VARINT_SIZE))
+			{
+				return false;
+			}
+
+			in = &run.data[run.begin] + header;
+			end = &run.data[0] + run.end;
+
+			if (rest > static_cast<u_int64_t>(end - in))
+			{
+				return fail("corrupted temporary file");
+			}
+
+			run.entry.path.resize(shared);
+			run.entry.path.append(in, rest);
+			in += rest;
+
+			for (int c = 0; c < COLUMN_COUNT; c++)
+			{
+				if ((in = ColumnarFormat::decodeVarint(in, end, run.entry.values[c])) == NULL)
+				{
+					return fail("corrupted temporary file");
+				}
+			}
+
+			run.begin = in - &run.data[0];
+
+			return true;
+		}
+
+		/**
+		 * \brief Orders the runs in \ref m_Heap, so that the top holds the least current entry
+		 */
+		inline bool isAfter(const Run* a, const Run* b) const
+		{
+			return a->entry.compare(b->entry, m_Key) > 0;
+		}
+
+		/**
+		 * \brief Loads the first entry of every run, and builds the heap of the runs
+		 */
+		void prime()
+		{
+			size_t readBuffer = std::max<size_t>(64 << 10, std::min<size_t>(SNAPSHOT_RUN_BUFFER_SIZE, m_MemoryBytes / (m_Runs.size() + 1)));
+
+			m_Merging = true;
+
+			for (std::unique_ptr<Run>& run : m_Runs)
+			{
+				if (run->fd >= 0)
+				{
+					run->data.resize(readBuffer);
+				}
+
+				if (advance(*run))
+				{
+					m_Heap.push_back(run.get());
+				}
+			}
+
+			std::make_heap(m_Heap.begin(), m_Heap.end(), [this](const Run* a, const Run* b) { return isAfter(a, b); });
+		}
+
+	public:
+
+		/**
+		 * \brief Creates a sorter of the entries of a snapshot
+		 * \param key The order of the entries
+		 * \param memoryBytes The memory budget, shared by the threads while sorting, and by the read buffers of the runs
+		 * while merging
+		 * \param threads Number of threads that decode and sort the snapshot
+		 * \param tempDir Directory where the sorted runs that do not fit in memory are spilled
+		 */
+		SnapshotSorter(SnapshotKey key, size_t memoryBytes, int threads, const std::string& tempDir)
+				: m_Key(key), m_MemoryBytes(memoryBytes), m_Threads(std::max(1, threads)), m_TempDir(tempDir), m_Current(NULL),
+				m_Merging(false), m_Records(0), m_SpilledRuns(0)
+		{
+		}
+
+		/**
+		 * \brief Sorts the entries of the specified columnar snapshot (or of all the shards listed in the specified
+		 * manifest of a sharded one) into runs, to be merged by \ref next()
+		 * \return True on success, false otherwise (see \ref getError())
+		 */
+		bool sort(const std::string& snapshotPath)
+		{
+			std::vector<std::unique_ptr<ColumnarReader>> snapshots;
+			std::vector<std::pair<const ColumnarReader*, size_t>> groups;
+			std::string error;
+
+			if (!ColumnarReader::openShards(snapshotPath, snapshots, error))
+			{
+				return fail(error);
+			}
+
+			for (const std::unique_ptr<ColumnarReader>& snapshot : snapshots)
+			{
+				for (size_t i = 0; i < snapshot->getRowGroupsCount(); i++)
+				{
+					groups.push_back(std::make_pair(snapshot.get(), i));
+				}
+
+				m_Records += snapshot->getRecordsCount();
+			}
+
+			std::atomic<size_t> nextGroup(0);
+			std::vector<std::thread> threads;
+			size_t bufferBytes = m_MemoryBytes / m_Threads;
+
+			for (int i = 0; i < m_Threads; i++)
+			{
+				threads.push_back(std::thread(&SnapshotSorter::sortThreadWork, this, std::cref(groups), std::ref(nextGroup), bufferBytes));
+			}
+
+			for (std::thread& t : threads)
+			{
+				t.join();
+			}
+
+			return m_Error.empty();
+		}
+
+		/**
+		 * \brief Returns the next entry in order. The entry is valid until the next call.
+		 * \return The entry, or NULL once all the entries are returned, or on error (see \ref getError())
+		 */
+		const SnapshotEntry* next()
+		{
+			auto after = [this](const Run* a, const Run* b) { return isAfter(a, b); };
+
+			if (!m_Merging)
+			{
+				prime();
+			}
+
+			if (m_Current != NULL && advance(*m_Current))
+			{
+				m_Heap.push_back(m_Current);
+				std::push_heap(m_Heap.begin(), m_Heap.end(), after);
+			}
+
+			m_Current = NULL;
+
+			if (m_Heap.empty() || !m_Error.empty())
+			{
+				return NULL;
+			}
+
+			std::pop_heap(m_Heap.begin(), m_Heap.end(), after);
+			m_Current = m_Heap.back();
+			m_Heap.pop_back();
+
+			return &m_Current->entry;
+		}
+
+		/**
+		 * \brief Returns the number of entries of the snapshot
+		 */
+		u_int64_t getRecordsCount() const
+		{
+			return m_Records;
+		}
+
+		/**
+		 * \brief Returns the number of sorted runs, spilled or in memory
+		 */
+		size_t getRunsCount() const
+		{
+			return m_Runs.size();
+		}
+
+		/**
+		 * \brief Returns the number of sorted runs spilled to disk
+		 */
+		size_t getSpilledRunsCount() const
+		{
+			return m_SpilledRuns;
+		}
+
+		/**
+		 * \brief Returns a description of the first error, or an empty string
+		 */
+		const std::string& getError() const
+		{
+			return m_Error;
+		}
+	};
+}
+
+#endif	/* SNAPSHOTSORTER_HPP */
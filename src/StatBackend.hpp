@@ -0,0 +1,177 @@
+#ifndef STATBACKEND_HPP
+#define	STATBACKEND_HPP
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/sysmacros.h>
+
+namespace pstat
+{
+	/**
+	 * \brief Flags of the stat fields that consumers of the stat records (e.g. output formats) may need.
+	 * The device id, inode and file type are always collected.
+	 */
+	enum StatField
+	{
+		STAT_FIELD_NLINK = 1 << 0,
+		STAT_FIELD_ATIME = 1 << 1,
+		STAT_FIELD_MTIME = 1 << 2,
+		STAT_FIELD_CTIME = 1 << 3,
+		STAT_FIELD_UID = 1 << 4,
+		STAT_FIELD_GID = 1 << 5,
+		STAT_FIELD_MODE = 1 << 6,
+		STAT_FIELD_SIZE = 1 << 7,
+		STAT_FIELD_BLOCKS = 1 << 8,
+		STAT_FIELD_ALL = (1 << 9) - 1
+	};
+
+	/**
+	 * \brief Stats filesystem entries, either with fstatat() or, when enabled and supported, with statx().
+	 * The statx() backend asks the filesystem only for the fields given to the constructor, which lets
+	 * network filesystems (e.g. NFS, Lustre) skip revalidating attributes nobody is going to output.
+	 * All the methods are thread-safe.
+	 */
+	class StatBackend
+	{
+#ifdef STATX_BASIC_STATS
+		std::atomic<bool> m_UseStatx; //!< Set to false at runtime if the kernel turns out not to support statx()
+		unsigned int m_StatxMask; //!< The STATX_* mask derived from the requested fields
+		int m_StatxFlags; //!< The AT_* flags passed to statx()
+#endif
+
+	public:
+
+		/**
+		 * \brief Creates a stat backend
+       * \param fields A combination of \ref StatField flags that must be filled in the stat records
+       * \param useStatx Set to true to use statx() when it is available
+       * \param dontSync Set to true to pass AT_STATX_DONT_SYNC to statx(), allowing the filesystem to return cached attributes
+       */
+		StatBackend(unsigned int fields = STAT_FIELD_ALL, bool useStatx = false, bool dontSync = false)
+		{
+#ifdef STATX_BASIC_STATS
+			m_UseStatx = useStatx;
+			m_StatxMask = toStatxMask(fields);
+			m_StatxFlags = AT_SYMLINK_NOFOLLOW | (dontSync ? AT_STATX_DONT_SYNC : AT_STATX_SYNC_AS_STAT);
+#else
+			(void) fields;
+			(void) useStatx;
+			(void) dontSync;
+#endif
+		}
+
+		/**
+		 * \brief Returns true if statx() is compiled in and has not been found unsupported by the kernel
+		 */
+		bool isUsingStatx() const
+		{
+#ifdef STATX_BASIC_STATS
+			return m_UseStatx;
+#else
+			return false;
+#endif
+		}
+
+		/**
+		 * \brief Stats the specified entry without following symbolic links.
+		 * Fields that were not requested might be left zeroed when statx() is used.
+       * \param dirfd File descriptor of the directory containing the entry, or AT_FDCWD
+       * \param name Name of the entry relative to dirfd
+       * \param sb Receives the stat record
+       * \return True on success, false otherwise (errno is set)
+       */
+		inline bool stat(int dirfd, const char* name, struct stat& sb)
+		{
+#ifdef STATX_BASIC_STATS
+			if (m_UseStatx)
+			{
+				struct statx stx;
+
+				if (statx(dirfd, name, m_StatxFlags, m_StatxMask, &stx) == 0)
+				{
+					statxToStat(stx, sb);
+					return true;
+				}
+
+				if (errno != ENOSYS)
+				{
+					return false;
+				}
+
+				// Old kernel, fall back to fstatat() for good
+				m_UseStatx = false;
+			}
+#endif
+			return fstatat(dirfd, name, &sb, AT_SYMLINK_NOFOLLOW) == 0;
+		}
+
+#ifdef STATX_BASIC_STATS
+		/**
+		 * \brief Returns the STATX_* mask derived from the requested fields
+		 */
+		inline unsigned int getStatxMask() const
+		{
+			return m_StatxMask;
+		}
+
+		/**
+		 * \brief Returns the AT_* flags to be passed to statx()
+		 */
+		inline int getStatxFlags() const
+		{
+			return m_StatxFlags;
+		}
+
+		/**
+		 * \brief Converts the specified \ref StatField flags to a STATX_* mask
+		 */
+		static unsigned int toStatxMask(unsigned int fields)
+		{
+			static const unsigned int map[][2] = {
+				{STAT_FIELD_NLINK, STATX_NLINK}, {STAT_FIELD_ATIME, STATX_ATIME}, {STAT_FIELD_MTIME, STATX_MTIME},
+				{STAT_FIELD_CTIME, STATX_CTIME}, {STAT_FIELD_UID, STATX_UID}, {STAT_FIELD_GID, STATX_GID},
+				{STAT_FIELD_MODE, STATX_MODE}, {STAT_FIELD_SIZE, STATX_SIZE}, {STAT_FIELD_BLOCKS, STATX_BLOCKS}
+			};
+
+			unsigned int mask = STATX_TYPE | STATX_INO;
+
+			for (const auto& m : map)
+			{
+				if (fields & m[0])
+				{
+					mask |= m[1];
+				}
+			}
+
+			return mask;
+		}
+
+		/**
+		 * \brief Fills the specified stat record from the specified statx record. Fields that were not
+		 * returned by the filesystem are zeroed.
+		 */
+		static void statxToStat(const struct statx& stx, struct stat& sb)
+		{
+			memset(&sb, 0, sizeof(sb));
+			sb.st_dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+			sb.st_ino = stx.stx_ino;
+			sb.st_mode = stx.stx_mode;
+
+			sb.st_nlink = (stx.stx_mask & STATX_NLINK) ? stx.stx_nlink : 0;
+			sb.st_atime = (stx.stx_mask & STATX_ATIME) ? stx.stx_atime.tv_sec : 0;
+			sb.st_mtime = (stx.stx_mask & STATX_MTIME) ? stx.stx_mtime.tv_sec : 0;
+			sb.st_ctime = (stx.stx_mask & STATX_CTIME) ? stx.stx_ctime.tv_sec : 0;
+			sb.st_uid = (stx.stx_mask & STATX_UID) ? stx.stx_uid : 0;
+			sb.st_gid = (stx.stx_mask & STATX_GID) ? stx.stx_gid : 0;
+			sb.st_size = (stx.stx_mask & STATX_SIZE) ? stx.stx_size : 0;
+			sb.st_blocks = (stx.stx_mask & STATX_BLOCKS) ? stx.stx_blocks : 0;
+		}
+#endif
+	};
+}
+
+#endif	/* STATBACKEND_HPP */
@@ -0,0 +1,73 @@
+#ifndef STRINGREF_HPP
+#define	STRINGREF_HPP
+
+#include <string>
+#include <ostream>
+#include <cstring>
+
+namespace pstat
+{
+	/**
+	 * \brief A non-owning reference to a string (not necessarily NUL-terminated) that outlives the reference, e.g. a
+	 * name interned by \ref CachedUtilities. Copying a reference copies neither the string nor allocates.
+	 */
+	class StringRef
+	{
+		const char* m_Data; //!< The first character of the string
+		size_t m_Size; //!< Number of characters in the string
+
+	public:
+
+		StringRef()
+		{
+			m_Data = "";
+			m_Size = 0;
+		}
+
+		StringRef(const char* data, size_t size)
+		{
+			m_Data = data;
+			m_Size = size;
+		}
+
+		/**
+		 * \brief Refers to the specified NUL-terminated string
+		 */
+		StringRef(const char* str)
+		{
+			m_Data = str;
+			m_Size = strlen(str);
+		}
+
+		/**
+		 * \brief Returns the first character of the string
+		 */
+		const char* data() const
+		{
+			return m_Data;
+		}
+
+		/**
+		 * \brief Returns the number of characters in the string
+		 */
+		size_t size() const
+		{
+			return m_Size;
+		}
+
+		/**
+		 * \brief Returns a copy of the string
+		 */
+		std::string str() const
+		{
+			return std::string(m_Data, m_Size);
+		}
+	};
+
+	inline std::ostream& operator<<(std::ostream& out, const StringRef& str)
+	{
+		return out.write(str.data(), str.size());
+	}
+}
+
+#endif	/* STRINGREF_HPP */
@@ -0,0 +1,450 @@
+#ifndef TELEMETRY_HPP
+#define	TELEMETRY_HPP
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#define TELEMETRY_LATENCY_BUCKETS 32 //!< Number of buckets of a \ref pstat::LatencyHistogram: bucket b counts the latencies under 2^b ns, the last one all the others
+
+namespace pstat
+{
+	/**
+	 * \brief Returns the time of the monotonic clock, in nanoseconds
+	 */
+	inline u_int64_t getMonotonicNanoseconds()
+	{
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+
+		return now.tv_sec * 1000000000ull + now.tv_nsec;
+	}
+
+	/**
+	 * \brief Returns the resident set size of the process, in bytes, or 0 if it cannot be read
+	 */
+	inline u_int64_t getResidentBytes()
+	{
+		FILE* statm = fopen("/proc/self/statm", "r");
+		unsigned long long pages = 0;
+
+		if (statm == NULL)
+		{
+			return 0;
+		}
+
+		if (fscanf(statm, "%*u %llu", &pages) != 1)
+		{
+			pages = 0;
+		}
+
+		fclose(statm);
+
+		return pages * sysconf(_SC_PAGESIZE);
+	}
+
+	/**
+	 * \brief Adds the specified value to a counter that only the calling thread updates. The counter is atomic so
+	 * that other threads may read it, but is updated with a plain load and store, which costs no more than for a
+	 * non-atomic counter.
+	 */
+	inline void bumpCounter(std::atomic<u_int64_t>& counter, u_int64_t value = 1)
+	{
+		counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+	}
+
+	/**
+	 * \brief A histogram of latencies, in power-of-two buckets of nanoseconds. Updated by a single thread, and read by any.
+	 */
+	class LatencyHistogram
+	{
+		std::atomic<u_int64_t> m_Buckets[TELEMETRY_LATENCY_BUCKETS]; //!< Number of latencies in [2^(b-1), 2^b) ns for each bucket b, 0 included in the first one
+		std::atomic<u_int64_t> m_Count; //!< Number of latencies
+		std::atomic<u_int64_t> m_Sum; //!< Sum of the latencies, in nanoseconds
+
+	public:
+
+		LatencyHistogram()
+		{
+			for (std::atomic<u_int64_t>& bucket : m_Buckets)
+			{
+				bucket = 0;
+			}
+
+			m_Count = 0;
+			m_Sum = 0;
+		}
+
+		/**
+		 * \brief Adds the specified latency, in nanoseconds
+		 */
+		inline void add(u_int64_t nanoseconds)
+		{
+			int bucket = nanoseconds == 0 ? 0 : 64 - __builtin_clzll(nanoseconds);
+
+			bumpCounter(m_Buckets[bucket < TELEMETRY_LATENCY_BUCKETS ? bucket : TELEMETRY_LATENCY_BUCKETS - 1]);
+			bumpCounter(m_Count);
+			bumpCounter(m_Sum, nanoseconds);
+		}
+
+		/**
+		 * \brief Adds the latency elapsed since the specified time of \ref getMonotonicNanoseconds()
+		 */
+		inline void addSince(u_int64_t start)
+		{
+			add(getMonotonicNanoseconds() - start);
+		}
+
+		/**
+		 * \brief Returns the number of latencies
+		 */
+		inline u_int64_t getCount() const
+		{
+			return m_Count;
+		}
+
+		/**
+		 * \brief Returns the sum of the latencies, in nanoseconds
+		 */
+		inline u_int64_t getSum() const
+		{
+			return m_Sum;
+		}
+
+		/**
+		 * \brief Adds the buckets, the count and the sum of this histogram to the specified ones
+		 */
+		void addTo(u_int64_t* buckets, u_int64_t& count, u_int64_t& sum) const
+		{
+			for (int b = 0; b < TELEMETRY_LATENCY_BUCKETS; b++)
+			{
+				buckets[b] += m_Buckets[b];
+			}
+
+			count += m_Count;
+			sum += m_Sum;
+		}
+	};
+
+	/**
+	 * \brief The operations whose latencies are measured
+	 */
+	enum TelemetryOperation
+	{
+		TELEMETRY_OPENDIR, //!< Opening a directory
+		TELEMETRY_READDIR, //!< Reading a batch of directory entries
+		TELEMETRY_STAT, //!< Stating an entry
+		TELEMETRY_WRITE, //!< Writing a chunk of records to an output shard
+		TELEMETRY_BACKPRESSURE, //!< Waiting for an empty chunk of records, all the chunks of the memory budget being in use
+		TELEMETRY_OPERATIONS //!< Number of operations
+	};
+
+	/**
+	 * \brief The counters of a walker or flush thread. Each one is allocated separately and padded, so that threads
+	 * do not false-share
+	 */
+	struct ThreadTelemetry
+	{
+		char padding[64]; //!< Keeps the tail of the previous allocation off the cache line of the counters
+		std::atomic<u_int64_t> directories; //!< Number of directories traversed, by a walker thread
+		std::atomic<u_int64_t> records; //!< Number of records collected by a walker thread, or written by a flush thread
+		std::atomic<u_int64_t> chunks; //!< Number of chunks of records written, by a flush thread
+		LatencyHistogram latencies[TELEMETRY_OPERATIONS]; //!< Latencies of the operations of the thread
+
+		ThreadTelemetry()
+		{
+			directories = 0;
+			records = 0;
+			chunks = 0;
+		}
+	};
+
+	/**
+	 * \brief Instantaneous values of the queues of a collection
+	 */
+	struct TelemetryGauges
+	{
+		u_int64_t queuedDirectories; //!< Number of directories queued to the walker threads
+		u_int64_t pendingDirectories; //!< Number of directories queued or being traversed
+		u_int64_t unwrittenChunks; //!< Number of chunks of records handed to the flush threads and not written yet
+		u_int64_t activeWalkerThreads; //!< Number of walker threads allowed to traverse directories
+		u_int64_t directories; //!< Number of directories found so far
+		u_int64_t allocatedChunks; //!< Number of chunks of records allocated
+		u_int64_t memoryBytes; //!< Approximate number of bytes used by the buffers of the walker
+		u_int64_t memoryBudget; //!< Maximum number of bytes of the buffers of the walker, or 0 for no limit
+		u_int64_t depthFirst; //!< 1 if the walker threads are held depth-first to keep the queued directories down, 0 otherwise
+	};
+
+	/**
+	 * \brief Live instrumentation of a collection: the counters and latencies of each walker and flush thread, which
+	 * only the thread itself updates, and the depths of the queues, sampled when written. The whole is written as a
+	 * Prometheus text exposition, or as JSON.
+	 */
+	class Telemetry
+	{
+		std::vector<std::unique_ptr<ThreadTelemetry>> m_Walkers; //!< Counters of each walker thread
+		std::vector<std::unique_ptr<ThreadTelemetry>> m_Flushers; //!< Counters of each flush thread
+		u_int64_t m_Start; //!< When the collection started, as a time of \ref getMonotonicNanoseconds()
+
+		Telemetry(const Telemetry&);
+		Telemetry& operator=(const Telemetry&);
+
+		/**
+		 * \brief Returns the name of the specified operation
+		 */
+		static const char* getOperationName(int operation)
+		{
+			static const char* names[TELEMETRY_OPERATIONS] = {"opendir", "readdir", "stat", "write", "backpressure"};
+
+			return names[operation];
+		}
+
+		/**
+		 * \brief Writes the counters as a Prometheus text exposition
+		 */
+		void writePrometheus(std::ostream& out, const TelemetryGauges& gauges) const
+		{
+			out << "# HELP pstat_uptime_seconds Time since the collection started\n# TYPE pstat_uptime_seconds gauge\n"
+					<< "pstat_uptime_seconds " << (getMonotonicNanoseconds() - m_Start) / 1e9 << "\n";
+
+			out << "# HELP pstat_walker_directories_total Directories traversed by each walker thread\n"
+					<< "# TYPE pstat_walker_directories_total counter\n";
+
+			for (size_t i = 0; i < m_Walkers.size(); i++)
+			{
+				out << "pstat_walker_directories_total{thread=\"" << i << "\"} " << m_Walkers[i]->directories << "\n";
+			}
+
+			out << "# HELP pstat_walker_records_total Stat records collected by each walker thread\n"
+					<< "# TYPE pstat_walker_records_total counter\n";
+
+			for (size_t i = 0; i < m_Walkers.size(); i++)
+			{
+				out << "pstat_walker_records_total{thread=\"" << i << "\"} " << m_Walkers[i]->records << "\n";
+			}
+
+			out << "# HELP pstat_flush_records_total Records written to each output shard\n# TYPE pstat_flush_records_total counter\n";
+
+			for (size_t i = 0; i < m_Flushers.size(); i++)
+			{
+				out << "pstat_flush_records_total{shard=\"" << i << "\"} " << m_Flushers[i]->records << "\n";
+			}
+
+			out << "# HELP pstat_flush_chunks_total Chunks of records written to each output shard\n"
+					<< "# TYPE pstat_flush_chunks_total counter\n";
+
+			for (size_t i = 0; i < m_Flushers.size(); i++)
+			{
+				out << "pstat_flush_chunks_total{shard=\"" << i << "\"} " << m_Flushers[i]->chunks << "\n";
+			}
+
+			out << "# HELP pstat_latency_seconds Latency of the operations of all the threads\n# TYPE pstat_latency_seconds histogram\n";
+
+			for (int op = 0; op < TELEMETRY_OPERATIONS; op++)
+			{
+				u_int64_t buckets[TELEMETRY_LATENCY_BUCKETS] = {0};
+				u_int64_t count = 0, sum = 0, cumulative = 0;
+
+				getLatencies(op, buckets, count, sum);
+
+				for (int b = 0; b < TELEMETRY_LATENCY_BUCKETS - 1; b++)
+				{
+					cumulative += buckets[b];
+					out << "pstat_latency_seconds_bucket{operation=\"" << getOperationName(op) << "\",le=\"" << (1ull << b) / 1e9
+							<< "\"} " << cumulative << "\n";
+				}
+
+				out << "pstat_latency_seconds_bucket{operation=\"" << getOperationName(op) << "\",le=\"+Inf\"} " << count << "\n"
+						<< "pstat_latency_seconds_sum{operation=\"" << getOperationName(op) << "\"} " << sum / 1e9 << "\n"
+						<< "pstat_latency_seconds_count{operation=\"" << getOperationName(op) << "\"} " << count << "\n";
+			}
+
+			out << "# HELP pstat_queued_directories Directories queued to the walker threads\n# TYPE pstat_queued_directories gauge\n"
+					<< "pstat_queued_directories " << gauges.queuedDirectories << "\n"
+					<< "# HELP pstat_pending_directories Directories queued or being traversed\n# TYPE pstat_pending_directories gauge\n"
+					<< "pstat_pending_directories " << gauges.pendingDirectories << "\n"
+					<< "# HELP pstat_unwritten_chunks Chunks of records waiting for the flush threads\n# TYPE pstat_unwritten_chunks gauge\n"
+					<< "pstat_unwritten_chunks " << gauges.unwrittenChunks << "\n"
+					<< "# HELP pstat_active_walker_threads Walker threads allowed to traverse directories\n"
+					<< "# TYPE pstat_active_walker_threads gauge\n"
+					<< "pstat_active_walker_threads " << gauges.activeWalkerThreads << "\n"
+					<< "# HELP pstat_directories Directories found so far\n# TYPE pstat_directories gauge\n"
+					<< "pstat_directories " << gauges.directories << "\n"
+					<< "# HELP pstat_allocated_chunks Chunks of records allocated\n# TYPE pstat_allocated_chunks gauge\n"
+					<< "pstat_allocated_chunks " << gauges.allocatedChunks << "\n"
+					<< "# HELP pstat_memory_bytes Approximate memory used by the buffers of the walker\n# TYPE pstat_memory_bytes gauge\n"
+					<< "pstat_memory_bytes " << gauges.memoryBytes << "\n"
+					<< "# HELP pstat_memory_budget_bytes Memory budget of the buffers of the walker, 0 if unlimited\n"
+					<< "# TYPE pstat_memory_budget_bytes gauge\n"
+					<< "pstat_memory_budget_bytes " << gauges.memoryBudget << "\n"
+					<< "# HELP pstat_resident_bytes Resident set size of the process\n# TYPE pstat_resident_bytes gauge\n"
+					<< "pstat_resident_bytes " << getResidentBytes() << "\n"
+					<< "# HELP pstat_depth_first Whether the walker threads are held depth-first\n# TYPE pstat_depth_first gauge\n"
+					<< "pstat_depth_first " << gauges.depthFirst << "\n";
+		}
+
+		/**
+		 * \brief Writes the counters as a JSON object
+		 */
+		void writeJson(std::ostream& out, const TelemetryGauges& gauges) const
+		{
+			out << "{\n  \"uptime_seconds\": " << (getMonotonicNanoseconds() - m_Start) / 1e9 << ",\n  \"walkers\": [";
+
+			for (size_t i = 0; i < m_Walkers.size(); i++)
+			{
+				out << (i > 0 ? ", " : "") << "{\"directories\": " << m_Walkers[i]->directories << ", \"records\": "
+						<< m_Walkers[i]->records << "}";
+			}
+
+			out << "],\n  \"shards\": [";
+
+			for (size_t i = 0; i < m_Flushers.size(); i++)
+			{
+				out << (i > 0 ? ", " : "") << "{\"records\": " << m_Flushers[i]->records << ", \"chunks\": " << m_Flushers[i]->chunks << "}";
+			}
+
+			out << "],\n  \"latencies\": {";
+
+			for (int op = 0; op < TELEMETRY_OPERATIONS; op++)
+			{
+				u_int64_t buckets[TELEMETRY_LATENCY_BUCKETS] = {0};
+				u_int64_t count = 0, sum = 0;
+
+				getLatencies(op, buckets, count, sum);
+				out << (op > 0 ? "," : "") << "\n    \"" << getOperationName(op) << "\": {\"count\": " << count
+						<< ", \"sum_seconds\": " << sum / 1e9 << ", \"buckets_under_ns\": [";
+
+				for (int b = 0; b < TELEMETRY_LATENCY_BUCKETS; b++)
+				{
+					out << (b > 0 ? ", " : "") << buckets[b];
+				}
+
+				out << "]}";
+			}
+
+			out << "\n  },\n  \"queued_directories\": " << gauges.queuedDirectories << ",\n  \"pending_directories\": "
+					<< gauges.pendingDirectories << ",\n  \"unwritten_chunks\": " << gauges.unwrittenChunks
+					<< ",\n  \"active_walker_threads\": " << gauges.activeWalkerThreads << ",\n  \"directories\": "
+					<< gauges.directories << ",\n  \"allocated_chunks\": " << gauges.allocatedChunks << ",\n  \"memory_bytes\": "
+					<< gauges.memoryBytes << ",\n  \"memory_budget_bytes\": " << gauges.memoryBudget << ",\n  \"resident_bytes\": "
+					<< getResidentBytes() << ",\n  \"depth_first\": " << gauges.depthFirst << "\n}\n";
+		}
+
+	public:
+
+		/**
+		 * \brief Creates the counters of the specified numbers of walker and flush threads
+		 */
+		Telemetry(int walkers, int flushers) : m_Start(getMonotonicNanoseconds())
+		{
+			for (int i = 0; i < walkers; i++)
+			{
+				m_Walkers.push_back(std::unique_ptr<ThreadTelemetry>(new ThreadTelemetry()));
+			}
+
+			for (int i = 0; i < flushers; i++)
+			{
+				m_Flushers.push_back(std::unique_ptr<ThreadTelemetry>(new ThreadTelemetry()));
+			}
+		}
+
+		/**
+		 * \brief Returns the counters of the specified walker thread
+		 */
+		inline ThreadTelemetry& getWalker(int tid)
+		{
+			return *m_Walkers[tid];
+		}
+
+		/**
+		 * \brief Gets the number and the sum (in nanoseconds) of the latencies of the specified operation, over all the
+		 * walker threads
+		 */
+		void getWalkerLatencies(int operation, u_int64_t& count, u_int64_t& sum) const
+		{
+			count = 0;
+			sum = 0;
+
+			for (const std::unique_ptr<ThreadTelemetry>& walker : m_Walkers)
+			{
+				count += walker->latencies[operation].getCount();
+				sum += walker->latencies[operation].getSum();
+			}
+		}
+
+		/**
+		 * \brief Returns the counters of the flush thread of the specified shard
+		 */
+		inline ThreadTelemetry& getFlusher(int shard)
+		{
+			return *m_Flushers[shard];
+		}
+
+		/**
+		 * \brief Adds the latencies of the specified operation of all the threads to the specified buckets, count and sum
+		 */
+		void getLatencies(int operation, u_int64_t* buckets, u_int64_t& count, u_int64_t& sum) const
+		{
+			for (const std::unique_ptr<ThreadTelemetry>& thread : m_Walkers)
+			{
+				thread->latencies[operation].addTo(buckets, count, sum);
+			}
+
+			for (const std::unique_ptr<ThreadTelemetry>& thread : m_Flushers)
+			{
+				thread->latencies[operation].addTo(buckets, count, sum);
+			}
+		}
+
+		/**
+		 * \brief Replaces the specified file with the counters and the specified gauges: as JSON if its name ends
+		 * with .json, as a Prometheus text exposition otherwise. The file is written aside and renamed, so that readers
+		 * never see a partial one.
+		 * \return 0 on success, the errno of the failure otherwise
+		 */
+		int write(const std::string& path, const TelemetryGauges& gauges) const
+		{
+			std::string temporary = path + ".tmp";
+			std::ofstream out(temporary.c_str(), std::ios::trunc);
+
+			if (!out)
+			{
+				return errno != 0 ? errno : EIO;
+			}
+
+			if (path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0)
+			{
+				writeJson(out, gauges);
+			}
+			else
+			{
+				writePrometheus(out, gauges);
+			}
+
+			out.close();
+
+			if (!out)
+			{
+				return EIO;
+			}
+
+			if (rename(temporary.c_str(), path.c_str()) != 0)
+			{
+				return errno;
+			}
+
+			return 0;
+		}
+	};
+}
+
+#endif	/* TELEMETRY_HPP */
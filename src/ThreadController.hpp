@@ -0,0 +1,126 @@
+#ifndef THREADCONTROLLER_HPP
+#define	THREADCONTROLLER_HPP
+
+#include <string>
+#include <cstdio>
+#include <algorithm>
+
+#define THREAD_CONTROLLER_TOLERANCE 0.05 //!< Relative change of the throughput within which it is considered unchanged (noise)
+#define THREAD_CONTROLLER_DEFAULT_INTERVAL 1000 //!< Default time interval, in milliseconds, between two throughput samples
+
+namespace pstat
+{
+	/**
+	 * \brief Decides the number of active walker threads from the observed throughput, by hill climbing: the number of
+	 * threads moves in one direction (by a quarter when growing, a fifth when shrinking) as long as the throughput
+	 * improves, and turns back when it drops. When a move leaves the throughput unchanged, the controller heads towards
+	 * fewer threads, which do the same work with less contention. While fewer directories are queued than there are
+	 * threads, some threads are idle whatever the throughput, so the number of threads shrinks, and the next sample
+	 * probes again from there.
+	 *
+	 * The average latency of the stat calls, as measured by the walker threads, is only logged along with the decisions.
+	 */
+	class ThreadController
+	{
+		int m_Min; //!< Minimum number of threads
+		int m_Max; //!< Maximum number of threads
+		int m_Threads; //!< Current number of threads
+		int m_Direction; //!< Direction of the last move: 1 to more threads, -1 to fewer
+		double m_LastRate; //!< Throughput of the previous sample, in stat records per second, or a negative value if unknown
+
+	public:
+
+		/**
+		 * \brief Creates a controller that keeps the number of threads between min and max, starting from threads
+		 */
+		ThreadController(int min, int max, int threads)
+				: m_Min(min), m_Max(max), m_Threads(std::max(min, std::min(threads, max))), m_Direction(1), m_LastRate(-1)
+		{
+		}
+
+		/**
+		 * \brief Returns the number of threads decided so far
+		 */
+		int getThreads() const
+		{
+			return m_Threads;
+		}
+
+		/**
+		 * \brief Takes a sample of the throughput, measured with the current number of threads, and decides the number
+		 * of threads for the next interval
+		 * \param rate Number of stat records collected per second since the previous sample
+		 * \param latency Average latency of the stat calls completed since the previous sample, in milliseconds, or a
+		 * negative value if none completed
+		 * \param starved Set if the walker threads lack directories to traverse, in which case more threads would not help
+		 * \param decision Receives a description of the decision, to be logged
+		 * \return The number of threads for the next interval
+		 */
+		int update(double rate, double latency, bool starved, std::string& decision)
+		{
+			char text[160];
+			char latencyText[32] = "";
+			int threads = m_Threads;
+
+			if (latency >= 0)
+			{
+				snprintf(latencyText, sizeof(latencyText), ", %.3f ms per stat", latency);
+			}
+
+			if (starved || rate <= 0)
+			{
+				threads = std::max(m_Min, m_Threads - std::max(1, m_Threads / 5));
+				snprintf(text, sizeof(text), "%d -> %d threads (%.0f stats/s%s), not enough directories queued",
+						m_Threads, threads, rate, latencyText);
+				decision = text;
+
+				// The next sample is not comparable with this one, it probes upwards again
+				m_LastRate = -1;
+				m_Direction = 1;
+				m_Threads = threads;
+
+				return m_Threads;
+			}
+
+			const char* reason = "probing";
+			double change = m_LastRate > 0 ? rate / m_LastRate - 1 : 0;
+
+			if (m_LastRate > 0)
+			{
+				if (change < -THREAD_CONTROLLER_TOLERANCE)
+				{
+					reason = "throughput dropped, turning back";
+					m_Direction = -m_Direction;
+				}
+				else if (change > THREAD_CONTROLLER_TOLERANCE)
+				{
+					reason = "throughput improved";
+				}
+				else
+				{
+					reason = "throughput unchanged";
+					m_Direction = -1;
+				}
+			}
+
+			threads += m_Direction > 0 ? std::max(1, m_Threads / 4) : -std::max(1, m_Threads / 5);
+			threads = std::max(m_Min, std::min(threads, m_Max));
+
+			if (threads == m_Threads)
+			{
+				// Stuck against a bound, probe the other way next time
+				m_Direction = -m_Direction;
+			}
+
+			snprintf(text, sizeof(text), "%d -> %d threads (%.0f stats/s, %+.1f%%%s), %s", m_Threads, threads,
+					rate, change * 100, latencyText, reason);
+			decision = text;
+			m_LastRate = rate;
+			m_Threads = threads;
+
+			return m_Threads;
+		}
+	};
+}
+
+#endif	/* THREADCONTROLLER_HPP */
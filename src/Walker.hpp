@@ -6,270 +6,1365 @@
 #endif
 
 #include "CachedUtilities.hpp"
+#include "DirectoryReader.hpp"
+#include "StatBackend.hpp"
+#include "IoUring.hpp"
+#include "WorkStealingScheduler.hpp"
+#include "RecordChunk.hpp"
+#include "ExclusionFilter.hpp"
+#include "BaselineIndex.hpp"
+#include "Aggregator.hpp"
+#include "RecordFilter.hpp"
+#include "Checkpoint.hpp"
+#include "InodeSet.hpp"
+#include "Telemetry.hpp"
 
 #include <thread>
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include <map>
+#include <set>
 #include <sys/stat.h>
 #include <mutex>
-#include <dirent.h>
+#include <fcntl.h>
 #include <string>
-#include <sstream>
 #include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <condition_variable>
 
-#ifdef HAVE_TBB_HEADERS_
-#include <tbb/concurrent_queue.h>
-#else
-#include "inconcurrent_queue.hpp"
-#endif
-
-#define OUTPUT_THREADS_COUNT 1 //!< Sets the number of outputting threads. Setting it to more than 1 might not be efficient though.
+#define IO_URING_QUEUE_DEPTH 256 //!< Maximum number of stat requests each walker thread keeps in flight when using io_uring
+#define IO_URING_DIRECTORY_BATCH 32 //!< Maximum number of directories each walker thread opens at once when using io_uring
+#define FRONTIER_MEMORY_SHARE 8 //!< With a memory budget, the walker threads are held depth-first while the queued directories take more than 1/FRONTIER_MEMORY_SHARE of it
 
 namespace pstat
 {
 	/**
-	 * \brief Defines a threadpool of threads that stat the filesystem
+	 * \brief The options of a \ref Walker. The defaults collect every entry, with 4 walker threads and synchronous lstat() calls.
+	 */
+	struct WalkerOptions
+	{
+		std::set<std::string> skipList; //!< Patterns of the paths to be skipped, along with their subtree (see \ref ExclusionFilter)
+		int walkerThreads; //!< The number of walker threads of the pool that traverses the devices without a pool of their own. Experiments show that setting it to 2x number of cores can yield the best performance
+		bool useStatx; //!< Set to true to stat using statx(), requesting only the fields the output needs. Falls back to fstatat() if not supported
+		bool dontSync; //!< Set to true to let statx() return cached attributes without revalidating them (AT_STATX_DONT_SYNC)
+		bool useIoUring; //!< Set to true to submit the stat calls in batches through io_uring. Falls back to the synchronous calls if io_uring is not supported
+		bool aggregate; //!< Set to true to aggregate the records into summary tables (see \ref Walker::writeSummary()) instead of handing them to the sink
+		const BaselineIndex* baseline; //!< A previous snapshot of the same path, holding all the entries of this collection. The records of the entries of the directories that are unchanged since are copied from it instead of collected. May be NULL
+		const RecordFilter* filter; //!< Selects the records to be output (or aggregated). Directories are traversed whether they match or not. May be NULL to select all the records
+		const Checkpoint* resume; //!< A checkpoint of an interrupted collection with the same options, to be resumed: only the directories it lists are traversed, and the sink must be reopened where the checkpoint left it. Does not apply when aggregating. May be NULL to start from the collected path
+		HardlinkMode hardlinks; //!< How the entries with several hard links are accounted for. The inodes whose first link was found before the checkpoint are not known after resuming, so one of their links may be found first again
+		bool oneFileSystem; //!< Set to true to leave out the directories on other devices than the collected path's (their own records are still output, but they are not traversed)
+		std::map<dev_t, int> deviceThreads; //!< The devices whose directories are traversed by a pool of walker threads of their own, with the number of threads of each pool, so that slow devices do not hold up the walker threads of the other ones
+		bool telemetry; //!< Set to true to instrument the walker and flush threads (see \ref Walker::writeTelemetry())
+		size_t maxMemory; //!< Memory budget of the buffers of the walker, in bytes, or 0 for no limit (see \ref Walker::balanceMemory())
+
+		WalkerOptions()
+		{
+			walkerThreads = 4;
+			useStatx = false;
+			dontSync = false;
+			useIoUring = false;
+			aggregate = false;
+			baseline = NULL;
+			filter = NULL;
+			resume = NULL;
+			hardlinks = HARDLINKS_COUNT;
+			oneFileSystem = false;
+			telemetry = false;
+			maxMemory = 0;
+		}
+	};
+
+	/**
+	 * \brief Defines a threadpool of threads that stat the filesystem, and hands the records they collect to a sink.
+	 *
+	 * The sink is resolved at compile time, so that records are delivered without a virtual call. The walker hands
+	 * it whole chunks of records, from flush threads of its own, one per shard of the sink. A Sink must provide:
+	 * - int getShardsCount() const: the number of flush threads. Each one only calls \ref consume() with its own shard
+	 * index, so the sink needs no locking when its shards are independent. May be 0 when aggregating, in which case
+	 * no records are handed over (see \ref writeSummary())
+	 * - unsigned int getStatFields() const: the \ref StatField flags of the fields the sink reads
+	 * - void consume(int shard, const RecordChunk& chunk, DirectoryPathCache& paths): takes the records of a chunk,
+	 * which is recycled once the call returns. paths resolves their parent directories to their paths
+	 * - bool sync(Checkpoint& state): only if \ref checkpoint() is used. Makes the records consumed so far durable and
+	 * stores where the sink can be resumed in state
+	 *
+	 * The collection runs from \ref start() until \ref wait() or \ref cancel() return. The sink then holds all the
+	 * records collected, and the walker no longer uses it. See \ref FileSink for the sink of the pstat command.
 	 */
+	template<class Sink>
 	class Walker
 	{
-		typedef struct stat StarRec;
-		std::hash<std::string> m_HashFunction; //!< String hash function
-		std::unordered_map<std::size_t, bool> m_SkipListHashes; //!< Hash list of paths to be skipped
 		std::vector<std::thread> m_WalkStatThreads; //!< Holds the walker threads
 		std::vector<std::thread> m_FlushThreads; //!< Holds the outputting threads
-		std::ofstream m_OutFile; //!< The output CSV file
-		tbb::concurrent_queue<std::string> m_DirectoryQueue; //!< Enqueues the directories to be stated
-		tbb::concurrent_queue<std::pair<std::string, StarRec>> m_StatRecords; //!< All the stated files/directories are stored here. The pair corresponds to the path and its stat record
-		bool m_RawOutput; //!< If set to false, human-readable output will be provided
+		std::string m_Path; //!< The collected path
+		Sink& m_Sink; //!< Receives the chunks of records, from the flush threads
+		const Checkpoint* m_Resume; //!< The checkpoint of the interrupted collection to be resumed, or NULL
+		int m_WalkerThreads; //!< Total number of walker threads, over all the pools
+		DirectoryTable m_Directories; //!< Every directory found so far, with its parent and name, indexed by id
+		ExclusionFilter m_Exclusions; //!< Decides which entries are skipped, along with their subtree
+		const BaselineIndex* m_Baseline; //!< A previous snapshot, whose records of the unchanged directories are copied instead of collected, or NULL
+		std::vector<std::unique_ptr<Aggregator>> m_Aggregators; //!< When aggregating, one per walker thread, fed instead of the chunks. Empty otherwise
+		const RecordFilter* m_Filter; //!< Selects the records to be output (or aggregated), or NULL to select all of them
+		HardlinkMode m_HardlinkMode; //!< How the entries with several hard links are accounted for
+		InodeSet m_LinkedInodes; //!< The inodes with several links found so far, unless \ref m_HardlinkMode is \ref HARDLINKS_COUNT
+		/**
+		 * \brief A pool of walker threads, which traverses the directories of some devices only
+		 */
+		struct DevicePool
+		{
+			WorkStealingScheduler<u_int32_t> scheduler; //!< Distributes the ids of the directories to be traversed among the threads of the pool
+			int firstThread; //!< Id of the first walker thread of the pool. The pool's threads have consecutive ids
+			int threads; //!< Number of walker threads of the pool
+
+			DevicePool(int first, int count) : scheduler(count), firstThread(first), threads(count)
+			{
+			}
+		};
+
+		std::vector<std::unique_ptr<DevicePool>> m_Pools; //!< The pools of walker threads. The first one traverses the devices without a pool of their own
+		std::map<dev_t, size_t> m_DevicePools; //!< Index in \ref m_Pools of each device with a pool of its own
+		std::vector<size_t> m_ThreadPools; //!< Index in \ref m_Pools of the pool of each walker thread
+		bool m_OneFileSystem; //!< If set to true, the directories on other devices than \ref m_RootDevice are not traversed
+		dev_t m_RootDevice; //!< Device of the collected path
+		RecordChunkPool m_ChunkPool; //!< Recycles the chunks of stat records. With a memory budget, its cap holds the walker threads back
+		size_t m_MemoryBudget; //!< Maximum number of bytes of the buffers of the walker, or 0 for no limit (see \ref balanceMemory())
+		BlockingQueue<RecordChunk*> m_FullChunks; //!< Chunks of stat records handed by the walker threads to the flush threads
+		std::atomic<u_int64_t> m_UnwrittenChunks; //!< Number of chunks handed to the flush threads and not written yet
+		std::mutex m_FlushMutex; //!< Serializes the waits for \ref m_UnwrittenChunks to drop to zero with its notifications
+		std::condition_variable m_FlushedCondition; //!< Notified when \ref m_UnwrittenChunks drops to zero
+		StatBackend m_StatBackend; //!< Performs the actual stat system calls
+		std::unique_ptr<Telemetry> m_Telemetry; //!< Counters and latencies of the walker and flush threads, or NULL if not instrumented
+		bool m_UseIoUring; //!< If set to true, walker threads submit their system calls in batches through io_uring
 		std::atomic<u_int64_t> m_TotalStated; //!< Stores the total number of stated files
+		std::atomic<u_int64_t> m_MatchedRecords; //!< Number of records selected by \ref m_Filter
+		std::atomic<u_int64_t> m_DuplicateLinks; //!< Number of records found to be further links of an inode, marked or dropped according to \ref m_HardlinkMode
+		std::atomic<u_int64_t> m_CopiedRecords; //!< Number of records copied from \ref m_Baseline
+		std::atomic<u_int64_t> m_UnchangedDirectories; //!< Number of directories whose entries are copied from \ref m_Baseline
+		bool m_Started; //!< Set to true once the threads are started
 		bool m_Halted; //!< If set to true, all threads in the threadpool will be gracefully exited
-	#if OUTPUT_THREADS_COUNT > 1
-		std::mutex m_OutputMutex; //!< A mutex to lock output file. Only used when number of output threads is > 1
-	#endif
+		std::atomic<u_int64_t> m_PendingDirectories; //!< Number of directories queued or being traversed. The walk is complete when it drops to zero
+		bool m_Completed; //!< Set to true once all the directories are traversed
+		std::mutex m_CompletionMutex; //!< Guards \ref m_Completed
+		std::condition_variable m_CompletionCondition; //!< Notified when the walk is complete
 
 		/**
-		 * \brief Stats the specified path using lstat() system call
-       * \param path Full path to the file to be stated
+		 * \brief Stats the specified entry using the stat backend, without following symbolic links
+       * \param tid The calling walker thread
+       * \param chunk The calling thread's chunk, where the stat record is added
+       * \param dirfd File descriptor of the directory containing the entry, or AT_FDCWD
+       * \param name Name of the entry relative to dirfd (NUL-terminated)
+       * \param nameLength Length of name
+       * \param parent Id of the directory containing the entry, or \ref NO_PARENT_DIRECTORY if name is a full path
+       * \param sb Receives the stat record
+       * \return True if the entry is stated successfully, false otherwise
        */
-		inline void mystat(const std::string& path)
+		inline bool mystat(int tid, RecordChunk*& chunk, int dirfd, const char* name, size_t nameLength, u_int32_t parent, struct stat& sb)
+		{
+			u_int64_t start = m_Telemetry ? getMonotonicNanoseconds() : 0;
+			bool stated = m_StatBackend.stat(dirfd, name, sb);
+
+			if (m_Telemetry)
+			{
+				m_Telemetry->getWalker(tid).latencies[TELEMETRY_STAT].addSince(start);
+			}
+
+			if (!stated)
+			{
+				std::string path;
+				getEntryPath(parent, name, nameLength, path);
+				std::cerr << "-- Error stating file: " << path << "\n";
+				return false;
+			}
+
+			pushRecord(tid, chunk, sb, parent, name, nameLength);
+
+			return true;
+		}
+
+		/**
+		 * \brief Stores the full path of the entry with the specified name within the specified directory in path
+		 */
+		void getEntryPath(u_int32_t parent, const char* name, size_t nameLength, std::string& path) const
+		{
+			if (parent == NO_PARENT_DIRECTORY)
+			{
+				path.assign(name, nameLength);
+				return;
+			}
+
+			m_Directories.getPath(parent, path);
+			DirectoryTable::appendName(path, name, nameLength);
+		}
+
+		/**
+		 * \brief Adds the specified stat record (a struct stat, or a \ref StatRecord) to the calling thread's chunk,
+		 * handing the chunk to the flush threads once it is full. When aggregating, the record only updates the
+		 * calling thread's \ref Aggregator instead. Records that do not match \ref m_Filter are dropped, and the
+		 * further links of an inode are marked or dropped according to \ref m_HardlinkMode.
+		 */
+		template<typename Record>
+		inline void pushRecord(int tid, RecordChunk*& chunk, const Record& sb, u_int32_t parent, const char* name, size_t nameLength)
 		{
 			m_TotalStated++;
 
-			struct stat sb;
-			lstat(path.c_str(), &sb);
+			if (m_Telemetry)
+			{
+				bumpCounter(m_Telemetry->getWalker(tid).records);
+			}
+
+			if (m_Filter != NULL)
+			{
+				if (!m_Filter->match(sb))
+				{
+					return;
+				}
+
+				m_MatchedRecords++;
+			}
 
-			m_StatRecords.emplace(path, sb);
+			if (m_HardlinkMode != HARDLINKS_COUNT)
+			{
+				StatRecord rec;
+				assignRecord(rec, sb);
+
+				// Only the inodes with several links are looked up, so that the set stays small
+				if (!S_ISDIR(rec.mode) && rec.nlink > 1 && !m_LinkedInodes.insert(rec.dev, rec.ino))
+				{
+					m_DuplicateLinks++;
+
+					if (m_HardlinkMode == HARDLINKS_DROP)
+					{
+						return;
+					}
+
+					// The first link found carries the space on disk of the inode
+					rec.flags |= RECORD_DUPLICATE_LINK;
+					storeRecord(tid, chunk, rec, parent, name, nameLength);
+					return;
+				}
+			}
+
+			storeRecord(tid, chunk, sb, parent, name, nameLength);
 		}
 
 		/**
-		 * \brief Stores the specified stat record (file path and stat info) to the output CSV file
-       */
-		inline void statRecordToFile(const std::pair<std::string, StarRec>& rec)
+		 * \brief Stores the specified selected stat record in the calling thread's chunk or \ref Aggregator
+		 */
+		template<typename Record>
+		inline void storeRecord(int tid, RecordChunk*& chunk, const Record& sb, u_int32_t parent, const char* name, size_t nameLength)
 		{
-			const StarRec& sb = rec.second;
+			if (!m_Aggregators.empty())
+			{
+				m_Aggregators[tid]->add(sb, parent);
+				return;
+			}
 
-#if OUTPUT_THREADS_COUNT > 1
-			std::unique_lock<std::mutex> lock(m_OutputMutex);
-#endif
-			if(m_RawOutput)
-			{
-				m_OutFile << sb.st_dev << "-" << sb.st_ino << "," 
-					<< sb.st_atime << "," 
-					<< sb.st_mtime << ","
-					<< sb.st_uid << "," 
-					<< sb.st_gid << ","
-					<< sb.st_mode << ","
-					<< sb.st_size << "," 
-					<< sb.st_blocks * 512ll << "," 
-					<< '"' << rec.first << '"' << "\n";
+			chunk->add(sb, parent, name, nameLength);
+
+			if (chunk->isFull())
+			{
+				handChunk(chunk);
+				chunk = acquireChunk(tid);
 			}
-			else
+		}
+
+		/**
+		 * \brief Fills the specified \ref StatRecord from the specified stat record
+		 */
+		static inline void assignRecord(StatRecord& rec, const struct stat& sb)
+		{
+			rec.assign(sb);
+		}
+
+		/**
+		 * \brief Copies the specified \ref StatRecord
+		 */
+		static inline void assignRecord(StatRecord& rec, const StatRecord& source)
+		{
+			rec = source;
+		}
+
+		/**
+		 * \brief Hands the specified chunk to the flush threads
+		 */
+		inline void handChunk(RecordChunk* chunk)
+		{
+			m_UnwrittenChunks++;
+			m_FullChunks.push(chunk);
+		}
+
+		/**
+		 * \brief Gets an empty chunk for the specified walker thread. If all the chunks of the memory budget are in use,
+		 * blocks until the flush threads write one, timing the wait if instrumented.
+		 */
+		inline RecordChunk* acquireChunk(int tid)
+		{
+			RecordChunk* chunk;
+
+			if (m_ChunkPool.tryAcquire(chunk))
+			{
+				return chunk;
+			}
+
+			u_int64_t start = m_Telemetry ? getMonotonicNanoseconds() : 0;
+			chunk = m_ChunkPool.acquire();
+
+			if (m_Telemetry)
+			{
+				m_Telemetry->getWalker(tid).latencies[TELEMETRY_BACKPRESSURE].addSince(start);
+			}
+
+			return chunk;
+		}
+
+		/**
+		 * \brief Hands the specified walker thread's chunk to the flush threads if it has any records, replacing it with
+		 * an empty one
+		 */
+		inline void flushChunk(int tid, RecordChunk*& chunk)
+		{
+			if (!chunk->isEmpty())
+			{
+				handChunk(chunk);
+				chunk = acquireChunk(tid);
+			}
+		}
+
+		/**
+		 * \brief Pops the next directory for the specified walker thread. Before parking for lack of work, the
+		 * thread's partially-filled chunk is handed to the flush threads so that its records are not held back.
+		 * \return True if a directory is popped, false if the walker is halted
+		 */
+		inline bool popDirectory(int tid, u_int32_t& dir, unsigned& seed, RecordChunk*& chunk)
+		{
+			DevicePool& pool = *m_Pools[m_ThreadPools[tid]];
+
+			if (pool.scheduler.tryPop(tid - pool.firstThread, dir, seed))
+			{
+				return true;
+			}
+
+			flushChunk(tid, chunk);
+
+			return pool.scheduler.pop(tid - pool.firstThread, dir, seed);
+		}
+
+		/**
+		 * \brief Queues the directory with the specified id, on the specified device, to be traversed by the pool of the
+		 * device. The directory goes to the deque of the specified walker thread if it belongs to that pool, and to the
+		 * deque of one of the pool's threads otherwise.
+		 */
+		inline void pushDirectory(int tid, u_int32_t dir, dev_t device)
+		{
+			size_t index = 0;
+
+			if (!m_DevicePools.empty())
+			{
+				std::map<dev_t, size_t>::const_iterator it = m_DevicePools.find(device);
+				index = it != m_DevicePools.end() ? it->second : 0;
+			}
+
+			DevicePool& pool = *m_Pools[index];
+
+			m_PendingDirectories++;
+
+			pool.scheduler.push(m_ThreadPools[tid] == index ? tid - pool.firstThread : tid % pool.threads, dir);
+		}
+
+		/**
+		 * \brief Adds the specified subdirectory to \ref m_Directories, looking it up in \ref m_Baseline, and queues it
+		 * to be traversed. With \ref m_OneFileSystem, subdirectories on other devices (mount points) are left out.
+		 * \param sb The stat record of the subdirectory
+		 * \param exclusionState State of the \ref ExclusionFilter within the subdirectory
+		 */
+		inline void pushSubdirectory(int tid, u_int32_t parent, const char* name, size_t nameLength, const struct stat& sb,
+				const u_int32_t* exclusionState)
+		{
+			if (m_OneFileSystem && sb.st_dev != m_RootDevice)
+			{
+				return;
+			}
+
+			u_int32_t baseline = NO_BASELINE_DIRECTORY;
+
+			if (m_Baseline != NULL)
+			{
+				baseline = m_Baseline->find(m_Directories.get(parent).baseline, name, nameLength);
+			}
+
+			u_int32_t id = m_Directories.add(tid, parent, name, nameLength, exclusionState, baseline,
+					m_Baseline != NULL && m_Baseline->isUnchanged(baseline, sb));
+
+			if (!m_Aggregators.empty() && (m_Filter == NULL || m_Filter->match(sb)))
 			{
-				m_OutFile << sb.st_dev << "-" 
-					<< sb.st_ino << "," 
-					<< sb.st_nlink << "," 
-					<< CachedUtilities::getInstance().strftime(sb.st_atime) << "," 
-					<< CachedUtilities::getInstance().strftime(sb.st_mtime) << ","
-					<< CachedUtilities::getInstance().uidToUsername(sb.st_uid) << "," 
-					<< CachedUtilities::getInstance().gidToGroupname(sb.st_gid) << ","
-					<< CachedUtilities::getInstance().getEffectiveFilePermissions(sb.st_mode) << ","
-					<< sb.st_size << "," 
-					<< sb.st_blocks * 512ll << "," 
-					<< CachedUtilities::getInstance().getFileType(sb.st_mode) << "," 
-					<< '"' << rec.first << '"' << "\n";
+				m_Aggregators[tid]->addDirectory(id, sb);
 			}
+
+			pushDirectory(tid, id, sb.st_dev);
 		}
 
 		/**
-		 * \brief This method continuously flushes the contents of the \ref m_StatRecords variable
-		 * to a file.
+		 * \brief Copies the records of the entries of the specified directory, which is unchanged since the baseline,
+		 * from \ref m_Baseline instead of reading the directory and stating them. Its subdirectories are still stated,
+		 * so that their own changes are found.
+		 * \param reader Opens the directory, if it has subdirectories
 		 */
-		void flushThreadWork()
+		void copyBaselineDirectory(int tid, u_int32_t dir, const std::string& dirPath, RecordChunk*& chunk, DirectoryReader& reader,
+				std::vector<u_int32_t>& exclusionNodes)
 		{
-			std::pair<std::string, StarRec> record;
+			const DirectoryTable::Entry& entry = m_Directories.get(dir);
+			ExclusionFilter::State exclusionState = entry.exclusionState;
+			bool opened = false;
+			struct stat sb;
+
+			m_UnchangedDirectories++;
 
-			while(true)
+			bool copied = m_Baseline->forEachEntry(entry.baseline, [&](const StatRecord& rec, const char* name, size_t nameLength)
 			{
-				while(!m_Halted && m_StatRecords.try_pop(record))
+				// The ignore list may have changed since the baseline
+				if (exclusionState != NULL && m_Exclusions.match(exclusionState, name, nameLength, exclusionNodes))
 				{
-					statRecordToFile(record);
+					return;
 				}
 
-				if (m_Halted)
+				if (!S_ISDIR(rec.mode))
 				{
-					// Flush anything remaining
-					while(m_StatRecords.try_pop(record))
-					{
-						statRecordToFile(record);
-					}
+					// The links are accounted for anew
+					StatRecord copy = rec;
+					copy.flags = 0;
+
+					m_CopiedRecords++;
+					pushRecord(tid, chunk, copy, dir, name, nameLength);
+					return;
+				}
+
+				if (!opened && !(opened = reader.open(dirPath.c_str())))
+				{
+					std::cerr << "-- Error stating directory: " << dirPath << "\n";
+				}
+
+				if (reader.fd() >= 0 && mystat(tid, chunk, reader.fd(), name, nameLength, dir, sb) && S_ISDIR(sb.st_mode))
+				{
+					pushSubdirectory(tid, dir, name, nameLength, sb,
+							exclusionState != NULL ? m_Exclusions.store(tid, exclusionState, exclusionNodes) : NULL);
+				}
+			});
+
+			reader.close();
+
+			if (!copied)
+			{
+				std::cerr << "-- Error reading the baseline of directory: " << dirPath << "\n";
+			}
+		}
+
+		/**
+		 * \brief Adds the specified directory, given as a full path, to \ref m_Directories, looking it up in
+		 * \ref m_Baseline, and queues it to be traversed
+		 * \param sb The stat record of the directory
+		 * \param stated Set if sb is filled
+		 */
+		void pushRootDirectory(const std::string& path, const struct stat& sb, bool stated)
+		{
+			u_int32_t baseline = m_Baseline != NULL ? m_Baseline->findPath(path) : NO_BASELINE_DIRECTORY;
+			u_int32_t id = m_Directories.add(0, NO_PARENT_DIRECTORY, path.c_str(), path.size(), m_Exclusions.getState(0, path),
+					baseline, stated && m_Baseline != NULL && m_Baseline->isUnchanged(baseline, sb));
+
+			if (stated && !m_Aggregators.empty() && (m_Filter == NULL || m_Filter->match(sb)))
+			{
+				m_Aggregators[0]->addDirectory(id, sb);
+			}
 
-					break;
+			pushDirectory(0, id, stated ? sb.st_dev : m_RootDevice);
+		}
+
+		/**
+		 * \brief Opens the specified directory with the specified reader, timing the call if telemetry is not NULL
+		 */
+		inline bool openDirectory(DirectoryReader& reader, const std::string& path, ThreadTelemetry* telemetry)
+		{
+			if (telemetry == NULL)
+			{
+				return reader.open(path.c_str());
+			}
+
+			u_int64_t start = getMonotonicNanoseconds();
+			bool opened = reader.open(path.c_str());
+			telemetry->latencies[TELEMETRY_OPENDIR].addSince(start);
+
+			return opened;
+		}
+
+		/**
+		 * \brief Marks the specified number of popped directories as traversed. Must be called after all the
+		 * subdirectories of these directories are pushed. Signals the completion of the walk when no directories
+		 * are left.
+		 */
+		inline void finishDirectories(u_int64_t count)
+		{
+			if (m_PendingDirectories.fetch_sub(count) == count)
+			{
+				std::unique_lock<std::mutex> lock(m_CompletionMutex);
+				m_Completed = true;
+				m_CompletionCondition.notify_all();
+			}
+		}
+
+		/**
+		 * \brief This method continuously hands the chunks in \ref m_FullChunks to the specified shard of the sink, until the
+		 * walker is halted and all the chunks are handed over. Each shard has its own flush thread, so they never wait on one another.
+		 */
+		void flushThreadWork(int shard)
+		{
+			DirectoryPathCache paths(m_Directories);
+			RecordChunk* chunk;
+
+			while(m_FullChunks.pop(chunk))
+			{
+				u_int64_t start = m_Telemetry ? getMonotonicNanoseconds() : 0;
+
+				m_Sink.consume(shard, *chunk, paths);
+
+				if (m_Telemetry)
+				{
+					ThreadTelemetry& telemetry = m_Telemetry->getFlusher(shard);
+					telemetry.latencies[TELEMETRY_WRITE].addSince(start);
+					bumpCounter(telemetry.records, chunk->size());
+					bumpCounter(telemetry.chunks);
 				}
 
-				std::this_thread::yield();
+				m_ChunkPool.release(chunk);
+
+				if (--m_UnwrittenChunks == 0)
+				{
+					std::unique_lock<std::mutex> lock(m_FlushMutex);
+					m_FlushedCondition.notify_all();
+				}
 			}
 		}
 		
 		/**
-		 * \brief Iterates through all the directories in the \ref m_DirectoryQueue, stating each file and 
-		 * folder within each directory, and queuing directories into the queue
+		 * \brief Iterates through all the directories queued to the pool of the specified thread, stating each file and 
+		 * folder within each directory, and queuing directories into the scheduler
        */
 		void walkerThreadWork(int tid)
 		{
-			std::string dir;
-			DIR *dirstruct;
-			struct dirent *ent;
-			std::string separ;
-			std::string fullpath;
+			u_int32_t dir;
+			std::string dirPath;
+			std::vector<u_int32_t> exclusionNodes;
+			DirectoryReader reader;
+			const char* name;
+			unsigned char type;
+			struct stat sb;
+			unsigned seed = tid + 1;
+			RecordChunk* chunk = acquireChunk(tid);
+			ThreadTelemetry* telemetry = m_Telemetry ? &m_Telemetry->getWalker(tid) : NULL;
+
+			if (telemetry != NULL)
+			{
+				reader.setReadLatency(&telemetry->latencies[TELEMETRY_READDIR]);
+			}
 
-			while (true)
+			// Parks while there is no work, exits once halted
+			while (popDirectory(tid, dir, seed, chunk))
 			{
-				while (!m_Halted && !m_DirectoryQueue.try_pop(dir))
+				// Traverse the directory. Its path is resolved once here, all entries are then
+				// stated relative to the open directory file descriptor
+				m_Directories.getPath(dir, dirPath);
+				ExclusionFilter::State exclusionState = m_Directories.get(dir).exclusionState;
+
+				if (telemetry != NULL)
 				{
-					// Busy-wait
-					std::this_thread::yield();
+					bumpCounter(telemetry->directories);
 				}
 
-				// Exit flag
-				if (m_Halted)
+				if (m_Directories.get(dir).unchanged)
 				{
-					break;
+					copyBaselineDirectory(tid, dir, dirPath, chunk, reader, exclusionNodes);
 				}
-
-				separ = (*dir.rbegin() != '/' ? "/" : ""); // *dir.rbegin() is equivalent to dir.back() of c++11
-
-				// Traverse the directory
-				if ((dirstruct = opendir(dir.c_str())) != NULL)
+				else if (openDirectory(reader, dirPath, telemetry))
 				{
-					while ((ent = readdir(dirstruct)) != NULL)
+					while (reader.next(name, type))
 					{
-						std::stringstream ss;
+						size_t nameLength = strlen(name);
 
-						// ignore . and ..
-						if(strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+						// Skip the excluded entries, along with their subtree
+						if (exclusionState != NULL && m_Exclusions.match(exclusionState, name, nameLength, exclusionNodes))
 						{
 							continue;
 						}
 
-						ss << dir << separ << ent->d_name;
-						fullpath = ss.str();
-						
-						// Hash and check if the file is to be ignored.
-						// This has a probability of 1/size_t of false-positives
-						if(m_SkipListHashes.count(m_HashFunction(fullpath)) != 0)
+						// Push path to stat threads
+						if (!mystat(tid, chunk, reader.fd(), name, nameLength, dir, sb))
 						{
 							continue;
 						}
 
-						// Push dirs to walker threads
-						if (ent->d_type == DT_DIR)
+						// Push dirs to walker threads. Some filesystems do not fill d_type, in which case
+						// the stat record tells
+						if (type == DT_DIR || (type == DT_UNKNOWN && S_ISDIR(sb.st_mode)))
 						{
-							m_DirectoryQueue.emplace(fullpath);
+							pushSubdirectory(tid, dir, name, nameLength, sb,
+									exclusionState != NULL ? m_Exclusions.store(tid, exclusionState, exclusionNodes) : NULL);
 						}
+					}
 
-						// Push path to stat threads
-						mystat(fullpath);
+					// The entries read so far are output, but the directory is not complete
+					if (reader.getError() != 0)
+					{
+						std::cerr << "-- Error reading directory: " << dirPath << ": " << strerror(reader.getError()) << "\n";
 					}
 
-					closedir(dirstruct);
+					reader.close();
 				}
 				else
 				{
-					std::cerr << "-- Error stating directory: " << dir << "\n";
+					std::cerr << "-- Error stating directory: " << dirPath << "\n";
 				}
+
+				finishDirectories(1);
 			}
+
+			flushChunk(tid, chunk);
+			m_ChunkPool.release(chunk);
 		}
 
-	public:
-		
+#ifdef HAVE_IO_URING_
 		/**
-		 * \brief Creates a walker with the specified parameters
-       * \param path Root path to collect stat from
-       * \param outputCsvPath Path to output CSV file
-       * \param skipList A list of full paths to be skipped
-       * \param human Set to true to get human-readable output (or false for raw)
-       * \param walkerThreads The number of walker threads. Experiments show that setting it to 2x number of cores can yield the best performance
-       */
-		Walker(const std::string& path, const std::string& outputCsvPath, std::set<std::string> skipList, bool human = false, int walkerThreads = 4)
+		 * \brief A statx() request in flight through io_uring
+		 */
+		struct UringStatSlot
 		{
-			m_TotalStated = 0;
-			m_Halted = false;
-			m_RawOutput = !human;
+			std::string name; //!< Name of the entry
+			u_int32_t parent; //!< Id of the directory containing the entry
+			unsigned char type; //!< d_type of the entry
+			const u_int32_t* exclusionState; //!< State of the \ref ExclusionFilter within the entry, should it be a directory
+			struct statx stx; //!< Receives the statx record
+			u_int64_t start; //!< When the request was prepared, as a time of \ref getMonotonicNanoseconds(), if instrumented
+		};
 
-			m_OutFile.open(outputCsvPath.c_str());
-			
-			if(m_RawOutput)
-			{
-				m_OutFile << "INODE,ACCESSED,MODIFIED,USER,GROUP,MODE,SIZE,DISK,PATH" << std::endl;
-			}
-			else
+		/**
+		 * \brief Same as \ref walkerThreadWork(), but instead of one blocking system call per entry, opens a batch of
+		 * directories and stats their entries through an io_uring, keeping up to \ref IO_URING_QUEUE_DEPTH requests in
+		 * flight. Falls back to \ref walkerThreadWork() if the ring cannot be set up.
+		 */
+		void uringWalkerThreadWork(int tid)
+		{
+			IoUring ring;
+
+			if (!ring.init(IO_URING_QUEUE_DEPTH))
 			{
-				m_OutFile << "INODE,LINKS,ACCESSED,MODIFIED,USER,GROUP,PERM,SIZE,DISK,TYPE,PATH" << std::endl;			
+				walkerThreadWork(tid);
+				return;
 			}
-			// Convert all skipped paths to hashes - performance baby
-			for(const std::string& p : skipList)
+
+			std::vector<u_int32_t> dirs(IO_URING_DIRECTORY_BATCH);
+			std::vector<std::string> dirPaths(IO_URING_DIRECTORY_BATCH);
+			std::vector<int> dirfds(IO_URING_DIRECTORY_BATCH);
+			std::string fullpath;
+			std::vector<u_int32_t> exclusionNodes;
+			std::vector<UringStatSlot> slots(IO_URING_QUEUE_DEPTH);
+			std::vector<unsigned> freeSlots;
+			DirectoryReader reader;
+			const char* name;
+			unsigned char type;
+			struct stat sb;
+			RecordChunk* chunk = acquireChunk(tid);
+
+			for (unsigned i = 0; i < slots.size(); i++)
 			{
-				m_SkipListHashes[m_HashFunction(p)] = true;
+				freeSlots.push_back(i);
 			}
-			
-			// Stat the root path
-			mystat(path);
-			
-			// Push the first directory to be traversed
-			m_DirectoryQueue.push(path);
 
-			// Start walker threads
-			for(int i = 0; i < walkerThreads; i++)
+			// Handles all the available statx() completions, returning their slots to the free list
+			auto reap = [&]()
 			{
-				m_WalkStatThreads.push_back(std::thread(&Walker::walkerThreadWork, this, i));
-			}
+				io_uring_cqe* cqe;
 
-			// Start flushing threads
-			for(int i = 0; i < OUTPUT_THREADS_COUNT; i++)
+				while ((cqe = ring.peek()) != NULL)
+				{
+					UringStatSlot& slot = slots[cqe->user_data];
+
+					// Includes the time spent queued in the ring, as the calls in flight wait for each other
+					if (m_Telemetry)
+					{
+						m_Telemetry->getWalker(tid).latencies[TELEMETRY_STAT].addSince(slot.start);
+					}
+
+					if (cqe->res < 0)
+					{
+						getEntryPath(slot.parent, slot.name.c_str(), slot.name.size(), fullpath);
+						std::cerr << "-- Error stating file: " << fullpath << "\n";
+					}
+					else
+					{
+						StatBackend::statxToStat(slot.stx, sb);
+						pushRecord(tid, chunk, sb, slot.parent, slot.name.c_str(), slot.name.size());
+
+						if (slot.type == DT_DIR || (slot.type == DT_UNKNOWN && S_ISDIR(sb.st_mode)))
+						{
+							pushSubdirectory(tid, slot.parent, slot.name.c_str(), slot.name.size(), sb, slot.exclusionState);
+						}
+					}
+
+					freeSlots.push_back(cqe->user_data);
+					ring.seen();
+				}
+			};
+
+			// Submits the prepared requests, waiting for the specified number of completions. An interrupted or busy
+			// wait returns early, the callers loop until they get what they wait for. Any other failure leaves
+			// requests in flight whose buffers the kernel may still write to, so the walk cannot go on
+			auto submit = [&](unsigned waitCount)
 			{
-				m_FlushThreads.push_back(std::thread(&Walker::flushThreadWork, this));
-			}
-		}
+				int ret = ring.submit(waitCount);
 
-		/**
-		 * \brief Gracefully stops all the threads within the threadpools
-       */
-		void halt()
-		{
-			m_Halted = true;
+				if (ret < 0 && ret != -EINTR && ret != -EAGAIN && ret != -EBUSY)
+				{
+					std::cerr << "-- Error submitting to io_uring: " << strerror(-ret) << "\n";
+					abort();
+				}
+			};
 
-			for(std::thread& t : m_WalkStatThreads)
+			unsigned seed = tid + 1;
+			DevicePool& pool = *m_Pools[m_ThreadPools[tid]];
+			ThreadTelemetry* telemetry = m_Telemetry ? &m_Telemetry->getWalker(tid) : NULL;
+
+			// The opens and stats are asynchronous, only the reads of the directories are timed
+			if (telemetry != NULL)
 			{
-				t.join();
+				reader.setReadLatency(&telemetry->latencies[TELEMETRY_READDIR]);
 			}
 
-			for(std::thread& t : m_FlushThreads)
+			// Parks while there is no work, exits once halted
+			while (popDirectory(tid, dirs[0], seed, chunk))
 			{
-				t.join();
-			}
+				// Grab more directories if available, and open them all at once
+				size_t count = 1;
 
-			m_OutFile.flush();
+				while (count < dirs.size() && pool.scheduler.tryPop(tid - pool.firstThread, dirs[count], seed))
+				{
+					count++;
+				}
+
+				if (telemetry != NULL)
+				{
+					bumpCounter(telemetry->directories, count);
+				}
+
+				// Directories unchanged since the baseline are not read
+				for (size_t i = 0; i < count; )
+				{
+					if (m_Directories.get(dirs[i]).unchanged)
+					{
+						m_Directories.getPath(dirs[i], dirPaths[i]);
+						copyBaselineDirectory(tid, dirs[i], dirPaths[i], chunk, reader, exclusionNodes);
+						finishDirectories(1);
+						dirs[i] = dirs[--count];
+					}
+					else
+					{
+						i++;
+					}
+				}
+
+				if (count == 0)
+				{
+					continue;
+				}
+
+				for (size_t i = 0; i < count; i++)
+				{
+					m_Directories.getPath(dirs[i], dirPaths[i]);
+					ring.prepareOpenat(AT_FDCWD, dirPaths[i].c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC, i);
+				}
+
+				for (size_t opened = 0; opened < count; )
+				{
+					submit(1);
+
+					io_uring_cqe* cqe;
+
+					while ((cqe = ring.peek()) != NULL)
+					{
+						dirfds[cqe->user_data] = cqe->res;
+						ring.seen();
+						opened++;
+					}
+				}
+
+				// Stat the entries of all the opened directories, keeping the directories open until all
+				// of their requests complete
+				for (size_t i = 0; i < count; i++)
+				{
+					if (dirfds[i] < 0 || !reader.attach(dirfds[i]))
+					{
+						std::cerr << "-- Error stating directory: " << dirPaths[i] << "\n";
+						continue;
+					}
+
+					ExclusionFilter::State exclusionState = m_Directories.get(dirs[i]).exclusionState;
+
+					while (reader.next(name, type))
+					{
+						while (freeSlots.empty())
+						{
+							submit(1);
+							reap();
+						}
+
+						unsigned index = freeSlots.back();
+						UringStatSlot& slot = slots[index];
+
+						slot.name.assign(name);
+						slot.parent = dirs[i];
+						slot.type = type;
+						slot.exclusionState = NULL;
+
+						// Skip the excluded entries, along with their subtree
+						if (exclusionState != NULL)
+						{
+							if (m_Exclusions.match(exclusionState, slot.name.c_str(), slot.name.size(), exclusionNodes))
+							{
+								continue;
+							}
+
+							if (type == DT_DIR || type == DT_UNKNOWN)
+							{
+								slot.exclusionState = m_Exclusions.store(tid, exclusionState, exclusionNodes);
+							}
+						}
+
+						// Taken before reaping, which returns slots to the free list
+						freeSlots.pop_back();
+						slot.start = m_Telemetry ? getMonotonicNanoseconds() : 0;
+
+						while (ring.prepareStatx(dirfds[i], slot.name.c_str(), m_StatBackend.getStatxFlags(),
+								m_StatBackend.getStatxMask(), &slot.stx, index) == NULL)
+						{
+							// Submission queue is full
+							submit(0);
+							reap();
+						}
+					}
+
+					if (reader.getError() != 0)
+					{
+						std::cerr << "-- Error reading directory: " << dirPaths[i] << ": " << strerror(reader.getError()) << "\n";
+					}
+
+					submit(0);
+					reap();
+				}
+
+				// Drain the remaining requests before closing the directories
+				while (freeSlots.size() < slots.size())
+				{
+					submit(1);
+					reap();
+				}
+
+				for (size_t i = 0; i < count; i++)
+				{
+					if (dirfds[i] >= 0)
+					{
+						close(dirfds[i]);
+					}
+				}
+
+				finishDirectories(count);
+			}
+
+			flushChunk(tid, chunk);
+			m_ChunkPool.release(chunk);
+		}
+#endif
+
+		/**
+		 * \brief Returns the number of directories queued to all the pools, and not being traversed yet
+		 */
+		size_t countQueuedDirectories() const
+		{
+			size_t queued = 0;
+
+			for (const std::unique_ptr<DevicePool>& pool : m_Pools)
+			{
+				queued += pool->scheduler.size();
+			}
+
+			return queued;
+		}
+
+		/**
+		 * \brief Gracefully stops all the threads within the threadpools, once the flush threads have handed all the
+		 * chunks to the sink. Does nothing if already halted.
+       */
+		void halt()
+		{
+			if (m_Halted)
+			{
+				return;
+			}
+
+			m_Halted = true;
+
+			for (std::unique_ptr<DevicePool>& pool : m_Pools)
+			{
+				pool->scheduler.stop();
+			}
+
+			for(std::thread& t : m_WalkStatThreads)
+			{
+				t.join();
+			}
+
+			// All the walker threads have handed their last chunks, let the flush threads drain them and exit
+			m_FullChunks.close();
+
+			for(std::thread& t : m_FlushThreads)
+			{
+				t.join();
+			}
+
+			for (size_t i = 1; i < m_Aggregators.size(); i++)
+			{
+				m_Aggregators[0]->merge(*m_Aggregators[i]);
+			}
+		}
+
+	public:
+		
+		/**
+		 * \brief Creates a walker with the specified options. No directory is traversed until \ref start() is called.
+		 * \param sink Receives the records collected. It must outlive the walker
+		 * \param path Root path to collect stat from
+		 */
+		Walker(Sink& sink, const std::string& path, const WalkerOptions& options = WalkerOptions())
+				: m_Path(path), m_Sink(sink), m_Resume(options.resume),
+				m_WalkerThreads(countWalkerThreads(options.walkerThreads, options.deviceThreads)), m_Directories(m_WalkerThreads),
+				m_Exclusions(options.skipList, m_WalkerThreads), m_Baseline(options.baseline), m_Filter(options.filter),
+				m_HardlinkMode(options.hardlinks), m_OneFileSystem(options.oneFileSystem), m_RootDevice(0), m_MemoryBudget(options.maxMemory),
+				m_StatBackend(sink.getStatFields() | (options.baseline != NULL ? STAT_FIELD_CTIME : 0)
+				| (options.filter != NULL ? options.filter->getStatFields() : 0) | (options.hardlinks != HARDLINKS_COUNT ? STAT_FIELD_NLINK : 0),
+				options.useStatx, options.dontSync)
+		{
+#ifdef HAVE_IO_URING_
+			m_UseIoUring = options.useIoUring && IoUring::isSupported();
+#else
+			m_UseIoUring = false;
+#endif
+			m_TotalStated = 0;
+			m_MatchedRecords = 0;
+			m_DuplicateLinks = 0;
+			m_UnwrittenChunks = 0;
+			m_CopiedRecords = 0;
+			m_UnchangedDirectories = 0;
+			m_PendingDirectories = 0;
+			m_Completed = false;
+			m_Started = false;
+			m_Halted = false;
+
+			// Split the walker threads into pools: the first one for the devices without a pool of their own
+			m_Pools.push_back(std::unique_ptr<DevicePool>(new DevicePool(0, options.walkerThreads)));
+			m_ThreadPools.assign(options.walkerThreads, 0);
+
+			for (const std::pair<const dev_t, int>& device : options.deviceThreads)
+			{
+				m_DevicePools[device.first] = m_Pools.size();
+				m_ThreadPools.insert(m_ThreadPools.end(), device.second, m_Pools.size());
+				m_Pools.push_back(std::unique_ptr<DevicePool>(new DevicePool(m_ThreadPools.size() - device.second, device.second)));
+			}
+
+			if (options.aggregate)
+			{
+				for (int i = 0; i < m_WalkerThreads; i++)
+				{
+					m_Aggregators.push_back(std::unique_ptr<Aggregator>(new Aggregator(time(NULL))));
+				}
+			}
+
+			if (options.telemetry)
+			{
+				m_Telemetry.reset(new Telemetry(m_WalkerThreads, options.aggregate ? 0 : sink.getShardsCount()));
+			}
+		}
+
+		/**
+		 * \brief Stats the root path (unless resuming), and starts the walker and flush threads. Must be called once.
+		 */
+		void start()
+		{
+			int walkerThreads = m_ThreadPools.size();
+			int shards = m_Aggregators.empty() ? m_Sink.getShardsCount() : 0;
+			struct stat sb;
+
+			m_Started = true;
+			balanceMemory();
+
+			if (m_Resume == NULL)
+			{
+				// Stat the root path
+				RecordChunk* chunk = m_ChunkPool.acquire();
+				bool stated = mystat(0, chunk, AT_FDCWD, m_Path.c_str(), m_Path.size(), NO_PARENT_DIRECTORY, sb);
+				m_RootDevice = stated ? sb.st_dev : 0;
+
+				if (!chunk->isEmpty())
+				{
+					handChunk(chunk);
+				}
+				else
+				{
+					m_ChunkPool.release(chunk);
+				}
+
+				// Push the first directory to be traversed
+				pushRootDirectory(m_Path, sb, stated);
+			}
+			else
+			{
+				if (m_StatBackend.stat(AT_FDCWD, m_Path.c_str(), sb))
+				{
+					m_RootDevice = sb.st_dev;
+				}
+
+				// Push the directories left to be traversed. Their own records are already in the output
+				for (const std::string& dir : m_Resume->directories)
+				{
+					pushRootDirectory(dir, sb, m_StatBackend.stat(AT_FDCWD, dir.c_str(), sb));
+				}
+
+				m_TotalStated = m_Resume->stated;
+				m_MatchedRecords = m_Resume->matched;
+
+				std::unique_lock<std::mutex> lock(m_CompletionMutex);
+				m_Completed = m_PendingDirectories == 0;
+			}
+
+			// Start walker threads
+			for(int i = 0; i < walkerThreads; i++)
+			{
+#ifdef HAVE_IO_URING_
+				if (m_UseIoUring)
+				{
+					m_WalkStatThreads.push_back(std::thread(&Walker::uringWalkerThreadWork, this, i));
+					continue;
+				}
+#endif
+				m_WalkStatThreads.push_back(std::thread(&Walker::walkerThreadWork, this, i));
+			}
+
+			// Start flushing threads
+			for(int i = 0; i < shards; i++)
+			{
+				m_FlushThreads.push_back(std::thread(&Walker::flushThreadWork, this, i));
+			}
+		}
+
+		/**
+		 * \brief Blocks until all the directories are traversed, or until the specified timeout expires
+		 * \param timeoutMs Maximum time to wait, in milliseconds
+		 * \return True if the walk is complete, false if the timeout expired first
+		 */
+		bool waitForCompletion(unsigned long timeoutMs)
+		{
+			std::unique_lock<std::mutex> lock(m_CompletionMutex);
+
+			return m_CompletionCondition.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this]() { return m_Completed; });
+		}
+
+		/**
+		 * \brief Takes a checkpoint of the collection, from which it can be resumed should it be interrupted. The walker
+		 * threads are paused between two directories, the records collected so far are written and flushed to disk,
+		 * then the directories left to be traversed are listed in the specified checkpoint file, which is replaced
+		 * atomically. Errors are reported to stderr. Does not apply when aggregating. The sink must provide sync().
+		 * \return True on success, false otherwise
+		 */
+		bool checkpoint(const std::string& file)
+		{
+			Checkpoint state;
+			std::vector<u_int32_t> pending;
+
+			for (std::unique_ptr<DevicePool>& pool : m_Pools)
+			{
+				pool->scheduler.pause();
+			}
+
+			// The walker threads handed their chunks before parking, let the flush threads write them
+			{
+				std::unique_lock<std::mutex> lock(m_FlushMutex);
+
+				while (m_UnwrittenChunks > 0)
+				{
+					m_FlushedCondition.wait(lock);
+				}
+			}
+
+			bool synced = m_Sink.sync(state);
+
+			for (std::unique_ptr<DevicePool>& pool : m_Pools)
+			{
+				pool->scheduler.getItems(pending);
+			}
+
+			state.stated = m_TotalStated;
+			state.matched = m_MatchedRecords;
+
+			for (std::unique_ptr<DevicePool>& pool : m_Pools)
+			{
+				pool->scheduler.resume();
+			}
+
+			if (!synced)
+			{
+				return false;
+			}
+
+			state.path = m_Path;
+			state.baseline = m_Baseline != NULL ? m_Baseline->getPath() : "";
+			state.directories.resize(pending.size());
+
+			for (size_t i = 0; i < pending.size(); i++)
+			{
+				m_Directories.getPath(pending[i], state.directories[i]);
+			}
+
+			if (!state.write(file))
+			{
+				std::cerr << "-- Error writing the checkpoint: " << state.getError() << "\n";
+				return false;
+			}
+
+			return true;
+		}
+
+		/**
+		 * \brief Replaces the specified file with the counters and latencies of the walker and flush threads, and the
+		 * current depths of the queues (see \ref Telemetry::write()). Errors are reported to stderr. Only applies if the
+		 * walker is instrumented.
+		 * \return True on success, false otherwise
+		 */
+		bool writeTelemetry(const std::string& file)
+		{
+			if (!m_Telemetry)
+			{
+				return false;
+			}
+
+			TelemetryGauges gauges = {countQueuedDirectories(), m_PendingDirectories, m_UnwrittenChunks, 0, m_Directories.size(),
+					m_ChunkPool.getAllocatedCount(), getMemoryBytes(), m_MemoryBudget, m_Pools[0]->scheduler.isDepthFirst()};
+
+			for (std::unique_ptr<DevicePool>& pool : m_Pools)
+			{
+				gauges.activeWalkerThreads += pool->scheduler.getActiveWorkers();
+			}
+
+			int error = m_Telemetry->write(file, gauges);
+
+			if (error != 0)
+			{
+				std::cerr << "-- Error writing the telemetry file: " << file << ": " << strerror(error) << "\n";
+				return false;
+			}
+
+			return true;
+		}
+
+		/**
+		 * \brief Shares the memory budget among the buffers of the walker. The directory table, the set of the linked
+		 * inodes and the queues of directories are needed for the walk to go on, so the chunks of records get what they
+		 * leave: once they are all in use, the walker threads wait for the flush threads to write one, rather than
+		 * collecting more records than the sink takes. They always get at least one chunk each, plus two per flush
+		 * thread, so a budget too small for the directory table slows the walk down but does not stop it.
+		 * Also holds the walker threads depth-first while the queued directories take more than
+		 * 1/\ref FRONTIER_MEMORY_SHARE of the budget, so that wide trees do not pile up directories breadth-first, and
+		 * lets them spread breadth-first again once the queues are down to half that.
+		 * Called by \ref start(), then meant to be called periodically, as the directory table grows. Does nothing
+		 * without a budget.
+		 */
+		void balanceMemory()
+		{
+			if (m_MemoryBudget == 0)
+			{
+				return;
+			}
+
+			size_t queued = countQueuedDirectories();
+			size_t used = m_Directories.getAllocatedBytes() + m_LinkedInodes.getAllocatedBytes() + queued * sizeof(u_int32_t);
+			size_t shards = m_Aggregators.empty() ? m_Sink.getShardsCount() : 0;
+			size_t minChunks = m_ThreadPools.size() + 2 * shards + 1;
+
+			m_ChunkPool.setMaxChunks(std::max(minChunks, used < m_MemoryBudget ? (m_MemoryBudget - used) / m_ChunkPool.getChunkBytes() : 0));
+
+			// A queued directory holds its entry in the table, its name (taken as 32 bytes) and its slot in a deque
+			size_t frontierBytes = queued * (sizeof(DirectoryTable::Entry) + 32 + sizeof(u_int32_t));
+			size_t frontierBudget = m_MemoryBudget / FRONTIER_MEMORY_SHARE;
+			bool depthFirst = frontierBytes > (m_Pools[0]->scheduler.isDepthFirst() ? frontierBudget / 2 : frontierBudget);
+
+			for (std::unique_ptr<DevicePool>& pool : m_Pools)
+			{
+				pool->scheduler.setDepthFirst(depthFirst);
+			}
+		}
+
+		/**
+		 * \brief Returns the approximate number of bytes used by the buffers of the walker: the chunks of records, the
+		 * directory table, the set of the linked inodes and the queues of directories. The sink, the baseline and the
+		 * filter are not accounted for.
+		 */
+		size_t getMemoryBytes()
+		{
+			return m_ChunkPool.getAllocatedCount() * m_ChunkPool.getChunkBytes() + m_Directories.getAllocatedBytes()
+					+ m_LinkedInodes.getAllocatedBytes() + countQueuedDirectories() * sizeof(u_int32_t);
+		}
+
+		/**
+		 * \brief Returns the number of directories queued or being traversed
+		 */
+		u_int64_t getPendingDirectoriesCount() const
+		{
+			return m_PendingDirectories;
+		}
+
+		/**
+		 * \brief Returns true if the walker threads are held depth-first (see \ref balanceMemory())
+		 */
+		bool isDepthFirst() const
+		{
+			return m_Pools[0]->scheduler.isDepthFirst();
+		}
+
+		/**
+		 * \brief Blocks until all the directories are traversed, and the sink holds all their records. Must be called
+		 * after \ref start().
+		 */
+		void wait()
+		{
+			{
+				std::unique_lock<std::mutex> lock(m_CompletionMutex);
+				m_CompletionCondition.wait(lock, [this]() { return m_Completed; });
+			}
+
+			halt();
+		}
+
+		/**
+		 * \brief Stops the collection before all the directories are traversed. The walker threads finish their current
+		 * directory, and the records collected so far are handed to the sink before it returns.
+		 */
+		void cancel()
+		{
+			halt();
+		}
+
+		/**
+		 * \brief Writes the summary tables of the records aggregated (see \ref Aggregator::write()). Only applies when
+		 * aggregating, once the collection is over.
+		 * \param depth Maximum depth, below the collected path, of the directories listed
+		 * \param human Set to true to write the names of the owners instead of their ids
+		 */
+		void writeSummary(const std::string& path, u_int32_t depth, bool human)
+		{
+			if (!m_Aggregators.empty())
+			{
+				m_Aggregators[0]->write(path, m_Directories, depth, human);
+			}
+		}
+		/**
+		 * \brief Returns the total number of walker threads: those of the first pool, and those of the device pools
+		 */
+		static int countWalkerThreads(int walkerThreads, const std::map<dev_t, int>& deviceThreads)
+		{
+			for (const std::pair<const dev_t, int>& device : deviceThreads)
+			{
+				walkerThreads += device.second;
+			}
+
+			return walkerThreads;
+		}
+
+		/**
+		 * \brief Returns true if stat records are collected using statx()
+		 */
+		bool isUsingStatx() const
+		{
+			return m_StatBackend.isUsingStatx();
+		}
+
+		/**
+		 * \brief Returns true if walker threads use io_uring
+		 */
+		bool isUsingIoUring() const
+		{
+			return m_UseIoUring;
+		}
+
+		/**
+		 * \brief Sets the number of active walker threads of the first pool (the one that traverses the devices without
+		 * a pool of their own). The other threads of the pool park once done with their current directory.
+		 */
+		void setActiveWalkerThreads(int threads)
+		{
+			m_Pools[0]->scheduler.setActiveWorkers(threads);
+		}
+
+		/**
+		 * \brief Returns the number of directories queued to the first pool, and not being traversed yet
+		 */
+		size_t getQueuedDirectoriesCount() const
+		{
+			return m_Pools[0]->scheduler.size();
+		}
+
+		/**
+		 * \brief Returns the number of records selected by the filter so far
+		 */
+		u_int64_t getMatchedRecordsCount() const
+		{
+			return m_MatchedRecords;
+		}
+
+		/**
+		 * \brief Gets the number of stat calls completed so far, and their total latency in nanoseconds. Only applies if
+		 * the walker is instrumented.
+		 * \return True on success, false if the walker is not instrumented
+		 */
+		bool getStatLatencies(u_int64_t& count, u_int64_t& sum) const
+		{
+			if (!m_Telemetry)
+			{
+				return false;
+			}
+
+			m_Telemetry->getWalkerLatencies(TELEMETRY_STAT, count, sum);
+
+			return true;
+		}
+
+		/**
+		 * \brief Returns the number of records found to be further links of an inode so far
+		 */
+		u_int64_t getDuplicateLinksCount() const
+		{
+			return m_DuplicateLinks;
+		}
+
+		/**
+		 * \brief Returns the number of records copied from the baseline so far
+		 */
+		u_int64_t getCopiedRecordsCount() const
+		{
+			return m_CopiedRecords;
+		}
+
+		/**
+		 * \brief Returns the number of directories found unchanged since the baseline so far
+		 */
+		u_int64_t getUnchangedDirectoriesCount() const
+		{
+			return m_UnchangedDirectories;
 		}
 
 		/**
@@ -0,0 +1,316 @@
+#ifndef WORKSTEALINGSCHEDULER_HPP
+#define	WORKSTEALINGSCHEDULER_HPP
+
+#include <algorithm>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+namespace pstat
+{
+	/**
+	 * \brief Schedules work items among a fixed set of worker threads. Each worker owns a deque; it pushes and pops
+	 * its own items in LIFO order (so it works depth-first on its own subtree, which keeps the dentry cache warm),
+	 * and when it runs dry it steals the oldest items of randomly-chosen victims. Workers that find no work at all
+	 * park on a condition variable instead of spinning, and are woken up by the next push.
+	 * The scheduler can be paused, so that its owner inspects the queued items while no worker holds any, and the
+	 * number of active workers can be lowered: the other ones get no items and park, their queued items being stolen.
+	 * Stealing the oldest items spreads the workers breadth-first, which lets the queued items pile up on wide trees;
+	 * in depth-first mode, thieves steal the newest items instead, so that every worker stays deep in the tree.
+	 * All the methods are thread-safe.
+	 */
+	template<typename T>
+	class WorkStealingScheduler
+	{
+		/**
+		 * \brief A worker's deque. Each one is allocated separately and padded, so that workers do not false-share
+		 */
+		struct WorkerDeque
+		{
+			char padding[64]; //!< Keeps the tail of the previous allocation off the cache line of the mutex
+			std::mutex mutex; //!< Guards items. Mostly uncontended, since only thieves compete with the owner
+			std::deque<T> items; //!< The owner pushes/pops at the back, thieves steal from the front
+		};
+
+		std::vector<std::unique_ptr<WorkerDeque>> m_Deques; //!< One deque per worker
+		std::atomic<long> m_Size; //!< Total number of items in all the deques. Might transiently go negative, as it is updated after the deques
+		std::atomic<int> m_Parked; //!< Number of workers parked (or about to park)
+		std::mutex m_ParkMutex; //!< Serializes parking with the wake-ups
+		std::condition_variable m_ParkCondition; //!< Parked active workers wait on this
+		std::condition_variable m_InactiveCondition; //!< Inactive workers wait on this, so that the wake-ups of the pushes go to active ones
+		std::atomic<bool> m_Stopped; //!< Once set, \ref pop() returns false
+		std::atomic<bool> m_Paused; //!< While set, workers get no items and park
+		std::atomic<int> m_Active; //!< Workers 0..m_Active-1 are active, the other ones get no items and park
+		std::condition_variable m_IdleCondition; //!< Notified when a worker parks while paused
+		std::atomic<bool> m_DepthFirst; //!< While set, thieves steal the most recently pushed items instead of the oldest
+
+		/**
+		 * \brief Pops the most recently pushed item of the specified worker's deque
+		 */
+		bool popOwn(int worker, T& item)
+		{
+			WorkerDeque& d = *m_Deques[worker];
+			std::unique_lock<std::mutex> lock(d.mutex);
+
+			if (d.items.empty() || m_Paused)
+			{
+				return false;
+			}
+
+			item = std::move(d.items.back());
+			d.items.pop_back();
+			m_Size--;
+
+			return true;
+		}
+
+		/**
+		 * \brief Steals the oldest item of the specified victim's deque, or its newest one in depth-first mode
+		 */
+		bool steal(int victim, T& item)
+		{
+			WorkerDeque& d = *m_Deques[victim];
+			std::unique_lock<std::mutex> lock(d.mutex);
+
+			if (d.items.empty() || m_Paused)
+			{
+				return false;
+			}
+
+			if (m_DepthFirst)
+			{
+				item = std::move(d.items.back());
+				d.items.pop_back();
+			}
+			else
+			{
+				item = std::move(d.items.front());
+				d.items.pop_front();
+			}
+
+			m_Size--;
+
+			return true;
+		}
+
+	public:
+
+		/**
+		 * \brief Creates a scheduler for the specified number of workers, identified by 0..workers-1
+		 */
+		WorkStealingScheduler(int workers)
+		{
+			for (int i = 0; i < workers; i++)
+			{
+				m_Deques.push_back(std::unique_ptr<WorkerDeque>(new WorkerDeque()));
+			}
+
+			m_Size = 0;
+			m_Parked = 0;
+			m_Stopped = false;
+			m_Paused = false;
+			m_Active = workers;
+			m_DepthFirst = false;
+		}
+
+		/**
+		 * \brief Pushes the specified item to the deque of the specified worker, waking up a parked worker if any
+		 */
+		void push(int worker, const T& item)
+		{
+			WorkerDeque& d = *m_Deques[worker];
+
+			{
+				std::unique_lock<std::mutex> lock(d.mutex);
+				d.items.push_back(item);
+			}
+
+			// Parkers increment m_Parked before checking m_Size, and we increment m_Size before checking m_Parked,
+			// so a push cannot slip between a parker's check and its wait
+			m_Size++;
+
+			if (m_Parked > 0)
+			{
+				std::unique_lock<std::mutex> lock(m_ParkMutex);
+				m_ParkCondition.notify_one();
+			}
+		}
+
+		/**
+		 * \brief Pops an item without blocking: from the worker's own deque first, then from the other workers'
+		 * \param worker The calling worker
+		 * \param seed The caller's random state, used to pick the first victim. Updated by this method.
+		 * \return True if an item is popped, false if no work is available
+		 */
+		bool tryPop(int worker, T& item, unsigned& seed)
+		{
+			if (worker >= m_Active)
+			{
+				return false;
+			}
+
+			if (popOwn(worker, item))
+			{
+				return true;
+			}
+
+			if (m_Size <= 0)
+			{
+				return false;
+			}
+
+			// xorshift, to spread the thieves among the victims
+			seed ^= seed << 13;
+			seed ^= seed >> 17;
+			seed ^= seed << 5;
+
+			int count = m_Deques.size();
+			int first = seed % count;
+
+			for (int i = 0; i < count; i++)
+			{
+				int victim = (first + i) % count;
+
+				if (victim != worker && steal(victim, item))
+				{
+					return true;
+				}
+			}
+
+			return false;
+		}
+
+		/**
+		 * \brief Pops an item, parking the calling worker while no work is available
+		 * \return True if an item is popped, false if the scheduler is stopped
+		 */
+		bool pop(int worker, T& item, unsigned& seed)
+		{
+			while (!m_Stopped)
+			{
+				if (tryPop(worker, item, seed))
+				{
+					return true;
+				}
+
+				std::unique_lock<std::mutex> lock(m_ParkMutex);
+
+				m_Parked++;
+
+				if (m_Paused)
+				{
+					m_IdleCondition.notify_all();
+				}
+
+				while (!m_Stopped && (m_Size <= 0 || m_Paused || worker >= m_Active))
+				{
+					(worker >= m_Active ? m_InactiveCondition : m_ParkCondition).wait(lock);
+				}
+
+				m_Parked--;
+			}
+
+			return false;
+		}
+
+		/**
+		 * \brief Returns the number of queued items
+		 */
+		size_t size() const
+		{
+			return std::max(m_Size.load(), 0l);
+		}
+
+		/**
+		 * \brief Stops handing out items, and waits until all the workers are parked. Workers that hold an item keep
+		 * it until they call \ref pop() again, so when this method returns, every item not yet done is in a deque.
+		 * Must not be called by a worker.
+		 */
+		void pause()
+		{
+			std::unique_lock<std::mutex> lock(m_ParkMutex);
+			m_Paused = true;
+
+			while (!m_Stopped && m_Parked < static_cast<int>(m_Deques.size()))
+			{
+				m_IdleCondition.wait(lock);
+			}
+		}
+
+		/**
+		 * \brief Hands out items again, after \ref pause()
+		 */
+		void resume()
+		{
+			std::unique_lock<std::mutex> lock(m_ParkMutex);
+			m_Paused = false;
+			m_ParkCondition.notify_all();
+			m_InactiveCondition.notify_all();
+		}
+
+		/**
+		 * \brief Sets the number of active workers: workers 0..active-1 get items, the other ones park once they are done
+		 * with the item they hold, if any, and their queued items are left to be stolen by the active ones
+		 */
+		void setActiveWorkers(int active)
+		{
+			std::unique_lock<std::mutex> lock(m_ParkMutex);
+			m_Active = std::max(1, std::min(active, static_cast<int>(m_Deques.size())));
+			m_ParkCondition.notify_all();
+			m_InactiveCondition.notify_all();
+		}
+
+		/**
+		 * \brief Returns the number of active workers
+		 */
+		int getActiveWorkers() const
+		{
+			return m_Active;
+		}
+
+		/**
+		 * \brief Switches the thieves to stealing the newest items (depth-first) or the oldest ones (breadth-first, the
+		 * default). The owners always pop their newest items.
+		 */
+		void setDepthFirst(bool depthFirst)
+		{
+			m_DepthFirst = depthFirst;
+		}
+
+		/**
+		 * \brief Returns true if the thieves steal the newest items
+		 */
+		bool isDepthFirst() const
+		{
+			return m_DepthFirst;
+		}
+
+		/**
+		 * \brief Appends all the queued items to the specified vector
+		 */
+		void getItems(std::vector<T>& items)
+		{
+			for (std::unique_ptr<WorkerDeque>& d : m_Deques)
+			{
+				std::unique_lock<std::mutex> lock(d->mutex);
+				items.insert(items.end(), d->items.begin(), d->items.end());
+			}
+		}
+
+		/**
+		 * \brief Wakes up all the parked workers and makes \ref pop() return false from now on
+		 */
+		void stop()
+		{
+			std::unique_lock<std::mutex> lock(m_ParkMutex);
+			m_Stopped = true;
+			m_ParkCondition.notify_all();
+			m_InactiveCondition.notify_all();
+		}
+	};
+}
+
+#endif	/* WORKSTEALINGSCHEDULER_HPP */
@@ -1,16 +1,34 @@
 #include <iostream>
+#include <fstream>
 #include <limits.h>
 #include <set>
+#include <map>
+#include <csignal>
+#include <sys/resource.h>
 
 #include "config.h"
 #include "vendor/cmdline.h"
 #include "Walker.hpp"
+#include "FileSink.hpp"
+#include "ColumnarReader.hpp"
+#include "SnapshotDiff.hpp"
 #include "Stopwatch.hpp"
+#include "ThreadController.hpp"
 
 #define VERSION_MAJOR "0"
 #define VERSION_MINOR "6"
 #define VERSION VERSION_MAJOR "." VERSION_MINOR
 
+static volatile sig_atomic_t telemetryRequested = 0; //!< Set by SIGUSR1 to write the telemetry file right away
+
+/**
+ * \brief Handles SIGUSR1, by requesting the telemetry file to be written
+ */
+void requestTelemetry(int)
+{
+	telemetryRequested = 1;
+}
+
 /**
  * A simple method that will split the specified string by the specified delimeter,
  * returning only distinct non-empty elements after splitting
@@ -53,10 +71,163 @@ bool fileExists(const std::string& path)
 	return (stat(path.c_str(), &buffer) == 0);
 }
 
-int main(int argc, char** argv)
+/**
+ * \brief Parses the specified list of device pools, separated by a colon, each given as the path of a directory on the
+ * device, an equal sign and the number of walker threads of the pool (e.g. /mnt/nfs=32). Stores the number of threads
+ * of each device in deviceThreads, and their paths in devicePaths.
+ * \return True on success, false otherwise, with a description of the error in error
+ */
+bool parseDeviceThreads(const std::string& spec, std::map<dev_t, int>& deviceThreads, std::map<dev_t, std::string>& devicePaths,
+		std::string& error)
+{
+	for (const std::string& pool : split(spec, ':'))
+	{
+		size_t equal = pool.rfind('=');
+		char* end;
+		long threads = equal != std::string::npos ? strtol(pool.c_str() + equal + 1, &end, 10) : 0;
+		struct stat sb;
+
+		if (equal == std::string::npos || equal == 0 || *end != '\0' || threads < 1 || threads > 1024)
+		{
+			error = pool + ": expected <path>=<threads>, with 1 to 1024 threads";
+			return false;
+		}
+
+		std::string path = pool.substr(0, equal);
+
+		if (stat(path.c_str(), &sb) != 0)
+		{
+			error = path + ": " + strerror(errno);
+			return false;
+		}
+
+		if (deviceThreads.count(sb.st_dev) > 0)
+		{
+			error = path + ": on the same device as " + devicePaths[sb.st_dev];
+			return false;
+		}
+
+		deviceThreads[sb.st_dev] = threads;
+		devicePaths[sb.st_dev] = path;
+	}
+
+	return true;
+}
+
+/**
+ * \brief Converts the specified columnar snapshot to a CSV file
+ * \return The exit code of the program
+ */
+int convertToCsv(const std::string& snapshotPath, const std::string& outputPath, bool human, int compressThreads)
+{
+	pstat::ColumnarReader reader;
+	
+	if (!reader.open(snapshotPath))
+	{
+		std::cerr << "Error: cannot read the snapshot (" << snapshotPath << "): " << reader.getError() << std::endl;
+		return -1;
+	}
+	
+	pstat::CsvWriter writer(human, compressThreads, CSV_WRITE_BUFFER_SIZE, reader.getOptions().hardlinks == pstat::HARDLINKS_MARK);
+	
+	if (!writer.open(outputPath))
+	{
+		std::cerr << "Error: cannot open the output file (" << outputPath << "): " << strerror(writer.getError()) << std::endl;
+		return -1;
+	}
+	
+	writer.writeHeader();
+	
+	bool read = reader.forEach([&writer](const pstat::StatRecord& rec, const std::string& path)
+	{
+		writer.writeRecord(rec, "", 0, path.data(), path.size());
+	});
+	
+	if (!writer.close())
+	{
+		std::cerr << "Error: cannot write the output file (" << outputPath << "): " << strerror(writer.getError()) << std::endl;
+		return -1;
+	}
+	
+	if (!read)
+	{
+		std::cerr << "Error: cannot read the snapshot (" << snapshotPath << "): " << reader.getError() << std::endl;
+		return -1;
+	}
+	
+	std::cout << "Converted " << reader.getRecordsCount() << " stat records to " << outputPath << std::endl;
+	
+	return 0;
+}
+
+/**
+ * \brief Writes the changes between the specified columnar snapshots to a CSV file, sorting both snapshots by the
+ * specified key first
+ * \param memoryBytes The memory budget of the sorts, shared by the two snapshots
+ * \param threads Number of threads that sort each snapshot
+ * \param tempDir Directory where the sorted runs that do not fit in memory are spilled
+ * \return The exit code of the program
+ */
+int diffSnapshots(const std::string& oldPath, const std::string& newPath, const std::string& outputPath, pstat::SnapshotKey key,
+		size_t memoryBytes, int threads, const std::string& tempDir, int compressThreads)
+{
+	pstat::SnapshotSorter oldSnapshot(key, memoryBytes / 2, threads, tempDir);
+	pstat::SnapshotSorter newSnapshot(key, memoryBytes / 2, threads, tempDir);
+	pstat::SnapshotDiff diff(key, compressThreads);
+	pstat::Stopwatch watch(true);
+	
+	if (!oldSnapshot.sort(oldPath))
+	{
+		std::cerr << "Error: cannot sort the snapshot (" << oldPath << "): " << oldSnapshot.getError() << std::endl;
+		return -1;
+	}
+	
+	std::cout << "Sorted " << oldSnapshot.getRecordsCount() << " records of " << oldPath << " (" << oldSnapshot.getSpilledRunsCount()
+			<< " runs spilled to disk)" << std::endl;
+	
+	if (!newSnapshot.sort(newPath))
+	{
+		std::cerr << "Error: cannot sort the snapshot (" << newPath << "): " << newSnapshot.getError() << std::endl;
+		return -1;
+	}
+	
+	std::cout << "Sorted " << newSnapshot.getRecordsCount() << " records of " << newPath << " (" << newSnapshot.getSpilledRunsCount()
+			<< " runs spilled to disk)" << std::endl;
+	
+	if (!diff.write(oldSnapshot, newSnapshot, outputPath))
+	{
+		std::cerr << "Error: cannot diff the snapshots: " << diff.getError() << std::endl;
+		return -1;
+	}
+	
+	watch.stop();
+	std::cout << "Wrote the changes to " << outputPath << " in " << watch.getElapsed() << "s: " << diff.getAddedCount() << " added, "
+			<< diff.getRemovedCount() << " removed, " << diff.getModifiedCount() << " modified, " << diff.getUnchangedCount()
+			<< " unchanged" << std::endl;
+	
+	return 0;
+}
+
+/**
+ * \brief Asks whether the specified output file, which exists, can be overwritten
+ * \return True if it can, false otherwise
+ */
+bool confirmOverwrite(const std::string& outputPath)
 {
-	pstat::CachedUtilities::init();
+	std::cout << "The specified output file (" << outputPath << ") already exists. Do you want to overwrite it? [Y/n]: ";
+	char answer = std::cin.get();
+
+	if (answer != 'Y' && answer != 'y' && answer != '\n')
+	{
+		std::cout << "The operation was canceled by the user." << std::endl;
+		return false;
+	}
 	
+	return true;
+}
+
+int main(int argc, char** argv)
+{
 	// <editor-fold defaultstate="collapsed" desc="Command-line args parsing">
 	cmdline::parser argsParser;
 	argsParser.set_program_name(argv[0]);
@@ -64,14 +235,87 @@ int main(int argc, char** argv)
 			  "from the target stat path.", false);
 	argsParser.add<int>("num-threads", 't', "Number of threads that walk the path tree. Defaults to number of cores in "
 			  "the machine if not specified.", false, std::thread::hardware_concurrency(), cmdline::range(1, 1024));
-	argsParser.add<unsigned long>("check-interval", 'i', "Time interval, in milliseconds, to check for parallel stat completion. "
-			  "Default is 200 ms. Set it to >1000 ms if pstat fails to stat all the files within the tree of the specified path.",
-			  false, 200, cmdline::range(200, 300000));
-	argsParser.add<std::string>("ignore-list", 'g', "List of full paths to ignore, separated by a colon (e.g. /etc:/dev/null).", false);
+	argsParser.add("auto-threads", 'A', "Adjusts the number of active walker threads during the collection, from the observed "
+			  "throughput, between --min-threads and --max-threads, starting from --num-threads. The decisions are logged.");
+	argsParser.add<int>("min-threads", '\0', "Minimum number of active walker threads, with --auto-threads. Default is 1.",
+			  false, 1, cmdline::range(1, 1024));
+	argsParser.add<int>("max-threads", '\0', "Maximum number of active walker threads, with --auto-threads. Default is 256.",
+			  false, 256, cmdline::range(1, 1024));
+	argsParser.add<unsigned long>("auto-threads-interval", '\0', "Time interval, in milliseconds, between two adjustments of "
+			  "the number of walker threads, with --auto-threads. Default is 1000 ms.", false, THREAD_CONTROLLER_DEFAULT_INTERVAL,
+			  cmdline::range(100, 600000));
+	argsParser.add<unsigned long>("check-interval", 'i', "Time interval, in milliseconds, between progress reports. "
+			  "Default is 200 ms.", false, 200, cmdline::range(10, 300000));
+	argsParser.add<std::string>("ignore-list", 'g', "List of path patterns to ignore, separated by a colon (e.g. /etc:/dev/null:.snapshot:*.o). "
+			  "Patterns starting with / are full paths, others match at any depth. *, ? and [...] match within a path component, "
+			  "and ** matches any number of components. Ignored directories are not traversed.", false);
+	argsParser.add<std::string>("ignore-file", 'G', "File listing path patterns to ignore, one per line, as in --ignore-list.", false);
 	argsParser.add("human", 'h', "Displays the results in human-readable format (e.g., UIDs and GIDs are resolved to names).");
+	argsParser.add("statx", 's', "Stat using statx(), asking the filesystem only for the fields that are output. "
+			  "Falls back to lstat() semantics via fstatat() if statx() is not supported.");
+	argsParser.add("dont-sync", 'd', "Implies --statx. Lets network filesystems (e.g. NFS) return cached attributes "
+			  "instead of revalidating them with the server (AT_STATX_DONT_SYNC).");
+	argsParser.add("io-uring", 'u', "Submit the open and stat calls of the walker threads in batches through io_uring, keeping "
+			  "hundreds of requests in flight per thread. Falls back to synchronous calls if the kernel does not support it.");
+	argsParser.add<int>("shards", 'S', "Number of output shards, each written by its own thread. With more than 1, the records "
+			  "are split among <output>.000, <output>.001, ..., and the output file lists the shards and their record counts. "
+			  "Default is 1.", false, 1, cmdline::range(1, 1000));
+	argsParser.add<std::string>("format", 'f', "Output format: csv, or columnar for a compact binary snapshot that can be "
+			  "converted to CSV later with --to-csv. Default is csv.", false, "csv", cmdline::oneof<std::string>("csv", "columnar"));
+	argsParser.add("to-csv", 'c', "Converts the columnar snapshot given as the target path to a CSV file (raw, or human-readable "
+			  "with --human), then exits.");
+	argsParser.add("compress", 'z', "Writes the CSV output gzip-compressed, as it is collected. The file is made of independently "
+			  "compressed blocks, and can be read by zcat or gzip -d.");
+	argsParser.add<int>("compress-threads", '\0', "Number of compressor threads of each output shard, with --compress. "
+			  "Default is 2.", false, 2, cmdline::range(1, 256));
+	argsParser.add<std::string>("baseline", 'b', "Columnar snapshot of a previous collection of the same path (or the manifest "
+			  "of its shards). The entries of the directories that are unchanged since are copied from it, instead of read and "
+			  "stated again. Only their subdirectories are stated, as they may have changed on their own.", false);
+	argsParser.add<std::string>("where", 'w', "Only outputs the records matching the specified expression, e.g. "
+			  "'type==FILE && size>1G && atime<-180d'. Directories are traversed whether they match or not. See the README for "
+			  "the fields and values.", false);
+	argsParser.add<std::string>("hardlinks", 'l', "How the files with several hard links are accounted for: count outputs every "
+			  "link as is, mark outputs every link with a LINK column telling the first one found (PRIMARY), which alone carries "
+			  "its space on disk in the totals, from the others (DUPLICATE), drop only outputs the first link found. Default is count.", false, "count",
+			  cmdline::oneof<std::string>("count", "mark", "drop"));
+	argsParser.add("one-file-system", 'x', "Does not traverse the directories on other filesystems than the target path's "
+			  "(mount points are output, but not their content).");
+	argsParser.add<std::string>("device-threads", '\0', "Traverses the directories of some filesystems with pools of walker "
+			  "threads of their own, given as <path>=<threads> separated by a colon (e.g. /mnt/nfs=32:/mnt/scratch=8), where path "
+			  "is any directory on the filesystem. The other filesystems are traversed by the --num-threads walker threads.", false);
+	argsParser.add("aggregate", 'a', "Writes summary tables instead of one record per entry: the recursive totals of the "
+			  "directories (to the output file), and the totals per user and group and the histograms of the file sizes and "
+			  "access ages (to the output file name without its .csv extension, followed by .users.csv, .groups.csv, .sizes.csv "
+			  "and .ages.csv).");
+	argsParser.add<unsigned int>("aggregate-depth", '\0', "Maximum depth, below the target path, of the directories listed "
+			  "with --aggregate. Default is 3.", false, AGGREGATE_DEFAULT_DEPTH);
+	argsParser.add<std::string>("checkpoint", 'k', "Periodically takes a checkpoint of the collection to the specified file, "
+			  "from which it can be resumed with --resume should it be interrupted. The file is removed once the collection "
+			  "completes.", false);
+	argsParser.add<unsigned long>("checkpoint-interval", '\0', "Time interval, in seconds, between checkpoints. "
+			  "Default is 300 s.", false, 300, cmdline::range(1, 604800));
+	argsParser.add<std::string>("resume", 'r', "Resumes the interrupted collection whose checkpoint is the specified file, "
+			  "and keeps taking checkpoints to it. The target path and the other options must be the same as the interrupted "
+			  "collection's.", false);
+	argsParser.add<unsigned long>("max-memory", 'M', "Memory budget of the collection, in MB. The walker threads wait for the "
+			  "output threads rather than buffer more records than the budget allows, and traverse the tree depth-first while the "
+			  "queued directories take a large share of it. The queue depth and memory use are reported with the progress. "
+			  "Default is 0, for no limit.", false, 0, cmdline::range(0, 1 << 24));
+	argsParser.add<std::string>("telemetry", 'T', "Instruments the collection, and periodically writes its telemetry (per-thread "
+			  "counters, latency histograms of the system calls and queue depths) to the specified file: as JSON if its name "
+			  "ends with .json, in the Prometheus text format otherwise. The file is also written on SIGUSR1.", false);
+	argsParser.add<unsigned long>("telemetry-interval", '\0', "Time interval, in seconds, between two writes of the telemetry "
+			  "file. Default is 10 s.", false, 10, cmdline::range(1, 86400));
+	argsParser.add<std::string>("diff-key", '\0', "With pstat diff, what identifies an entry across the snapshots: path, or "
+			  "inode to find the entries that moved. Default is path.", false, "path", cmdline::oneof<std::string>("path", "inode"));
+	argsParser.add<unsigned long>("sort-memory", '\0', "With pstat diff, memory budget of the sorts of the snapshots, in MB. "
+			  "The sorted runs that do not fit are spilled to --temp-dir. Default is 1024 MB.", false, SNAPSHOT_SORT_DEFAULT_MEMORY,
+			  cmdline::range(16, 1 << 24));
+	argsParser.add<std::string>("temp-dir", '\0', "With pstat diff, directory where the sorted runs are spilled. Default is "
+			  "the directory of the output file.", false);
 	argsParser.add("no-prompt", 'y', "Do not prompt if the specified output file exist, go ahead an overwrite.");
 	argsParser.add("version", 'v', "Prints version info an exits.");
-	argsParser.footer("<target stat path>");
+	argsParser.footer("<target stat path> | diff <old snapshot> <new snapshot>");
 
 	argsParser.parse_check(argc, argv);
 	
@@ -94,13 +338,86 @@ int main(int argc, char** argv)
 		return 0;
 	}
 
+	// Compare two columnar snapshots
+	if (argsParser.rest()[0] == "diff")
+	{
+		if (argsParser.rest().size() != 3)
+		{
+			std::cout << "Wrong usage - pstat diff <old snapshot> <new snapshot>" << std::endl;
+			std::cout << argsParser.usage() << std::endl;
+
+			return 0;
+		}
+
+		bool compress = argsParser.exist("compress");
+		std::string outputPath = argsParser.get<std::string>("output-csv");
+		std::string tempDir = argsParser.get<std::string>("temp-dir");
+
+		if (compress && !pstat::CsvWriter::isCompressionSupported())
+		{
+			std::cerr << "Error: this version of pstat is built without zlib, so it cannot compress its output. Aborting..." << std::endl;
+			return -1;
+		}
+
+		if (outputPath.size() == 0)
+		{
+			// Named after the new snapshot, in the current directory
+			std::string newPath = argsParser.rest()[2];
+			outputPath = newPath.substr(newPath.rfind('/') + 1) + ".diff.csv" + (compress ? ".gz" : "");
+		}
+
+		if (tempDir.size() == 0)
+		{
+			std::string::size_type slash = outputPath.rfind('/');
+			tempDir = slash == std::string::npos ? "." : slash == 0 ? "/" : outputPath.substr(0, slash);
+		}
+
+		if (!argsParser.exist("no-prompt") && fileExists(outputPath) && !confirmOverwrite(outputPath))
+		{
+			return 0;
+		}
+
+		return diffSnapshots(argsParser.rest()[1], argsParser.rest()[2], outputPath, argsParser.get<std::string>("diff-key") == "inode"
+				? pstat::SNAPSHOT_KEY_INODE : pstat::SNAPSHOT_KEY_PATH, argsParser.get<unsigned long>("sort-memory") << 20,
+				argsParser.get<int>("num-threads"), tempDir, compress ? argsParser.get<int>("compress-threads") : 0);
+	}
+
 	std::string path = resolvePath(argsParser.rest()[0].c_str());
 	std::string outputPath = argsParser.get<std::string>("output-csv");
 	std::string ignore = argsParser.get<std::string>("ignore-list");
+	std::string ignoreFile = argsParser.get<std::string>("ignore-file");
+	std::string baselinePath = argsParser.get<std::string>("baseline");
+	std::string where = argsParser.get<std::string>("where");
+	std::string checkpointPath = argsParser.get<std::string>("checkpoint");
+	unsigned long checkpointInterval = argsParser.get<unsigned long>("checkpoint-interval");
+	std::string resumePath = argsParser.get<std::string>("resume");
 	int numThreads = argsParser.get<int>("num-threads");
 	unsigned long checkInterval = argsParser.get<unsigned long>("check-interval");
+	std::string telemetryPath = argsParser.get<std::string>("telemetry");
+	unsigned long telemetryInterval = argsParser.get<unsigned long>("telemetry-interval");
+	unsigned long maxMemory = argsParser.get<unsigned long>("max-memory");
+	bool autoThreads = argsParser.exist("auto-threads");
+	int minThreads = argsParser.get<int>("min-threads");
+	int maxThreads = argsParser.get<int>("max-threads");
+	unsigned long autoThreadsInterval = argsParser.get<unsigned long>("auto-threads-interval");
 	bool human = argsParser.exist("human");
+	
+	pstat::CachedUtilities::init(human);
 	bool noPrompt = argsParser.exist("no-prompt");
+	bool dontSync = argsParser.exist("dont-sync");
+	bool useStatx = dontSync || argsParser.exist("statx");
+	bool useIoUring = argsParser.exist("io-uring");
+	int shards = argsParser.get<int>("shards");
+	bool toCsv = argsParser.exist("to-csv");
+	pstat::OutputFormat format = argsParser.get<std::string>("format") == "columnar" && !toCsv ? pstat::OUTPUT_FORMAT_COLUMNAR : pstat::OUTPUT_FORMAT_CSV;
+	std::string hardlinks = argsParser.get<std::string>("hardlinks");
+	pstat::HardlinkMode hardlinkMode = hardlinks == "mark" ? pstat::HARDLINKS_MARK : hardlinks == "drop" ? pstat::HARDLINKS_DROP : pstat::HARDLINKS_COUNT;
+	bool oneFileSystem = argsParser.exist("one-file-system");
+	std::string devicePools = argsParser.get<std::string>("device-threads");
+	bool aggregate = argsParser.exist("aggregate");
+	unsigned int aggregateDepth = argsParser.get<unsigned int>("aggregate-depth");
+	bool compress = argsParser.exist("compress");
+	int compressThreads = compress ? argsParser.get<int>("compress-threads") : 0;
 	
 	std::set<std::string> ignoreList;
 	
@@ -109,6 +426,87 @@ int main(int argc, char** argv)
 		ignoreList = split(ignore, ':');
 	}
 	
+	if(ignoreFile.length() > 0)
+	{
+		std::ifstream file(ignoreFile.c_str());
+		std::stringstream patterns;
+		
+		if (!file)
+		{
+			std::cerr << "Error: cannot read the ignore file (" << ignoreFile << "). Aborting..." << std::endl;
+			return -1;
+		}
+		
+		patterns << file.rdbuf();
+		std::set<std::string> filePatterns = split(patterns.str(), '\n');
+		ignoreList.insert(filePatterns.begin(), filePatterns.end());
+	}
+	
+	if (compress && !pstat::CsvWriter::isCompressionSupported())
+	{
+		std::cerr << "Error: this version of pstat is built without zlib, so it cannot compress its output. Aborting..." << std::endl;
+		return -1;
+	}
+	
+	if (compress && format == pstat::OUTPUT_FORMAT_COLUMNAR)
+	{
+		std::cerr << "Error: --compress only applies to the CSV format. Aborting..." << std::endl;
+		return -1;
+	}
+	
+	if (autoThreads && minThreads > maxThreads)
+	{
+		std::cerr << "Error: --min-threads cannot be larger than --max-threads. Aborting..." << std::endl;
+		return -1;
+	}
+	
+	std::map<dev_t, int> deviceThreads;
+	std::map<dev_t, std::string> devicePaths;
+	std::string deviceError;
+	
+	if (devicePools.length() > 0 && !parseDeviceThreads(devicePools, deviceThreads, devicePaths, deviceError))
+	{
+		std::cerr << "Error: invalid --device-threads (" << deviceError << "). Aborting..." << std::endl;
+		return -1;
+	}
+	
+	pstat::RecordFilter filter;
+	
+	if (where.length() > 0 && !filter.compile(where))
+	{
+		std::cerr << "Error: invalid --where expression (" << where << "): " << filter.getError() << ". Aborting..." << std::endl;
+		return -1;
+	}
+	
+	if (aggregate && (format == pstat::OUTPUT_FORMAT_COLUMNAR || shards > 1 || compress || toCsv))
+	{
+		std::cerr << "Error: --aggregate cannot be combined with --format columnar, --shards, --compress or --to-csv. Aborting..." << std::endl;
+		return -1;
+	}
+	
+	if (aggregate && (checkpointPath.length() > 0 || resumePath.length() > 0))
+	{
+		std::cerr << "Error: --aggregate cannot be combined with --checkpoint or --resume. Aborting..." << std::endl;
+		return -1;
+	}
+	
+	// The inodes found before a checkpoint are not saved, so a resumed collection would account for some of them twice
+	if (hardlinkMode != pstat::HARDLINKS_COUNT && (checkpointPath.length() > 0 || resumePath.length() > 0))
+	{
+		std::cerr << "Error: --hardlinks " << hardlinks << " cannot be combined with --checkpoint or --resume. Aborting..." << std::endl;
+		return -1;
+	}
+	
+	if (aggregate)
+	{
+		format = pstat::OUTPUT_FORMAT_AGGREGATE;
+	}
+	
+	if (resumePath.length() > 0 && checkpointPath.length() == 0)
+	{
+		checkpointPath = resumePath;
+	}
+	
 	// Make sure the target path exists
 	if(!fileExists(path))
 	{
@@ -119,7 +517,8 @@ int main(int argc, char** argv)
 	if (outputPath.size() == 0)
 	{
 		// If no output is specified, construct the csv file name using the specified path -- replacing / with - 
-		outputPath = path + ".csv";
+		outputPath = path + (format == pstat::OUTPUT_FORMAT_COLUMNAR ? ".pcol" : format == pstat::OUTPUT_FORMAT_AGGREGATE ? ".summary.csv" : ".csv")
+				+ (compress ? ".gz" : "");
 		
 		if(outputPath[0] == '/')
 		{
@@ -134,25 +533,51 @@ int main(int argc, char** argv)
 		outputPath = resolvePath(argsParser.get<std::string>("output-csv").c_str());
 	}
 	
-	// Prompt if the file exists
-	if(!noPrompt && fileExists(outputPath))
+	pstat::CollectionOptions options;
+	options.exclusions = ignoreList;
+	options.oneFileSystem = oneFileSystem;
+	options.filter = where;
+	options.hardlinks = hardlinkMode;
+	
+	if (baselinePath.length() > 0 && fileExists(baselinePath))
 	{
-		std::cout << "The specified output file (" << outputPath << ") already exists. Do you want to overwrite it? [Y/n]: ";
-		char answer = std::cin.get();
-
-		if (answer != 'Y' && answer != 'y' && answer != '\n')
+		baselinePath = resolvePath(baselinePath.c_str());
+	}
+	
+	pstat::Checkpoint checkpoint;
+	
+	if (resumePath.length() > 0)
+	{
+		if (!checkpoint.read(resumePath))
 		{
-			std::cout << "The operation was canceled by the user." << std::endl;
-			return 0;
+			std::cerr << "Error: cannot read the checkpoint (" << resumePath << "): " << checkpoint.getError() << ". Aborting..." << std::endl;
+			return -1;
 		}
+		
+		if (checkpoint.path != path || checkpoint.outputPath != outputPath || checkpoint.format != format || checkpoint.human != human
+				|| checkpoint.compressed != compress || static_cast<int>(checkpoint.shards.size()) != shards
+				|| checkpoint.options != options || checkpoint.baseline != baselinePath)
+		{
+			std::cerr << "Error: the checkpoint (" << resumePath << ") is of another collection: it collects " << checkpoint.path
+					<< " to " << checkpoint.outputPath << ", with other options. Aborting..." << std::endl;
+			return -1;
+		}
+	}
+	
+	// Prompt if the file exists
+	if(!noPrompt && resumePath.length() == 0 && fileExists(outputPath) && !confirmOverwrite(outputPath))
+	{
+		return 0;
 	}
 	
 	// </editor-fold>
 	
+	if (toCsv)
+	{
+		return convertToCsv(path, outputPath, human, compressThreads);
+	}
+	
 	std::cout << "pstat v" << VERSION << " - Parallel stat collector" << std::endl;
-#ifndef HAVE_TBB_HEADERS_
-	std::cout << "NOTE: this version is not using Thread Building Blocks classes. You will not get the maximum performance." << std::endl;
-#endif
 	std::cout << std::endl;
 	
 	// In case number of hardware threads not detected
@@ -163,35 +588,250 @@ int main(int argc, char** argv)
 	}
 	
 	std::cout << "Collecting stat from: " << path << std::endl;
-	std::cout << "Number of threads: " << numThreads << std::endl;
-	std::cout << "CSV output file: " << outputPath << std::endl;
+	pstat::ThreadController controller(minThreads, maxThreads, numThreads);
+	
+	if (autoThreads)
+	{
+		std::cout << "Number of threads: auto (" << minThreads << " to " << maxThreads << ", starting with "
+				<< controller.getThreads() << ", adjusted every " << autoThreadsInterval << " ms)" << std::endl;
+	}
+	else
+	{
+		std::cout << "Number of threads: " << numThreads << std::endl;
+	}
+	
+	if (format == pstat::OUTPUT_FORMAT_AGGREGATE)
+	{
+		std::cout << "Summary output files: " << outputPath << " (directories up to depth " << aggregateDepth << "), "
+				<< pstat::Aggregator::getTablePath(outputPath, "{users,groups,sizes,ages}") << std::endl;
+	}
+	else
+	{
+		std::cout << (format == pstat::OUTPUT_FORMAT_COLUMNAR ? "Columnar output file: " : "CSV output file: ") << outputPath << std::endl;
+	}
+
+	if (compress)
+	{
+		std::cout << "Compression: gzip (" << compressThreads << " threads" << (shards > 1 ? " per shard" : "") << ")" << std::endl;
+	}
+
+	if (shards > 1)
+	{
+		std::cout << "Output shards: " << shards << " (" << pstat::FileSink::getShardPath(outputPath, 0) << " to "
+				<< pstat::FileSink::getShardPath(outputPath, shards - 1) << ")" << std::endl;
+	}
+
+	if (!filter.isEmpty())
+	{
+		std::cout << "Filter: " << where << std::endl;
+	}
+
+	if (oneFileSystem)
+	{
+		std::cout << "One file system: Yes" << std::endl;
+	}
+
+	for (const std::pair<const dev_t, int>& device : deviceThreads)
+	{
+		std::cout << "Device pool: " << devicePaths[device.first] << " (" << device.second << " threads)" << std::endl;
+	}
+
+	if (hardlinkMode != pstat::HARDLINKS_COUNT)
+	{
+		std::cout << "Hard links: " << hardlinks << std::endl;
+	}
+
+	if (checkpointPath.length() > 0)
+	{
+		std::cout << "Checkpoints: " << checkpointPath << " (every " << checkpointInterval << " s)" << std::endl;
+	}
+
+	if (resumePath.length() > 0)
+	{
+		std::cout << "Resuming from: " << resumePath << " (" << checkpoint.stated << " records collected, "
+				<< checkpoint.directories.size() << " directories left)" << std::endl;
+	}
+
+	if (maxMemory > 0)
+	{
+		std::cout << "Memory budget: " << maxMemory << " MB" << std::endl;
+	}
+
+	if (telemetryPath.length() > 0)
+	{
+		std::cout << "Telemetry: " << telemetryPath << " (every " << telemetryInterval << " s, and on SIGUSR1)" << std::endl;
+	}
+
 	std::cout << "Check interval: " << checkInterval << " ms" << std::endl;
 	std::cout << "Human output: " << (human ? "Yes" : "No") << std::endl;
+	std::cout << "I/O engine: " << (useIoUring ? "io_uring" : "sync") << std::endl;
+	std::cout << "Stat backend: " << (useStatx ? (dontSync ? "statx (don't sync)" : "statx") : "lstat") << std::endl;
+	
+	std::unique_ptr<pstat::BaselineIndex> baseline;
+	
+	if (baselinePath.length() > 0)
+	{
+		pstat::Stopwatch baselineWatch(true);
+		baseline.reset(new pstat::BaselineIndex());
+		
+		if (!baseline->open(baselinePath))
+		{
+			std::cerr << "Error: cannot read the baseline (" << baselinePath << "): " << baseline->getError() << std::endl;
+			return -1;
+		}
+		
+		std::string reason;
+		
+		if (!baseline->getOptions().covers(options, reason))
+		{
+			std::cerr << "Error: the baseline (" << baselinePath << ") lacks entries of this collection: " << reason << ". Aborting..." << std::endl;
+			return -1;
+		}
+		
+		baselineWatch.stop();
+		std::cout << "Baseline: " << baselinePath << " (" << baseline->getRecordsCount() << " records, "
+				<< baseline->getDirectoriesCount() << " directories, indexed in " << baselineWatch.getElapsed() << "s)" << std::endl;
+	}
+	
+	if (telemetryPath.length() > 0)
+	{
+		signal(SIGUSR1, requestTelemetry);
+	}
+	
 	std::cout << std::endl;
 	std::cout << "* Collection started" << std::endl;
 	
 	pstat::Stopwatch watch(true);
-	pstat::Walker walker(path, outputPath, ignoreList, human, numThreads);
+	pstat::FileSink sink(outputPath, human, shards, format, compressThreads, resumePath.length() > 0 ? &checkpoint : NULL, options);
+	
+	if (!sink.isOpen())
+	{
+		std::cerr << "Error: cannot open the output file (" << outputPath << "). Aborting..." << std::endl;
+		return -1;
+	}
+	
+	pstat::WalkerOptions walkerOptions;
+	walkerOptions.skipList = ignoreList;
+	walkerOptions.walkerThreads = autoThreads ? maxThreads : numThreads;
+	walkerOptions.useStatx = useStatx;
+	walkerOptions.dontSync = dontSync;
+	walkerOptions.useIoUring = useIoUring;
+	walkerOptions.aggregate = aggregate;
+	walkerOptions.baseline = baseline.get();
+	walkerOptions.filter = filter.isEmpty() ? NULL : &filter;
+	walkerOptions.resume = resumePath.length() > 0 ? &checkpoint : NULL;
+	walkerOptions.hardlinks = hardlinkMode;
+	walkerOptions.oneFileSystem = oneFileSystem;
+	walkerOptions.deviceThreads = deviceThreads;
+	walkerOptions.telemetry = telemetryPath.length() > 0 || autoThreads;
+	walkerOptions.maxMemory = static_cast<size_t>(maxMemory) << 20;
+	pstat::Walker<pstat::FileSink> walker(sink, path, walkerOptions);
 	
-	// Convert to usec
-	checkInterval *= 1000ul;
+	if (useIoUring && !walker.isUsingIoUring())
+	{
+		std::cerr << "Warning: io_uring is not supported by this system. Using synchronous system calls instead." << std::endl;
+	}
 	
-	size_t oldSize = 0;
-	size_t newSize;
-	while(true)
+	if (autoThreads)
 	{
-		usleep(checkInterval);
+		walker.setActiveWalkerThreads(controller.getThreads());
+	}
+	
+	walker.start();
+	
+	// Report progress until the walker signals that every directory is traversed
+	pstat::Stopwatch checkpointWatch(true);
+	pstat::Stopwatch autoThreadsWatch(true);
+	pstat::Stopwatch telemetryWatch(true);
+	u_int64_t sampledRecords = walker.getTotalNumberOfRecords();
+	u_int64_t sampledStats = 0;
+	u_int64_t sampledStatNanoseconds = 0;
+	
+	while(!walker.waitForCompletion(checkInterval))
+	{
+		if (maxMemory > 0)
+		{
+			walker.balanceMemory();
+			std::cout << "-- Collected " << walker.getTotalNumberOfRecords() << " stat records so far (" << walker.getPendingDirectoriesCount()
+					<< " directories pending, " << (walker.getMemoryBytes() >> 20) << " MB buffered, " << (pstat::getResidentBytes() >> 20)
+					<< " MB resident" << (walker.isDepthFirst() ? ", depth-first" : "") << ")..." << std::endl;
+		}
+		else
+		{
+			std::cout << "-- Collected " << walker.getTotalNumberOfRecords() << " stat records so far..." << std::endl;
+		}
+		
+		checkpointWatch.stop();
+		autoThreadsWatch.stop();
+		telemetryWatch.stop();
 		
-		newSize = walker.getTotalNumberOfRecords();
+		if (telemetryPath.length() > 0 && (telemetryRequested || telemetryWatch.getElapsed() >= telemetryInterval))
+		{
+			telemetryRequested = 0;
+			walker.writeTelemetry(telemetryPath);
+			telemetryWatch.start();
+		}
 		
-		if(newSize == oldSize)
+		if (autoThreads && autoThreadsWatch.getElapsed() * 1000 >= autoThreadsInterval)
 		{
-			walker.halt();
-			break;
+			u_int64_t records = walker.getTotalNumberOfRecords();
+			u_int64_t stats = 0;
+			u_int64_t statNanoseconds = 0;
+			std::string decision;
+			
+			walker.getStatLatencies(stats, statNanoseconds);
+			walker.setActiveWalkerThreads(controller.update((records - sampledRecords) / autoThreadsWatch.getElapsed(),
+					stats > sampledStats ? (statNanoseconds - sampledStatNanoseconds) / 1e6 / (stats - sampledStats) : -1,
+					walker.getQueuedDirectoriesCount() < static_cast<size_t>(controller.getThreads()), decision));
+			std::cout << "-- Auto threads: " << decision << std::endl;
+			sampledRecords = records;
+			sampledStats = stats;
+			sampledStatNanoseconds = statNanoseconds;
+			autoThreadsWatch.start();
 		}
 		
-		std::cout << "-- Collected " << newSize << " stat records so far..." << std::endl;
-		oldSize = newSize;
+		if (checkpointPath.length() > 0 && checkpointWatch.getElapsed() >= checkpointInterval)
+		{
+			if (walker.checkpoint(checkpointPath))
+			{
+				std::cout << "-- Checkpoint written to " << checkpointPath << std::endl;
+			}
+			
+			checkpointWatch.start();
+			
+			// The walker threads were paused, leave this time out of the throughput
+			sampledRecords = walker.getTotalNumberOfRecords();
+			autoThreadsWatch.start();
+		}
+	}
+	
+	walker.wait();
+	
+	if (aggregate)
+	{
+		walker.writeSummary(outputPath, aggregateDepth, human);
+	}
+	
+	bool closed = sink.close();
+	
+	// Leave the final counts in the telemetry file
+	if (telemetryPath.length() > 0)
+	{
+		walker.writeTelemetry(telemetryPath);
+	}
+	
+	// The outputs are incomplete, keep the checkpoint to resume from
+	if (!closed)
+	{
+		std::cerr << "Error: cannot write the output file (" << outputPath << ")" << (checkpointPath.length() > 0
+				? ", the collection can be resumed from the last checkpoint (" + checkpointPath + ")" : std::string()) << ". Aborting..." << std::endl;
+		return -1;
+	}
+	
+	// The outputs are complete, the checkpoint is of no use anymore
+	if (checkpointPath.length() > 0)
+	{
+		unlink(checkpointPath.c_str());
 	}
 	
 	watch.stop();
@@ -201,6 +841,31 @@ int main(int argc, char** argv)
 	std::cout << "Elapsed time: " << watch.getElapsed() << "s\n";
 	std::cout << "Total files: " << walker.getTotalNumberOfRecords() << std::endl;
 	std::cout << "Files/second: " << walker.getTotalNumberOfRecords() / watch.getElapsed() << std::endl;
+	
+	if (!filter.isEmpty())
+	{
+		std::cout << "Matching records: " << walker.getMatchedRecordsCount() << std::endl;
+	}
+	
+	if (hardlinkMode != pstat::HARDLINKS_COUNT)
+	{
+		std::cout << "Duplicate links: " << walker.getDuplicateLinksCount() << (hardlinkMode == pstat::HARDLINKS_DROP ? " (dropped)" : " (marked)")
+				<< std::endl;
+	}
+	
+	if (maxMemory > 0)
+	{
+		struct rusage usage;
+		getrusage(RUSAGE_SELF, &usage);
+		std::cout << "Peak memory: " << (usage.ru_maxrss >> 10) << " MB (budget " << maxMemory << " MB)" << std::endl;
+	}
+	
+	if (baseline)
+	{
+		std::cout << "Unchanged directories: " << walker.getUnchangedDirectoriesCount() << " (" << walker.getCopiedRecordsCount()
+				<< " records copied from the baseline)" << std::endl;
+	}
+	
 	std::cout << std::endl;
 	
 	return 0;